@@ -28,6 +28,14 @@
 #include <libaudcore/ringbuf.h>
 #include <libaudcore/runtime.h>
 
+#include "multiband.h"
+#include "../effect-common/effect-params.h"
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+
 /* Response time adjustments.  Maybe this should be adjustable? */
 #define CHUNK_TIME 0.2f /* seconds */
 #define CHUNKS 5
@@ -38,17 +46,79 @@
 static const char * const compressor_defaults[] = {
     "center", "0.5",
     "range", "0.5",
+    "multiband", "FALSE",
+    "mb_low_freq", "250",
+    "mb_high_freq", "4000",
+    "mb_threshold", "-20",
+    "mb_ratio", "3",
+    "ceiling", "-1",
+    "lookahead", "5",
      nullptr
 };
 
+struct CompressorSettings {
+    float center, range;
+    MultibandParams mb;
+};
+
+/* Settings are published here when changed in the UI and picked up by the
+ * audio thread in start() and process() */
+static EffectParams<CompressorSettings> params;
+static CompressorSettings settings;
+
+static void update_config ()
+{
+    CompressorSettings s;
+
+    s.center = aud_get_double ("compressor", "center");
+    s.range = aud_get_double ("compressor", "range");
+
+    s.mb.low_freq = aud_get_double ("compressor", "mb_low_freq");
+    s.mb.high_freq = aud_get_double ("compressor", "mb_high_freq");
+    s.mb.threshold = aud_get_double ("compressor", "mb_threshold");
+    s.mb.ratio = aud_get_double ("compressor", "mb_ratio");
+    s.mb.ceiling = aud_get_double ("compressor", "ceiling");
+    s.mb.lookahead = aud_get_double ("compressor", "lookahead");
+
+    params.publish (s);
+}
+
 static const PreferencesWidget compressor_widgets[] = {
     WidgetLabel (N_("<b>Compression</b>")),
     WidgetSpin (N_("Center volume:"),
-        WidgetFloat ("compressor", "center"),
+        WidgetFloat ("compressor", "center", update_config),
         {0.1, 1, 0.1}),
     WidgetSpin (N_("Dynamic range:"),
-        WidgetFloat ("compressor", "range"),
-        {0.0, 3.0, 0.1})
+        WidgetFloat ("compressor", "range", update_config),
+        {0.0, 3.0, 0.1}),
+    WidgetLabel (N_("<b>Multiband Mode</b>")),
+    WidgetCheck (N_("Multiband compressor with look-ahead limiter"),
+        WidgetBool ("compressor", "multiband")),
+    WidgetSpin (N_("Low crossover:"),
+        WidgetFloat ("compressor", "mb_low_freq", update_config),
+        {40, 1000, 10, N_("Hz")},
+        WIDGET_CHILD),
+    WidgetSpin (N_("High crossover:"),
+        WidgetFloat ("compressor", "mb_high_freq", update_config),
+        {1000, 16000, 100, N_("Hz")},
+        WIDGET_CHILD),
+    WidgetSpin (N_("Threshold:"),
+        WidgetFloat ("compressor", "mb_threshold", update_config),
+        {-60, 0, 1, N_("dB")},
+        WIDGET_CHILD),
+    WidgetSpin (N_("Ratio:"),
+        WidgetFloat ("compressor", "mb_ratio", update_config),
+        {1, 20, 0.5},
+        WIDGET_CHILD),
+    WidgetSpin (N_("Limiter ceiling:"),
+        WidgetFloat ("compressor", "ceiling", update_config),
+        {-12, 0, 0.1, N_("dB")},
+        WIDGET_CHILD),
+    WidgetSpin (N_("Look-ahead:"),
+        WidgetFloat ("compressor", "lookahead", update_config),
+        {1, 20, 0.5, N_("ms")},
+        WIDGET_CHILD),
+    WidgetLabel (N_("Mode and look-ahead changes take effect at the next song."))
 };
 
 static const PluginPreferences compressor_prefs = {{compressor_widgets}};
@@ -90,42 +160,170 @@ static RingBuf<float> buffer, peaks;
 static Index<float> output;
 static int chunk_size;
 static float current_peak;
+static float ramp_gain;  /* at the end of the last ramp, 0 if none */
 static int current_channels, current_rate;
 
-/* I used to find the maximum sample and take that as the peak, but that doesn't
- * work well on badly clipped tracks.  Now, I use the highly sophisticated
- * method of averaging the absolute value of the samples and multiplying by 6, a
- * number proved by experiment (on exactly three files) to best approximate the
- * actual peak. */
+/* In multiband mode the chunk buffer above is unused and the audio is
+ * processed in place, delayed by multiband.latency () frames. */
+static bool multiband_mode;
+static MultibandCompressor multiband;
 
-static float calc_peak (float * data, int length)
+/* Inner loops: sum of absolute values and linear gain ramp.  The scalar
+ * versions are always available; on x86, SSE2 and AVX2 versions are compiled
+ * in as well and picked at runtime in init(). */
+
+static float sum_abs_scalar (const float * data, int length)
 {
     float sum = 0;
 
-    float * end = data + length;
+    const float * end = data + length;
     while (data < end)
         sum += fabsf (* data ++);
 
-    return aud::max (0.01f, sum / length * 6);
+    return sum;
 }
 
-static void do_ramp (float * data, int length, float peak_a, float peak_b)
+/* multiplies data[i] by a + step * i */
+static void ramp_scalar (float * data, int length, float a, float step)
 {
-    float center = aud_get_double ("compressor", "center");
-    float range = aud_get_double ("compressor", "range");
-    float a = powf (peak_a / center, range - 1);
-    float b = powf (peak_b / center, range - 1);
-
     for (int count = 0; count < length; count ++)
+        data[count] *= a + step * count;
+}
+
+#ifdef HAVE_X86_KERNELS
+
+__attribute__ ((target ("sse2")))
+static float sum_abs_sse2 (const float * data, int length)
+{
+    const __m128 mask = _mm_castsi128_ps (_mm_set1_epi32 (0x7fffffff));
+    __m128 sum0 = _mm_setzero_ps (), sum1 = _mm_setzero_ps ();
+    int i = 0;
+
+    for (; i + 8 <= length; i += 8)
+    {
+        sum0 = _mm_add_ps (sum0, _mm_and_ps (_mm_loadu_ps (data + i), mask));
+        sum1 = _mm_add_ps (sum1, _mm_and_ps (_mm_loadu_ps (data + i + 4), mask));
+    }
+
+    float part[4];
+    _mm_storeu_ps (part, _mm_add_ps (sum0, sum1));
+
+    return part[0] + part[1] + part[2] + part[3] + sum_abs_scalar (data + i, length - i);
+}
+
+__attribute__ ((target ("sse2")))
+static void ramp_sse2 (float * data, int length, float a, float step)
+{
+    __m128 index = _mm_setr_ps (0, 1, 2, 3);
+    const __m128 four = _mm_set1_ps (4);
+    const __m128 va = _mm_set1_ps (a), vstep = _mm_set1_ps (step);
+    int i = 0;
+
+    for (; i + 4 <= length; i += 4)
+    {
+        __m128 gain = _mm_add_ps (va, _mm_mul_ps (vstep, index));
+        _mm_storeu_ps (data + i, _mm_mul_ps (_mm_loadu_ps (data + i), gain));
+        index = _mm_add_ps (index, four);
+    }
+
+    for (; i < length; i ++)
+        data[i] *= a + step * i;
+}
+
+__attribute__ ((target ("avx2")))
+static float sum_abs_avx2 (const float * data, int length)
+{
+    const __m256 mask = _mm256_castsi256_ps (_mm256_set1_epi32 (0x7fffffff));
+    __m256 sum0 = _mm256_setzero_ps (), sum1 = _mm256_setzero_ps ();
+    int i = 0;
+
+    for (; i + 16 <= length; i += 16)
+    {
+        sum0 = _mm256_add_ps (sum0, _mm256_and_ps (_mm256_loadu_ps (data + i), mask));
+        sum1 = _mm256_add_ps (sum1, _mm256_and_ps (_mm256_loadu_ps (data + i + 8), mask));
+    }
+
+    float part[8];
+    _mm256_storeu_ps (part, _mm256_add_ps (sum0, sum1));
+
+    float sum = 0;
+    for (float p : part)
+        sum += p;
+
+    return sum + sum_abs_scalar (data + i, length - i);
+}
+
+__attribute__ ((target ("avx2")))
+static void ramp_avx2 (float * data, int length, float a, float step)
+{
+    __m256 index = _mm256_setr_ps (0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256 eight = _mm256_set1_ps (8);
+    const __m256 va = _mm256_set1_ps (a), vstep = _mm256_set1_ps (step);
+    int i = 0;
+
+    for (; i + 8 <= length; i += 8)
+    {
+        __m256 gain = _mm256_add_ps (va, _mm256_mul_ps (vstep, index));
+        _mm256_storeu_ps (data + i, _mm256_mul_ps (_mm256_loadu_ps (data + i), gain));
+        index = _mm256_add_ps (index, eight);
+    }
+
+    for (; i < length; i ++)
+        data[i] *= a + step * i;
+}
+
+#endif /* HAVE_X86_KERNELS */
+
+static float (* sum_abs) (const float * data, int length) = sum_abs_scalar;
+static void (* ramp) (float * data, int length, float a, float step) = ramp_scalar;
+
+static void select_kernels ()
+{
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init ();
+
+    if (__builtin_cpu_supports ("avx2"))
     {
-        * data = (* data) * (a * (length - count) + b * count) / length;
-        data ++;
+        AUDDBG ("Using AVX2 kernels.\n");
+        sum_abs = sum_abs_avx2;
+        ramp = ramp_avx2;
     }
+    else if (__builtin_cpu_supports ("sse2"))
+    {
+        AUDDBG ("Using SSE2 kernels.\n");
+        sum_abs = sum_abs_sse2;
+        ramp = ramp_sse2;
+    }
+#endif
+}
+
+/* I used to find the maximum sample and take that as the peak, but that doesn't
+ * work well on badly clipped tracks.  Now, I use the highly sophisticated
+ * method of averaging the absolute value of the samples and multiplying by 6, a
+ * number proved by experiment (on exactly three files) to best approximate the
+ * actual peak. */
+
+static float calc_peak (float * data, int length)
+{
+    return aud::max (0.01f, sum_abs (data, length) / length * 6);
+}
+
+/* Each ramp starts from the gain where the last one ended, so that changes to
+ * the settings are spread over a chunk rather than applied as a step. */
+static void do_ramp (float * data, int length, float peak_a, float peak_b)
+{
+    float a = ramp_gain ? ramp_gain : powf (peak_a / settings.center, settings.range - 1);
+    float b = powf (peak_b / settings.center, settings.range - 1);
+
+    ramp (data, length, a, (b - a) / length);
+    ramp_gain = b;
 }
 
 bool Compressor::init ()
 {
     aud_config_set_defaults ("compressor", compressor_defaults);
+    select_kernels ();
+    update_config ();
     return true;
 }
 
@@ -141,6 +339,16 @@ void Compressor::start (int & channels, int & rate)
     current_channels = channels;
     current_rate = rate;
 
+    params.fetch (settings);
+
+    multiband_mode = aud_get_bool ("compressor", "multiband");
+
+    if (multiband_mode)
+    {
+        multiband.start (channels, rate, settings.mb);
+        return;
+    }
+
     chunk_size = channels * (int) (rate * CHUNK_TIME);
 
     buffer.alloc (chunk_size * CHUNKS);
@@ -151,6 +359,17 @@ void Compressor::start (int & channels, int & rate)
 
 Index<float> & Compressor::process (Index<float> & data)
 {
+    bool changed = params.fetch (settings);
+
+    if (multiband_mode)
+    {
+        if (changed)
+            multiband.set_params (settings.mb);
+
+        multiband.process (data.begin (), data.len () / current_channels);
+        return data;
+    }
+
     output.resize (0);
 
     int offset = 0;
@@ -195,10 +414,17 @@ Index<float> & Compressor::process (Index<float> & data)
 
 bool Compressor::flush (bool force)
 {
+    if (multiband_mode)
+    {
+        multiband.flush ();
+        return true;
+    }
+
     buffer.discard ();
     peaks.discard ();
 
     current_peak = 0.0f;
+    ramp_gain = 0.0f;
     return true;
 }
 
@@ -206,6 +432,18 @@ Index<float> & Compressor::finish (Index<float> & data, bool end_of_playlist)
 {
     output.resize (0);
 
+    if (multiband_mode)
+    {
+        /* push silence through to drain the delay line */
+        output.insert (data.begin (), -1, data.len ());
+        output.insert (-1, multiband.latency () * current_channels);
+
+        multiband.process (output.begin (), output.len () / current_channels);
+        multiband.flush ();
+
+        return output;
+    }
+
     peaks.discard ();
 
     while (buffer.len ())
@@ -228,5 +466,6 @@ Index<float> & Compressor::finish (Index<float> & data, bool end_of_playlist)
 
 int Compressor::adjust_delay (int delay)
 {
-    return delay + aud::rescale<int64_t> (buffer.len () / current_channels, current_rate, 1000);
+    int frames = multiband_mode ? multiband.latency () : buffer.len () / current_channels;
+    return delay + aud::rescale<int64_t> (frames, current_rate, 1000);
 }
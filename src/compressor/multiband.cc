@@ -0,0 +1,320 @@
+/*
+ * Multiband Compressor and Look-ahead Limiter for Audacious
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "multiband.h"
+
+#include <math.h>
+
+#include <libaudcore/objects.h>
+
+#define BLOCK 256         /* frames processed at once */
+#define Q_BUTTERWORTH 0.70710678f
+#define ATTACK_TIME 0.005f   /* seconds */
+#define RELEASE_TIME 0.15f
+#define LIMITER_RELEASE_TIME 0.05f
+
+/* Catmull-Rom weights for the points at 1/4, 1/2 and 3/4 between the two
+ * middle samples, used to estimate inter-sample peaks */
+static const float interp[3][4] = {
+    {-0.0703125f, 0.8671875f, 0.2265625f, -0.0234375f},
+    {-0.0625f, 0.5625f, 0.5625f, -0.0625f},
+    {-0.0234375f, 0.2265625f, 0.8671875f, -0.0703125f}
+};
+
+enum {LOWPASS, HIGHPASS, ALLPASS};
+
+static void design (float * c, int type, float freq, int rate)
+{
+    float w0 = 2 * (float) M_PI * freq / rate;
+    float cosw = cosf (w0);
+    float alpha = sinf (w0) / (2 * Q_BUTTERWORTH);
+    float a0 = 1 + alpha;
+
+    switch (type)
+    {
+    case LOWPASS:
+        c[0] = (1 - cosw) / 2;
+        c[1] = 1 - cosw;
+        c[2] = (1 - cosw) / 2;
+        break;
+    case HIGHPASS:
+        c[0] = (1 + cosw) / 2;
+        c[1] = -(1 + cosw);
+        c[2] = (1 + cosw) / 2;
+        break;
+    case ALLPASS:
+        c[0] = 1 - alpha;
+        c[1] = -2 * cosw;
+        c[2] = 1 + alpha;
+        break;
+    }
+
+    c[3] = -2 * cosw;
+    c[4] = 1 - alpha;
+
+    for (int i = 0; i < 5; i ++)
+        c[i] /= a0;
+}
+
+void MultibandCompressor::start (int channels, int rate, const MultibandParams & params)
+{
+    m_channels = channels;
+    m_rate = rate;
+
+    for (Filter * f : {& m_lp1[0], & m_lp1[1], & m_hp1[0], & m_hp1[1],
+     & m_lp2[0], & m_lp2[1], & m_hp2[0], & m_hp2[1], & m_ap2})
+        f->z.resize (2 * channels);
+
+    m_low.resize (BLOCK * channels);
+    m_mid.resize (BLOCK * channels);
+    m_high.resize (BLOCK * channels);
+
+    m_attack = expf (-1 / (ATTACK_TIME * rate));
+    m_release = expf (-1 / (RELEASE_TIME * rate));
+    m_limiter_release = expf (-1 / (LIMITER_RELEASE_TIME * rate));
+
+    /* The limiter needs the inter-sample peak on both sides of a sample
+     * before it knows the gain for it, hence one extra frame of delay. */
+    m_window = aud::max (1, (int) (params.lookahead * rate / 1000));
+    m_delay = m_window + 1;
+
+    m_hist.resize (4 * channels);
+    m_min_val.resize (m_window);
+    m_min_pos.resize (m_window);
+    m_avg_ring.resize (m_window);
+    m_delay_ring.resize (m_delay * channels);
+
+    set_params (params);
+    flush ();
+}
+
+void MultibandCompressor::set_params (const MultibandParams & params)
+{
+    m_params = params;
+
+    if (m_rate)
+        calc_coefs ();
+
+    m_threshold = powf (10, params.threshold / 20);
+    m_slope = 1 / aud::max (params.ratio, 1.0f) - 1;
+    m_ceiling = powf (10, params.ceiling / 20);
+}
+
+void MultibandCompressor::calc_coefs ()
+{
+    float nyquist = m_rate * 0.45f;
+    float f1 = aud::clamp (m_params.low_freq, 20.0f, nyquist);
+    float f2 = aud::clamp (m_params.high_freq, f1, nyquist);
+
+    /* a Linkwitz-Riley crossover is two Butterworth sections in series */
+    for (int i = 0; i < 2; i ++)
+    {
+        design (& m_lp1[i].c.b0, LOWPASS, f1, m_rate);
+        design (& m_hp1[i].c.b0, HIGHPASS, f1, m_rate);
+        design (& m_lp2[i].c.b0, LOWPASS, f2, m_rate);
+        design (& m_hp2[i].c.b0, HIGHPASS, f2, m_rate);
+    }
+
+    /* the low band skips the second crossover, so give it the same phase */
+    design (& m_ap2.c.b0, ALLPASS, f2, m_rate);
+}
+
+void MultibandCompressor::flush ()
+{
+    for (Filter * f : {& m_lp1[0], & m_lp1[1], & m_hp1[0], & m_hp1[1],
+     & m_lp2[0], & m_lp2[1], & m_hp2[0], & m_hp2[1], & m_ap2})
+    {
+        for (float & z : f->z)
+            z = 0;
+    }
+
+    for (Band & band : m_bands)
+        band = {0, 1};
+
+    for (float & h : m_hist)
+        h = 0;
+    for (float & x : m_delay_ring)
+        x = 0;
+    for (float & g : m_avg_ring)
+        g = 1;
+
+    m_prev_seg = 0;
+    m_min_head = m_min_len = 0;
+    m_avg_sum = m_window;
+    m_pos = 0;
+    m_gain = 1;
+}
+
+/* Transposed direct form II.  Channels are independent, so the inner loop
+ * runs across a whole frame and can be vectorized. */
+void MultibandCompressor::run_filter (Filter & f, const float * in, float * out, int frames)
+{
+    const Biquad c = f.c;
+    const int channels = m_channels;
+    float * z1 = f.z.begin ();
+    float * z2 = z1 + channels;
+
+    for (int i = 0; i < frames; i ++)
+    {
+        for (int ch = 0; ch < channels; ch ++)
+        {
+            float x = in[ch];
+            float y = c.b0 * x + z1[ch];
+            z1[ch] = c.b1 * x - c.a1 * y + z2[ch];
+            z2[ch] = c.b2 * x - c.a2 * y;
+            out[ch] = y;
+        }
+
+        in += channels;
+        out += channels;
+    }
+}
+
+void MultibandCompressor::compress_bands (float * data, int frames)
+{
+    float * low = m_low.begin ();
+    float * mid = m_mid.begin ();
+    float * high = m_high.begin ();
+
+    run_filter (m_lp1[0], data, low, frames);
+    run_filter (m_lp1[1], low, low, frames);
+    run_filter (m_ap2, low, low, frames);
+
+    run_filter (m_hp1[0], data, mid, frames);
+    run_filter (m_hp1[1], mid, mid, frames);
+
+    run_filter (m_hp2[0], mid, high, frames);
+    run_filter (m_hp2[1], high, high, frames);
+    run_filter (m_lp2[0], mid, mid, frames);
+    run_filter (m_lp2[1], mid, mid, frames);
+
+    float * bands[3] = {low, mid, high};
+
+    for (int i = 0; i < frames; i ++)
+    {
+        int offset = i * m_channels;
+
+        /* the channels are linked, so that the stereo image stays put */
+        for (int b = 0; b < 3; b ++)
+        {
+            float level = 0;
+            for (int ch = 0; ch < m_channels; ch ++)
+                level = aud::max (level, fabsf (bands[b][offset + ch]));
+
+            Band & band = m_bands[b];
+            float coef = (level > band.env) ? m_attack : m_release;
+            band.env = level + coef * (band.env - level);
+            band.gain = (band.env > m_threshold) ? powf (band.env / m_threshold, m_slope) : 1;
+        }
+
+        for (int ch = 0; ch < m_channels; ch ++)
+            data[offset + ch] = low[offset + ch] * m_bands[0].gain +
+             mid[offset + ch] * m_bands[1].gain + high[offset + ch] * m_bands[2].gain;
+    }
+}
+
+/* Takes the gain needed for the newest frame and returns the gain for the
+ * frame leaving the delay line: the minimum over the look-ahead window,
+ * smoothed by a moving average over the same window (so that the gain has
+ * fully come down by the time a peak leaves the delay line) and by a slower
+ * release. */
+float MultibandCompressor::limiter_gain (float required)
+{
+    int window = m_window;
+
+    if (m_min_len && m_min_pos[m_min_head] <= m_pos - window)
+    {
+        m_min_head = (m_min_head + 1) % window;
+        m_min_len --;
+    }
+
+    while (m_min_len && m_min_val[(m_min_head + m_min_len - 1) % window] >= required)
+        m_min_len --;
+
+    int tail = (m_min_head + m_min_len) % window;
+    m_min_val[tail] = required;
+    m_min_pos[tail] = m_pos;
+    m_min_len ++;
+
+    float minimum = m_min_val[m_min_head];
+    int slot = m_pos % window;
+    m_avg_sum += minimum - m_avg_ring[slot];
+    m_avg_ring[slot] = minimum;
+
+    float smooth = m_avg_sum / window;
+    m_gain = aud::min (smooth, smooth + m_limiter_release * (m_gain - smooth));
+
+    return m_gain;
+}
+
+void MultibandCompressor::limit (float * data, int frames)
+{
+    const int channels = m_channels;
+
+    for (int i = 0; i < frames; i ++)
+    {
+        float * frame = data + i * channels;
+        float sample_peak = 0, seg_peak = 0;
+
+        for (int ch = 0; ch < channels; ch ++)
+        {
+            float * h = & m_hist[4 * ch];
+            h[0] = h[1];
+            h[1] = h[2];
+            h[2] = h[3];
+            h[3] = frame[ch];
+
+            /* peak of sample n-2 and of the curve between samples n-2 and n-1 */
+            sample_peak = aud::max (sample_peak, fabsf (h[1]));
+
+            for (auto & w : interp)
+                seg_peak = aud::max (seg_peak, fabsf (w[0] * h[0] + w[1] * h[1] +
+                 w[2] * h[2] + w[3] * h[3]));
+        }
+
+        float peak = aud::max (sample_peak, aud::max (m_prev_seg, seg_peak));
+        m_prev_seg = seg_peak;
+
+        float gain = limiter_gain ((peak > m_ceiling) ? m_ceiling / peak : 1);
+
+        float * delayed = & m_delay_ring[(m_pos % m_delay) * channels];
+
+        for (int ch = 0; ch < channels; ch ++)
+        {
+            float x = delayed[ch];
+            delayed[ch] = frame[ch];
+            frame[ch] = x * gain;
+        }
+
+        m_pos ++;
+    }
+}
+
+void MultibandCompressor::process (float * data, int frames)
+{
+    while (frames > 0)
+    {
+        int block = aud::min (frames, BLOCK);
+
+        compress_bands (data, block);
+        limit (data, block);
+
+        data += block * m_channels;
+        frames -= block;
+    }
+}
@@ -0,0 +1,98 @@
+/*
+ * Multiband Compressor and Look-ahead Limiter for Audacious
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef COMPRESSOR_MULTIBAND_H
+#define COMPRESSOR_MULTIBAND_H
+
+#include <stdint.h>
+
+#include <libaudcore/index.h>
+
+struct MultibandParams
+{
+    float low_freq, high_freq;  /* crossover frequencies (Hz) */
+    float threshold;            /* band compressor threshold (dBFS) */
+    float ratio;                /* band compressor ratio */
+    float ceiling;              /* limiter ceiling (dBFS) */
+    float lookahead;            /* limiter look-ahead (ms) */
+};
+
+/* Three-band compressor (Linkwitz-Riley crossovers) followed by a look-ahead
+ * peak limiter.  Audio is processed in place, in blocks, and comes out
+ * delayed by latency() frames. */
+class MultibandCompressor
+{
+public:
+    void start (int channels, int rate, const MultibandParams & params);
+    void set_params (const MultibandParams & params);  /* except look-ahead */
+    void flush ();
+
+    void process (float * data, int frames);
+    int latency () const
+        { return m_delay; }
+
+private:
+    struct Biquad {
+        float b0, b1, b2, a1, a2;
+    };
+
+    /* one biquad section applied to all channels; z holds 2 values per channel */
+    struct Filter {
+        Biquad c;
+        Index<float> z;
+    };
+
+    struct Band {
+        float env;
+        float gain;
+    };
+
+    int m_channels = 0, m_rate = 0;
+    MultibandParams m_params {};
+
+    /* crossover: two cascaded sections each for low/high pass at both
+     * frequencies, plus an allpass to keep the low band in phase */
+    Filter m_lp1[2], m_hp1[2], m_lp2[2], m_hp2[2], m_ap2;
+    Index<float> m_low, m_mid, m_high;
+
+    Band m_bands[3];
+    float m_attack, m_release;
+    float m_threshold, m_slope;
+
+    /* limiter */
+    float m_ceiling, m_limiter_release;
+    int m_window = 0, m_delay = 0;
+    Index<float> m_hist;           /* last 4 samples of each channel */
+    float m_prev_seg = 0;          /* inter-sample peak before the last sample */
+    Index<float> m_min_val;        /* monotonic queue for the sliding minimum */
+    Index<int64_t> m_min_pos;
+    int m_min_head = 0, m_min_len = 0;
+    Index<float> m_avg_ring;       /* ring for the moving average */
+    double m_avg_sum = 0;
+    Index<float> m_delay_ring;     /* delayed audio */
+    int64_t m_pos = 0;
+    float m_gain = 1;
+
+    void calc_coefs ();
+    void run_filter (Filter & f, const float * in, float * out, int frames);
+    void compress_bands (float * data, int frames);
+    float limiter_gain (float required);
+    void limit (float * data, int frames);
+};
+
+#endif
@@ -11,16 +11,31 @@
 #include <string.h>
 
 #include <libaudcore/audstrings.h>
+#include <libaudcore/objects.h>
 #include <libaudcore/runtime.h>
 
 #include "configure.h"
 #include "plugin.h"
 #include "Music_Emu.h"
 #include "Gzip_Reader.h"
+#include "render_ahead.h"
 
 static const int fade_threshold = 10 * 1000;
 static const int fade_length    = 8 * 1000;
 
+// emulator state is saved this often to speed up seeking
+static const int snapshot_period = 10 * 1000;
+static const long snapshot_budget = 16 * 1024 * 1024L;
+
+// audio is rendered this far ahead of the play position on a worker thread
+static const int render_ahead = 10 * 1000;
+
+// audio is rendered and written in blocks of a quarter of the output buffer,
+// within these limits (in milliseconds); larger blocks let the emulators read
+// out their whole 50 ms sound buffers at once
+static const int min_block = 10;
+static const int max_block = 100;
+
 static bool log_err(blargg_err_t err)
 {
     if (err)
@@ -28,6 +43,27 @@ static bool log_err(blargg_err_t err)
     return !!err;
 }
 
+static int get_block_size(int sample_rate)
+{
+    int msec = aud::clamp(aud_get_int(nullptr, "output_buffer_size") / 4, min_block, max_block);
+    return sample_rate * msec / 1000 * 2;
+}
+
+// timing is only enabled when "profile" is set in the [console] section of
+// the config file, as it costs two clock reads per stage per frame
+static void log_profile(Music_Emu * emu)
+{
+    Play_Profile const& p = emu->profile();
+    double emulation = p.seconds(Play_Profile::emulation);
+    double mixing = p.seconds(Play_Profile::mixing);
+    double resampling = p.seconds(Play_Profile::resampling);
+
+    AUDINFO("Rendered %.1f s in %.0f ms: emulation %.0f ms, mixing %.0f ms, "
+     "resampling %.0f ms.\n", emu->tell() / 1000.0,
+     (emulation + mixing + resampling) * 1000, emulation * 1000,
+     mixing * 1000, resampling * 1000);
+}
+
 static void log_warning(Music_Emu * emu)
 {
     const char *str = emu->warning();
@@ -196,6 +232,29 @@ bool ConsolePlugin::read_tag(const char *filename, VFSFile &file, Tuple &tuple,
     return true;
 }
 
+// applies the configured stereo depth and equalizer
+static void set_effects(Music_Emu * emu)
+{
+    // stereo echo depth
+    gme_set_stereo_depth(emu, 1.0 / 100 * audcfg.echo);
+
+    // set equalizer
+    if (audcfg.treble || audcfg.bass)
+    {
+        Music_Emu::equalizer_t eq;
+
+        // bass - logarithmic, 2 to 8194 Hz
+        double bass = 1.0 - (audcfg.bass / 200.0 + 0.5);
+        eq.bass = (long) (2.0 + pow( 2.0, bass * 13 ));
+
+        // treble - -50 to 0 to +5 dB
+        double treble = audcfg.treble / 100.0;
+        eq.treble = treble * (treble < 0 ? 50.0 : 5.0);
+
+        emu->set_equalizer(eq);
+    }
+}
+
 bool ConsolePlugin::play(const char *filename, VFSFile &file)
 {
     int length, sample_rate;
@@ -222,36 +281,24 @@ bool ConsolePlugin::play(const char *filename, VFSFile &file)
     if (fh.load(sample_rate))
         return false;
 
-    // stereo echo depth
-    gme_set_stereo_depth(fh.m_emu, 1.0 / 100 * audcfg.echo);
-
-    // set equalizer
-    if (audcfg.treble || audcfg.bass)
-    {
-        Music_Emu::equalizer_t eq;
-
-        // bass - logarithmic, 2 to 8194 Hz
-        double bass = 1.0 - (audcfg.bass / 200.0 + 0.5);
-        eq.bass = (long) (2.0 + pow( 2.0, bass * 13 ));
-
-        // treble - -50 to 0 to +5 dB
-        double treble = audcfg.treble / 100.0;
-        eq.treble = treble * (treble < 0 ? 50.0 : 5.0);
-
-        fh.m_emu->set_equalizer(eq);
-    }
+    set_effects(fh.m_emu);
 
     // get info
     length = -1;
+    bool length_known = false;
     if (!log_err(fh.m_emu->track_info(&info, fh.m_track)))
     {
         if (fh.m_type == gme_spc_type && audcfg.ignore_spc_length)
             info.length = -1;
 
         length = get_track_length(info);
+        length_known = (info.length > 0 || info.loop_length > 0);
         set_stream_bitrate(fh.m_emu->voice_count() * 1000);
     }
 
+    fh.m_emu->set_snapshot_period(snapshot_period, snapshot_budget);
+    fh.m_emu->profile().enable(audcfg.profile);
+
     // start track
     if (log_err(fh.m_emu->start_track(fh.m_track)))
         return false;
@@ -267,24 +314,71 @@ bool ConsolePlugin::play(const char *filename, VFSFile &file)
         length -= fade_length / 2;
     fh.m_emu->set_fade(length, fade_length);
 
+    // without a length from the file, a second emulator plays the track in
+    // the background to find out whether it ends in silence sooner; that
+    // can't happen if silence detection is off.  It is set up like the first,
+    // so that it hears the same output and finds the same silence.
+    SmartPtr<ConsoleFileHandler> scout_fh;
+    Music_Emu* scout = nullptr;
+
+    if (!length_known && !fh.m_emu->silence_ignored() && !file.fseek(0, VFS_SEEK_SET))
+    {
+        scout_fh.capture(new ConsoleFileHandler(filename, file));
+
+        if (!scout_fh->load(sample_rate))
+        {
+            set_effects(scout_fh->m_emu);
+
+            if (!scout_fh->m_emu->start_track(fh.m_track))
+            {
+                scout_fh->m_emu->set_fade(length, fade_length);
+                scout = scout_fh->m_emu;
+            }
+        }
+    }
+
+    int block = get_block_size(sample_rate);
+    Index<Music_Emu::sample_t> buf;
+    buf.resize(block);
+
+    RenderAhead ahead;
+    if (!ahead.start(fh.m_emu, render_ahead, block, scout, length))
+        return false;
+
     while (!check_stop())
     {
         /* Perform seek, if requested */
         int seek_value = check_seek();
         if (seek_value >= 0)
-            fh.m_emu->seek(seek_value);
+            ahead.seek(seek_value);
 
         /* Fill and play buffer of audio */
-        int const buf_size = 1024;
-        Music_Emu::sample_t buf[buf_size];
-
-        fh.m_emu->play(buf_size, buf);
+        int count = ahead.read(buf.begin(), block);
 
-        write_audio(buf, sizeof(buf));
+        write_audio(buf.begin(), count * sizeof(buf[0]));
 
-        if (fh.m_emu->track_ended())
+        if (count < block)
             break;
+
+        /* Update length once the scout has found the end */
+        if (scout_fh && ahead.scout_done())
+        {
+            int detected = ahead.detected_length();
+            if (detected > 0)
+            {
+                Tuple tuple = get_playback_tuple();
+                tuple.set_int(Tuple::Length, detected);
+                set_playback_tuple(tuple.ref());
+            }
+
+            scout_fh.clear();
+        }
     }
 
+    ahead.stop();
+
+    if (audcfg.profile)
+        log_profile(fh.m_emu);
+
     return true;
 }
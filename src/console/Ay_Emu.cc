@@ -272,6 +272,22 @@ blargg_err_t Ay_Emu::start_track_( int track )
 	return 0;
 }
 
+void Ay_Emu::snapshot_regions_( Snapshot_Regions& out )
+{
+	Classic_Emu::buffer_regions( out );
+	out.add( static_cast<cpu&> (*this) );
+	out.add( play_period );
+	out.add( next_play );
+	out.add( beeper_delta );
+	out.add( last_beeper );
+	out.add( apu_addr );
+	out.add( cpc_latch );
+	out.add( spectrum_mode );
+	out.add( cpc_mode );
+	out.add( mem );
+	out.add( apu );
+}
+
 // Emulation
 
 void Ay_Emu::cpu_out_misc( cpu_time_t time, unsigned addr, int data )
@@ -88,6 +88,12 @@ blargg_err_t Classic_Emu::setup_buffer( long rate )
 	return 0;
 }
 
+void Classic_Emu::buffer_regions( Snapshot_Regions& out )
+{
+	buf->snapshot_regions( out );
+	out.add( clock_rate_ );
+}
+
 blargg_err_t Classic_Emu::start_track_( int track )
 {
 	RETURN_ERR( Music_Emu::start_track_( track ) );
@@ -100,7 +106,9 @@ blargg_err_t Classic_Emu::play_( long count, sample_t* out )
 	long remain = count;
 	while ( remain )
 	{
+		double t = profile().begin();
 		remain -= buf->read_samples( &out [count - remain], remain );
+		profile().end( Play_Profile::mixing, t );
 		if ( remain )
 		{
 			if ( buf_changed_count != buf->channels_changed_count() )
@@ -110,9 +118,11 @@ blargg_err_t Classic_Emu::play_( long count, sample_t* out )
 			}
 			int msec = buf->length();
 			blip_time_t clocks_emulated = (blargg_long) msec * clock_rate_ / 1000;
+			t = profile().begin();
 			RETURN_ERR( run_clocks( clocks_emulated, msec ) );
 			assert( clocks_emulated );
 			buf->end_frame( clocks_emulated );
+			profile().end( Play_Profile::emulation, t );
 		}
 	}
 	return 0;
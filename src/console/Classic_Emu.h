@@ -21,6 +21,11 @@ protected:
 	long clock_rate() const { return clock_rate_; }
 	void change_clock_rate( long ); // experimental
 
+	// Add output buffer to snapshot regions. Derived emulators which support
+	// snapshots call this from their snapshot_regions_() along with adding
+	// their own state.
+	void buffer_regions( Snapshot_Regions& );
+
 	// Overridable
 	virtual void set_voice( int index, Blip_Buffer* center,
 			Blip_Buffer* left, Blip_Buffer* right ) = 0;
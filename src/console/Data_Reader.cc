@@ -126,6 +126,17 @@ blargg_err_t Remaining_Reader::read( void* out, long count )
 		return 0;
 	return in->read( (char*) out + first, second );
 }
+blargg_err_t Remaining_Reader::skip( long count )
+{
+	// let underlying reader skip efficiently (by seeking, if it can)
+	long first = header_end - header;
+	if ( first > count )
+		first = count;
+	header += first;
+	if ( count == first )
+		return 0;
+	return in->skip( count - first );
+}
 
 // Mem_File_Reader
 
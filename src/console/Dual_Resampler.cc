@@ -2,6 +2,8 @@
 
 #include "Dual_Resampler.h"
 
+#include "Snapshot_Regions.h"
+
 #include <stdlib.h>
 #include <string.h>
 
@@ -31,6 +33,13 @@ blargg_err_t Dual_Resampler::reset( int pairs )
 	return resampler.buffer_size( resampler_size );
 }
 
+void Dual_Resampler::snapshot_regions( Snapshot_Regions& out )
+{
+	out.add_contents( sample_buf );
+	out.add( buf_pos );
+	resampler.snapshot_regions( out );
+}
+
 void Dual_Resampler::resize( int pairs )
 {
 	int new_sample_buf_size = pairs * 2;
@@ -47,28 +56,34 @@ void Dual_Resampler::resize( int pairs )
 	}
 }
 
-void Dual_Resampler::play_frame_( Blip_Buffer& blip_buf, dsample_t* out )
+void Dual_Resampler::play_frame_( Blip_Buffer& blip_buf, dsample_t* out, Play_Profile& profile )
 {
 	long pair_count = sample_buf_size >> 1;
 	blip_time_t blip_time = blip_buf.count_clocks( pair_count );
 	int sample_count = oversamples_per_frame - resampler.written();
 
+	double t = profile.begin();
 	int new_count = play_frame( blip_time, sample_count, resampler.buffer() );
 	assert( new_count < resampler_size );
 
 	blip_buf.end_frame( blip_time );
 	assert( blip_buf.samples_avail() == pair_count );
+	profile.end( Play_Profile::emulation, t );
 
 	resampler.write( new_count );
 
+	t = profile.begin();
 	long count = resampler.read( sample_buf.begin(), sample_buf_size );
 	assert( count == (long) sample_buf_size );
+	profile.end( Play_Profile::resampling, t );
 
+	t = profile.begin();
 	mix_samples( blip_buf, out );
 	blip_buf.remove_samples( pair_count );
+	profile.end( Play_Profile::mixing, t );
 }
 
-void Dual_Resampler::dual_play( long count, dsample_t* out, Blip_Buffer& blip_buf )
+void Dual_Resampler::dual_play( long count, dsample_t* out, Blip_Buffer& blip_buf, Play_Profile& profile )
 {
 	// empty extra buffer
 	long remain = sample_buf_size - buf_pos;
@@ -85,7 +100,7 @@ void Dual_Resampler::dual_play( long count, dsample_t* out, Blip_Buffer& blip_bu
 	// entire frames
 	while ( count >= (long) sample_buf_size )
 	{
-		play_frame_( blip_buf, out );
+		play_frame_( blip_buf, out, profile );
 		out += sample_buf_size;
 		count -= sample_buf_size;
 	}
@@ -93,7 +108,7 @@ void Dual_Resampler::dual_play( long count, dsample_t* out, Blip_Buffer& blip_bu
 	// extra
 	if ( count )
 	{
-		play_frame_( blip_buf, sample_buf.begin() );
+		play_frame_( blip_buf, sample_buf.begin(), profile );
 		buf_pos = count;
 		memcpy( out, sample_buf.begin(), count * sizeof *out );
 		out += count;
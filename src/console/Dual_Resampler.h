@@ -6,6 +6,7 @@
 
 #include "Fir_Resampler.h"
 #include "Blip_Buffer.h"
+#include "Play_Profile.h"
 
 class Dual_Resampler {
 public:
@@ -19,7 +20,10 @@ public:
 	void resize( int pairs_per_frame );
 	void clear();
 
-	void dual_play( long count, dsample_t* out, Blip_Buffer& );
+	void dual_play( long count, dsample_t* out, Blip_Buffer&, Play_Profile& );
+
+	// Add buffered samples and resampler state to 'out', for emulator snapshots
+	void snapshot_regions( Snapshot_Regions& out );
 
 protected:
 	virtual int play_frame( blip_time_t, int pcm_count, dsample_t* pcm_out ) = 0;
@@ -33,7 +37,7 @@ private:
 
 	Fir_Resampler<12> resampler;
 	void mix_samples( Blip_Buffer&, dsample_t* );
-	void play_frame_( Blip_Buffer&, dsample_t* );
+	void play_frame_( Blip_Buffer&, dsample_t*, Play_Profile& );
 };
 
 inline double Dual_Resampler::setup( double oversample, double rolloff, double gain )
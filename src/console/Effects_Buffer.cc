@@ -246,6 +246,18 @@ long Effects_Buffer::samples_avail() const
 	return bufs [0].samples_avail() * 2;
 }
 
+void Effects_Buffer::snapshot_regions( Snapshot_Regions& out )
+{
+	for ( int i = 0; i < buf_count; i++ )
+		out.add_buffer( bufs [i] );
+	out.add( stereo_remain );
+	out.add( effect_remain );
+	out.add_contents( reverb_buf );
+	out.add_contents( echo_buf );
+	out.add( reverb_pos );
+	out.add( echo_pos );
+}
+
 long Effects_Buffer::read_samples( blip_sample_t* out, long total_samples )
 {
 	require( total_samples % 2 == 0 ); // count must be even
@@ -2,6 +2,8 @@
 
 #include "Fir_Resampler.h"
 
+#include "Snapshot_Regions.h"
+
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -52,6 +54,46 @@ static void gen_sinc( double rolloff, int width, double offset, double spacing,
 	}
 }
 
+static bool cpu_supports( Fir_Resampler_::kernel_t k )
+{
+	#if FIR_RESAMPLER_X86
+		__builtin_cpu_init();
+		if ( k == Fir_Resampler_::kernel_avx2 )
+			return __builtin_cpu_supports( "avx2" );
+		if ( k == Fir_Resampler_::kernel_sse2 )
+			return __builtin_cpu_supports( "sse2" );
+	#endif
+
+	#if FIR_RESAMPLER_NEON
+		if ( k == Fir_Resampler_::kernel_neon )
+			return true;
+	#endif
+
+	return k == Fir_Resampler_::kernel_scalar;
+}
+
+static Fir_Resampler_::kernel_t best_kernel()
+{
+	if ( cpu_supports( Fir_Resampler_::kernel_neon ) )
+		return Fir_Resampler_::kernel_neon;
+	if ( cpu_supports( Fir_Resampler_::kernel_avx2 ) )
+		return Fir_Resampler_::kernel_avx2;
+	if ( cpu_supports( Fir_Resampler_::kernel_sse2 ) )
+		return Fir_Resampler_::kernel_sse2;
+	return Fir_Resampler_::kernel_scalar;
+}
+
+Fir_Resampler_::kernel_t Fir_Resampler_::kernel_ = best_kernel();
+
+bool Fir_Resampler_::set_kernel( kernel_t k )
+{
+	if ( !cpu_supports( k ) )
+		return false;
+
+	kernel_ = k;
+	return true;
+}
+
 Fir_Resampler_::Fir_Resampler_( int width, sample_t* impulses_ ) :
 	width_( width ),
 	write_offset( width * stereo - stereo ),
@@ -77,6 +119,13 @@ void Fir_Resampler_::clear()
 	}
 }
 
+void Fir_Resampler_::snapshot_regions( Snapshot_Regions& out )
+{
+	out.add_contents( buf );
+	out.add( write_pos );
+	out.add( imp_phase );
+}
+
 blargg_err_t Fir_Resampler_::buffer_size( int new_size )
 {
 	RETURN_ERR( buf.resize( new_size + write_offset ) );
@@ -188,6 +237,8 @@ int Fir_Resampler_::skip_input( long count )
 {
 	int remain = write_pos - buf.begin();
 	int max_count = remain - width_ * stereo;
+	if ( max_count < 0 )
+		max_count = 0;
 	if ( count > max_count )
 		count = max_count;
 
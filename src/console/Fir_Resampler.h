@@ -7,6 +7,20 @@
 #include "blargg_common.h"
 #include <string.h>
 
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+	#include <immintrin.h>
+	#define FIR_RESAMPLER_X86 1
+#endif
+
+// NEON is part of the baseline on AArch64, and of 32-bit ARM builds that
+// enable it, so it needs no separate target or run-time check
+#if defined (__GNUC__) && defined (__ARM_NEON)
+	#include <arm_neon.h>
+	#define FIR_RESAMPLER_NEON 1
+#endif
+
+class Snapshot_Regions;
+
 class Fir_Resampler_ {
 public:
 
@@ -53,6 +67,21 @@ public:
 	// Number of output samples available
 	int avail() const { return avail_( write_pos - &buf [width_ * stereo] ); }
 
+	// Add buffered input and position to 'out', for emulator snapshots
+	void snapshot_regions( Snapshot_Regions& out );
+
+// Inner loop
+
+	// Implementations of the inner loop of read(). The fastest one the CPU
+	// supports is used unless set_kernel() chooses another; all give the same
+	// output.
+	enum kernel_t { kernel_scalar, kernel_sse2, kernel_avx2, kernel_neon };
+
+	// Use 'k' in all resamplers. Returns false, and changes nothing, if the CPU
+	// doesn't support it.
+	static bool set_kernel( kernel_t k );
+	static kernel_t kernel() { return kernel_; }
+
 public:
 	~Fir_Resampler_();
 protected:
@@ -72,6 +101,8 @@ protected:
 
 	Fir_Resampler_( int width, sample_t* );
 	int avail_( blargg_long input_count ) const;
+
+	static kernel_t kernel_;
 };
 
 // Width is number of points in FIR. Must be even and 4 or more. More points give
@@ -86,6 +117,22 @@ public:
 	// Read at most 'count' samples. Returns number of samples actually read.
 	typedef short sample_t;
 	int read( sample_t* out, blargg_long count );
+
+private:
+	template<class Kernel>
+	int read_( sample_t* out, blargg_long count );
+
+	#if FIR_RESAMPLER_X86
+		// flatten inlines the kernel, which needs the instruction set enabled
+		__attribute__ ((target ("sse2"), flatten))
+		int read_sse2( sample_t* out, blargg_long count );
+		__attribute__ ((target ("avx2"), flatten))
+		int read_avx2( sample_t* out, blargg_long count );
+	#endif
+	#if FIR_RESAMPLER_NEON
+		__attribute__ ((flatten))
+		int read_neon( sample_t* out, blargg_long count );
+	#endif
 };
 
 // End of public interface
@@ -96,8 +143,209 @@ inline void Fir_Resampler_::write( long count )
 	assert( write_pos <= buf.end() );
 }
 
+// Kernels add up 'width' points of FIR 'imp' applied to stereo input 'in' into
+// 'l' and 'r'. All sums wrap at 32 bits (blargg_long), and wrap the same way in
+// any order, so the vector kernels match the scalar one exactly.
+
+struct Fir_Kernel_Scalar {
+	template<int width>
+	static void points( const short* in, const short* imp, blargg_long& l, blargg_long& r )
+	{
+		for ( int n = width / 2; n; --n )
+		{
+			int pt0 = imp [0];
+			l += pt0 * in [0];
+			r += pt0 * in [1];
+			int pt1 = imp [1];
+			imp += 2;
+			l += pt1 * in [2];
+			r += pt1 * in [3];
+			in += 4;
+		}
+	}
+};
+
+#if FIR_RESAMPLER_X86
+
+// Input is reordered to L0 L1 R0 R1 L2 L3 R2 R3 so that madd pairs each channel
+// with its own points, and the points are duplicated to match.
+
+struct Fir_Kernel_Sse2 {
+	template<int width>
+	__attribute__ ((target ("sse2")))
+	static void points( const short* in, const short* imp, blargg_long& l, blargg_long& r )
+	{
+		__m128i sum  = _mm_setzero_si128();
+		__m128i sum2 = _mm_setzero_si128();
+		for ( int n = width / 8; n; --n )
+		{
+			__m128i s  = _mm_loadu_si128( (__m128i const*) in );
+			__m128i s2 = _mm_loadu_si128( (__m128i const*) (in + 8) );
+			s  = _mm_shufflehi_epi16( _mm_shufflelo_epi16( s,  0xD8 ), 0xD8 );
+			s2 = _mm_shufflehi_epi16( _mm_shufflelo_epi16( s2, 0xD8 ), 0xD8 );
+			__m128i pt = _mm_loadu_si128( (__m128i const*) imp );
+			sum  = _mm_add_epi32( sum,  _mm_madd_epi16( s,  _mm_unpacklo_epi32( pt, pt ) ) );
+			sum2 = _mm_add_epi32( sum2, _mm_madd_epi16( s2, _mm_unpackhi_epi32( pt, pt ) ) );
+			imp += 8;
+			in += 16;
+		}
+		if ( width & 4 )
+		{
+			__m128i s = _mm_loadu_si128( (__m128i const*) in );
+			s = _mm_shufflehi_epi16( _mm_shufflelo_epi16( s, 0xD8 ), 0xD8 );
+			__m128i pt = _mm_loadl_epi64( (__m128i const*) imp );
+			sum = _mm_add_epi32( sum, _mm_madd_epi16( s, _mm_unpacklo_epi32( pt, pt ) ) );
+			imp += 4;
+			in += 8;
+		}
+		sum = _mm_add_epi32( sum, sum2 );
+		sum = _mm_add_epi32( sum, _mm_srli_si128( sum, 8 ) );
+		l += _mm_cvtsi128_si32( sum );
+		r += _mm_cvtsi128_si32( _mm_srli_si128( sum, 4 ) );
+
+		Fir_Kernel_Scalar::points<width & 2>( in, imp, l, r );
+	}
+};
+
+// Eight points per vector: the low half holds frames 0-3 and the high half
+// frames 4-7, and the points are spread across both halves with one permute.
+
+struct Fir_Kernel_Avx2 {
+	template<int width>
+	__attribute__ ((target ("avx2")))
+	static void points( const short* in, const short* imp, blargg_long& l, blargg_long& r )
+	{
+		__m256i const spread = _mm256_setr_epi32( 0, 0, 1, 1, 2, 2, 3, 3 );
+		__m256i sum  = _mm256_setzero_si256();
+		__m256i sum2 = _mm256_setzero_si256();
+		int n = width / 8;
+		for ( ; n >= 2; n -= 2 )
+		{
+			__m256i s  = _mm256_loadu_si256( (__m256i const*) in );
+			__m256i s2 = _mm256_loadu_si256( (__m256i const*) (in + 16) );
+			s  = _mm256_shufflehi_epi16( _mm256_shufflelo_epi16( s,  0xD8 ), 0xD8 );
+			s2 = _mm256_shufflehi_epi16( _mm256_shufflelo_epi16( s2, 0xD8 ), 0xD8 );
+			__m256i pt  = _mm256_castsi128_si256( _mm_loadu_si128( (__m128i const*) imp ) );
+			__m256i pt2 = _mm256_castsi128_si256( _mm_loadu_si128( (__m128i const*) (imp + 8) ) );
+			sum  = _mm256_add_epi32( sum,  _mm256_madd_epi16( s,  _mm256_permutevar8x32_epi32( pt,  spread ) ) );
+			sum2 = _mm256_add_epi32( sum2, _mm256_madd_epi16( s2, _mm256_permutevar8x32_epi32( pt2, spread ) ) );
+			imp += 16;
+			in += 32;
+		}
+		if ( n )
+		{
+			__m256i s = _mm256_loadu_si256( (__m256i const*) in );
+			s = _mm256_shufflehi_epi16( _mm256_shufflelo_epi16( s, 0xD8 ), 0xD8 );
+			__m256i pt = _mm256_castsi128_si256( _mm_loadu_si128( (__m128i const*) imp ) );
+			sum = _mm256_add_epi32( sum, _mm256_madd_epi16( s, _mm256_permutevar8x32_epi32( pt, spread ) ) );
+			imp += 8;
+			in += 16;
+		}
+		sum = _mm256_add_epi32( sum, sum2 );
+		__m128i half = _mm_add_epi32( _mm256_castsi256_si128( sum ), _mm256_extracti128_si256( sum, 1 ) );
+		if ( width & 4 )
+		{
+			__m128i s = _mm_loadu_si128( (__m128i const*) in );
+			s = _mm_shufflehi_epi16( _mm_shufflelo_epi16( s, 0xD8 ), 0xD8 );
+			__m128i pt = _mm_loadl_epi64( (__m128i const*) imp );
+			half = _mm_add_epi32( half, _mm_madd_epi16( s, _mm_unpacklo_epi32( pt, pt ) ) );
+			imp += 4;
+			in += 8;
+		}
+		half = _mm_add_epi32( half, _mm_srli_si128( half, 8 ) );
+		l += _mm_cvtsi128_si32( half );
+		r += _mm_cvtsi128_si32( _mm_srli_si128( half, 4 ) );
+
+		Fir_Kernel_Scalar::points<width & 2>( in, imp, l, r );
+	}
+};
+
+template<int width>
+int Fir_Resampler<width>::read_sse2( sample_t* out, blargg_long count )
+{
+	return read_<Fir_Kernel_Sse2>( out, count );
+}
+
+template<int width>
+int Fir_Resampler<width>::read_avx2( sample_t* out, blargg_long count )
+{
+	return read_<Fir_Kernel_Avx2>( out, count );
+}
+
+#endif
+
+#if FIR_RESAMPLER_NEON
+
+// vld2 splits the input into left and right, so each channel is multiplied
+// by the points directly, widening to 32 bits (wrapping like the scalar sums).
+
+struct Fir_Kernel_Neon {
+	static blargg_long sum_lanes( int32x4_t v )
+	{
+		int32x2_t half = vadd_s32( vget_low_s32( v ), vget_high_s32( v ) );
+		return vget_lane_s32( vpadd_s32( half, half ), 0 );
+	}
+
+	template<int width>
+	static void points( const short* in, const short* imp, blargg_long& l, blargg_long& r )
+	{
+		int32x4_t suml = vdupq_n_s32( 0 );
+		int32x4_t sumr = vdupq_n_s32( 0 );
+		for ( int n = width / 8; n; --n )
+		{
+			int16x8x2_t s = vld2q_s16( in );
+			int16x8_t pt = vld1q_s16( imp );
+			suml = vmlal_s16( suml, vget_low_s16( s.val [0] ), vget_low_s16( pt ) );
+			sumr = vmlal_s16( sumr, vget_low_s16( s.val [1] ), vget_low_s16( pt ) );
+			suml = vmlal_s16( suml, vget_high_s16( s.val [0] ), vget_high_s16( pt ) );
+			sumr = vmlal_s16( sumr, vget_high_s16( s.val [1] ), vget_high_s16( pt ) );
+			imp += 8;
+			in += 16;
+		}
+		if ( width & 4 )
+		{
+			int16x4x2_t s = vld2_s16( in );
+			int16x4_t pt = vld1_s16( imp );
+			suml = vmlal_s16( suml, s.val [0], pt );
+			sumr = vmlal_s16( sumr, s.val [1], pt );
+			imp += 4;
+			in += 8;
+		}
+		l += sum_lanes( suml );
+		r += sum_lanes( sumr );
+
+		Fir_Kernel_Scalar::points<width & 2>( in, imp, l, r );
+	}
+};
+
 template<int width>
-int Fir_Resampler<width>::read( sample_t* out_begin, blargg_long count )
+int Fir_Resampler<width>::read_neon( sample_t* out, blargg_long count )
+{
+	return read_<Fir_Kernel_Neon>( out, count );
+}
+
+#endif
+
+template<int width>
+int Fir_Resampler<width>::read( sample_t* out, blargg_long count )
+{
+	#if FIR_RESAMPLER_X86
+		if ( kernel_ == kernel_avx2 )
+			return read_avx2( out, count );
+		if ( kernel_ == kernel_sse2 )
+			return read_sse2( out, count );
+	#endif
+	#if FIR_RESAMPLER_NEON
+		if ( kernel_ == kernel_neon )
+			return read_neon( out, count );
+	#endif
+
+	return read_<Fir_Kernel_Scalar>( out, count );
+}
+
+template<int width>
+template<class Kernel>
+inline int Fir_Resampler<width>::read_( sample_t* out_begin, blargg_long count )
 {
 	sample_t* out = out_begin;
 	const sample_t* in = buf.begin();
@@ -120,21 +368,11 @@ int Fir_Resampler<width>::read( sample_t* out_begin, blargg_long count )
 			blargg_long l = 0;
 			blargg_long r = 0;
 
-			const sample_t* i = in;
 			if ( count < 0 )
 				break;
 
-			for ( int n = width / 2; n; --n )
-			{
-				int pt0 = imp [0];
-				l += pt0 * i [0];
-				r += pt0 * i [1];
-				int pt1 = imp [1];
-				imp += 2;
-				l += pt1 * i [2];
-				r += pt1 * i [3];
-				i += 4;
-			}
+			Kernel::template points<width>( in, imp, l, r );
+			imp += width;
 
 			remain--;
 
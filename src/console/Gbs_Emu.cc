@@ -236,6 +236,16 @@ blargg_err_t Gbs_Emu::start_track_( int track )
 	return 0;
 }
 
+void Gbs_Emu::snapshot_regions_( Snapshot_Regions& out )
+{
+	Classic_Emu::buffer_regions( out );
+	out.add( static_cast<cpu&> (*this) );
+	out.add( play_period );
+	out.add( next_play );
+	out.add( ram );
+	out.add( apu );
+}
+
 blargg_err_t Gbs_Emu::run_clocks( blip_time_t& duration, int )
 {
 	cpu_time = 0;
@@ -247,6 +247,21 @@ blargg_err_t Gym_Emu::start_track_( int track )
 	return 0;
 }
 
+void Gym_Emu::snapshot_regions_( Snapshot_Regions& out )
+{
+	out.add( loop_begin );
+	out.add( pos );
+	out.add( loop_remain );
+	out.add( dac_amp );
+	out.add( prev_dac_count );
+	out.add( dac_enabled );
+	out.add_buffer( blip_buf );
+	fm.snapshot_regions( out );
+	out.add( dac_synth );
+	out.add( apu );
+	Dual_Resampler::snapshot_regions( out );
+}
+
 void Gym_Emu::run_dac( int dac_count )
 {
 	// Guess beginning and end of sample and adjust rate and buffer position accordingly.
@@ -375,6 +390,6 @@ int Gym_Emu::play_frame( blip_time_t blip_time, int sample_count, sample_t* buf
 
 blargg_err_t Gym_Emu::play_( long count, sample_t* out )
 {
-	Dual_Resampler::dual_play( count, out, blip_buf );
+	Dual_Resampler::dual_play( count, out, blip_buf, profile() );
 	return 0;
 }
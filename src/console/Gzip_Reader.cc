@@ -106,3 +106,35 @@ long Gzip_Reader::read_avail( void* out, long count )
 		count = -1;
 	return count;
 }
+
+blargg_err_t Gzip_Reader::skip( long count )
+{
+	if ( !in )
+		return eof_error;
+
+	if ( !inflater.deflated() )
+	{
+		// read what's buffered, then seek past the rest
+		long n = min( count, inflater.buffered() );
+		RETURN_ERR( Data_Reader::skip( n ) );
+		count -= n;
+		if ( count )
+		{
+			if ( count > remain() )
+				return eof_error;
+			RETURN_ERR( in->skip( count ) );
+			tell_ += count;
+		}
+		return 0;
+	}
+
+	// inflate in larger blocks than Data_Reader::skip()
+	char buf [4096];
+	while ( count )
+	{
+		long n = min( count, (long) sizeof buf );
+		count -= n;
+		RETURN_ERR( read( buf, n ) );
+	}
+	return 0;
+}
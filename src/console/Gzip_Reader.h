@@ -18,6 +18,7 @@ public:
 	long remain() const;
 	error_t read( void*, long );
 	long read_avail( void*, long );
+	error_t skip( long );
 private:
 	File_Reader* in;
 	long tell_;
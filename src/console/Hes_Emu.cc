@@ -252,6 +252,19 @@ blargg_err_t Hes_Emu::start_track_( int track )
 	return 0;
 }
 
+void Hes_Emu::snapshot_regions_( Snapshot_Regions& out )
+{
+	Classic_Emu::buffer_regions( out );
+	out.add( static_cast<cpu&> (*this) );
+	out.add( write_pages );
+	out.add( last_frame_hook );
+	out.add( timer );
+	out.add( vdp );
+	out.add( irq );
+	out.add( apu );
+	out.add( sgx );
+}
+
 // Hardware
 
 void Hes_Emu::cpu_write_vdp( int addr, int data )
@@ -256,6 +256,21 @@ blargg_err_t Kss_Emu::start_track_( int track )
 	return 0;
 }
 
+void Kss_Emu::snapshot_regions_( Snapshot_Regions& out )
+{
+	Classic_Emu::buffer_regions( out );
+	out.add( static_cast<cpu&> (*this) );
+	out.add( scc_accessed );
+	out.add( gain_updated );
+	out.add( next_play );
+	out.add( ay_latch );
+	out.add( ram );
+	out.add( ay );
+	out.add( scc );
+	if ( sn )
+		out.add( *sn );
+}
+
 void Kss_Emu::set_bank( int logical, int physical )
 {
 	unsigned const bank_size = this->bank_size();
@@ -58,6 +58,7 @@ protected:
 	void set_tempo_( double );
 	void set_voice( int, Blip_Buffer*, Blip_Buffer*, Blip_Buffer* );
 	void update_eq( blip_eq_t const& );
+	void snapshot_regions_( Snapshot_Regions& );
 	void unload();
 private:
 	Rom_Data<page_size> rom;
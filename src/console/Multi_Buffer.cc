@@ -103,6 +103,14 @@ void Stereo_Buffer::end_frame( blip_time_t clock_count )
 	}
 }
 
+void Stereo_Buffer::snapshot_regions( Snapshot_Regions& out )
+{
+	for ( int i = 0; i < buf_count; i++ )
+		out.add_buffer( bufs [i] );
+	out.add( stereo_added );
+	out.add( was_stereo );
+}
+
 long Stereo_Buffer::read_samples( blip_sample_t* out, long count )
 {
 	require( !(count & 1) ); // count must be even
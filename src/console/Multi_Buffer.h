@@ -6,6 +6,7 @@
 
 #include "blargg_common.h"
 #include "Blip_Buffer.h"
+#include "Snapshot_Regions.h"
 
 // Interface to one or more Blip_Buffers mapped to one or more channels
 // consisting of left, center, and right buffers.
@@ -51,6 +52,10 @@ public:
 	virtual long read_samples( blip_sample_t*, long ) = 0;
 	virtual long samples_avail() const = 0;
 
+	// Add memory holding buffered sound to 'out', for emulator snapshots.
+	// The default marks snapshots as unsupported.
+	virtual void snapshot_regions( Snapshot_Regions& out ) { out.set_unsupported(); }
+
 protected:
 	void channels_changed() { channels_changed_count_++; }
 private:
@@ -83,6 +88,7 @@ public:
 	long read_samples( blip_sample_t* p, long s ) { return buf.read_samples( p, s ); }
 	channel_t channel( int, int ) { return chan; }
 	void end_frame( blip_time_t t ) { buf.end_frame( t ); }
+	void snapshot_regions( Snapshot_Regions& out ) { out.add_buffer( buf ); }
 };
 
 // Uses three buffers (one for center) and outputs stereo sample pairs.
@@ -106,6 +112,7 @@ public:
 
 	long samples_avail() const { return bufs [0].samples_avail() * 2; }
 	long read_samples( blip_sample_t*, long );
+	void snapshot_regions( Snapshot_Regions& );
 
 private:
 	enum { buf_count = 3 };
@@ -132,6 +139,7 @@ public:
 	void end_frame( blip_time_t ) { }
 	long samples_avail() const { return 0; }
 	long read_samples( blip_sample_t*, long ) { return 0; }
+	void snapshot_regions( Snapshot_Regions& ) { }
 };
 
 
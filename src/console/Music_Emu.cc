@@ -45,6 +45,10 @@ void Music_Emu::unload()
 {
 	voice_count_ = 0;
 	clear_track_vars();
+	clear_snapshots();
+	snapshot_layout.clear();
+	snapshots.clear();
+	snapshot_data.clear();
 	Gme_File::unload();
 }
 
@@ -63,6 +67,8 @@ Music_Emu::Music_Emu()
 	ignore_silence_     = false;
 	equalizer_.treble   = -1.0;
 	equalizer_.bass     = 60;
+	snapshot_period     = 0;
+	snapshot_budget     = 0;
 
 	static const char* const names [] = {
 		"Voice 1", "Voice 2", "Voice 3", "Voice 4",
@@ -91,6 +97,7 @@ void Music_Emu::pre_load()
 
 void Music_Emu::set_equalizer( equalizer_t const& eq )
 {
+	clear_snapshots(); // equalizer is part of saved sound chip state
 	equalizer_ = eq;
 	set_equalizer_( eq );
 }
@@ -119,6 +126,7 @@ void Music_Emu::set_tempo( double t )
 	double const max = 4.00;
 	if ( t < min ) t = min;
 	if ( t > max ) t = max;
+	clear_snapshots(); // timing is part of saved state
 	tempo_ = t;
 	set_tempo_( t );
 }
@@ -131,6 +139,10 @@ void Music_Emu::post_load_()
 
 blargg_err_t Music_Emu::start_track( int track )
 {
+	// snapshots of the same track remain valid when it is restarted
+	if ( track != current_track_ )
+		clear_snapshots();
+
 	clear_track_vars();
 
 	int remapped = track;
@@ -156,6 +168,8 @@ blargg_err_t Music_Emu::start_track( int track )
 		silence_time  = 0;
 		silence_count = 0;
 	}
+
+	setup_snapshots();
 	return track_ended() ? warning() : 0;
 }
 
@@ -187,12 +201,53 @@ long Music_Emu::tell() const
 blargg_err_t Music_Emu::seek( long msec )
 {
 	blargg_long time = msec_to_samples( msec );
-	if ( time < out_time )
+
+	// nearest snapshot at or before new time
+	int i = snapshot_count;
+	while ( i && snapshots [i - 1].time > time )
+		i--;
+
+	if ( i && (time < out_time || snapshots [i - 1].time > out_time) )
+	{
+		load_snapshot( i - 1 );
+	}
+	else if ( time < out_time )
+	{
+		// keep the fade, which start_track() clears
+		blargg_long saved_start = fade_start;
+		int saved_step = fade_step;
 		RETURN_ERR( start_track( current_track_ ) );
-	return skip( time - out_time );
+		fade_start = saved_start;
+		fade_step = saved_step;
+	}
+
+	// with snapshots, the rest is normally at most one interval, so emulate it
+	// exactly as playback would instead of with a fast skip, stopping to take
+	// any snapshot due on the way as playback would
+	if ( !snapshot_period || time - out_time > snapshot_interval )
+		return skip( time - out_time );
+
+	while ( out_time < time )
+	{
+		long count = time - out_time;
+		if ( out_time < next_snapshot && next_snapshot < time )
+			count = next_snapshot - out_time;
+
+		RETURN_ERR( skip_samples( count, true ) );
+
+		if ( out_time >= next_snapshot )
+			save_snapshot();
+	}
+
+	return 0;
 }
 
 blargg_err_t Music_Emu::skip( long count )
+{
+	return skip_samples( count, false );
+}
+
+blargg_err_t Music_Emu::skip_samples( long count, bool exact )
 {
 	require( current_track() >= 0 ); // start_track() must have been called already
 	out_time += count;
@@ -211,7 +266,7 @@ blargg_err_t Music_Emu::skip( long count )
 	if ( count && !emu_track_ended_ )
 	{
 		emu_time += count;
-		end_track_if_error( skip_( count ) );
+		end_track_if_error( exact ? play_through( count ) : skip_( count ) );
 	}
 
 	if ( !(silence_count | buf_remain) ) // caught up to emulator, so update track ended
@@ -238,6 +293,11 @@ blargg_err_t Music_Emu::skip_( long count )
 		mute_voices( saved_mute );
 	}
 
+	return play_through( count );
+}
+
+blargg_err_t Music_Emu::play_through( long count )
+{
 	while ( count && !emu_track_ended_ )
 	{
 		long n = buf_size;
@@ -249,6 +309,99 @@ blargg_err_t Music_Emu::skip_( long count )
 	return 0;
 }
 
+// Snapshots
+
+void Music_Emu::set_snapshot_period( long period_msec, long budget )
+{
+	require( sample_rate() ); // sample rate must be set first
+	snapshot_period = msec_to_samples( period_msec );
+	snapshot_budget = budget;
+	clear_snapshots();
+	snapshot_layout.clear();
+	if ( current_track_ >= 0 )
+		setup_snapshots();
+}
+
+void Music_Emu::clear_snapshots()
+{
+	snapshot_count    = 0;
+	snapshot_interval = snapshot_period;
+	next_snapshot     = snapshot_period;
+}
+
+void Music_Emu::setup_snapshots()
+{
+	Snapshot_Regions layout;
+	if ( snapshot_period )
+		snapshot_regions_( layout );
+
+	// keep snapshots if memory is where it was when they were taken
+	if ( snapshot_count && layout == snapshot_layout )
+		return;
+
+	clear_snapshots();
+	snapshot_layout = layout;
+
+	long max = 0;
+	if ( layout.supported() )
+		max = snapshot_budget / layout.size();
+
+	if ( max < 2 || snapshots.resize( max ) || snapshot_data.resize( max * layout.size() ) )
+	{
+		snapshots.clear();
+		snapshot_data.clear();
+	}
+}
+
+void Music_Emu::save_snapshot()
+{
+	// only take snapshots while the emulator isn't ahead of the output
+	if ( silence_count | buf_remain || emu_track_ended_ || out_time > fade_start )
+		return;
+
+	int const max = snapshots.size();
+	long const size = snapshot_layout.size();
+	if ( !max )
+		return;
+
+	if ( snapshot_count >= max )
+	{
+		// drop every other snapshot
+		int n = 0;
+		for ( int i = 1; i < snapshot_count; i += 2, n++ )
+		{
+			snapshots [n] = snapshots [i];
+			memcpy( snapshot_data.begin() + n * size, snapshot_data.begin() + i * size, size );
+		}
+		snapshot_count = n;
+		snapshot_interval *= 2;
+
+		next_snapshot = snapshots [n - 1].time + snapshot_interval;
+		if ( out_time < next_snapshot )
+			return;
+	}
+
+	snapshot_t& s = snapshots [snapshot_count];
+	s.time         = out_time;
+	s.silence_time = silence_time;
+	snapshot_layout.save( snapshot_data.begin() + snapshot_count * size );
+	snapshot_count++;
+	next_snapshot = out_time + snapshot_interval;
+}
+
+void Music_Emu::load_snapshot( int i )
+{
+	snapshot_layout.load( snapshot_data.begin() + i * snapshot_layout.size() );
+	out_time         = snapshots [i].time;
+	emu_time         = out_time;
+	silence_time     = snapshots [i].silence_time;
+	silence_count    = 0;
+	buf_remain       = 0;
+	emu_track_ended_ = false;
+	track_ended_     = false;
+	remute_voices(); // in case muting changed since snapshot
+}
+
 // Fading
 
 void Music_Emu::set_fade( long start_msec, long length_msec )
@@ -395,6 +548,10 @@ blargg_err_t Music_Emu::play( long out_count, sample_t* out )
 			handle_fade( out_count, out );
 	}
 	out_time += out_count;
+
+	if ( snapshot_period && out_time >= next_snapshot )
+		save_snapshot();
+
 	return 0;
 }
 
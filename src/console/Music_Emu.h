@@ -5,6 +5,8 @@
 #define MUSIC_EMU_H
 
 #include "Gme_File.h"
+#include "Snapshot_Regions.h"
+#include "Play_Profile.h"
 class Multi_Buffer;
 
 struct Music_Emu : public Gme_File {
@@ -41,10 +43,13 @@ public:
 	// Number of milliseconds (1000 msec = 1 second) played since beginning of track
 	long tell() const;
 
-	// Seek to new time in track. Seeking backwards or far forward can take a while.
+	// Seek to new time in track. Seeking backwards or far forward can take a while,
+	// unless snapshots are enabled (see below).
 	blargg_err_t seek( long msec );
 
-	// Skip n samples
+	// Skip n samples. Long skips are made with all voices muted, which is faster
+	// but can leave the emulator slightly off, so that what is played afterwards
+	// differs a little from playing through.
 	blargg_err_t skip( long n );
 
 	// True if a track has reached its end
@@ -57,10 +62,33 @@ public:
 	// Disable automatic end-of-track detection and skipping of silence at beginning
 	void ignore_silence( bool disable = true );
 
+	// True if automatic end-of-track detection is disabled
+	bool silence_ignored() const;
+
 	// Info for current track
 	using Gme_File::track_info;
 	blargg_err_t track_info( track_info_t* out ) const;
 
+// Snapshots
+
+	// Save a snapshot of the emulator state every 'period_msec' of playback, keeping
+	// at most 'budget' bytes of them; when they no longer fit, every other one is
+	// dropped and the period doubled. seek() then restores the nearest snapshot at
+	// or before the new time instead of emulating from the beginning of the track,
+	// and emulates the rest of the way with sound (taking the snapshots due on
+	// the way), so that the output is the same as if the track had been played
+	// through. If the nearest snapshot, or the beginning of the track, is more
+	// than one period back, seek() uses skip() instead. A period of 0 disables
+	// snapshots. Has no effect on emulators that don't support them.
+	void set_snapshot_period( long period_msec, long budget = 16 * 1024 * 1024L );
+
+// Profiling
+
+	// CPU time spent in each stage of generating sound, including while seeking.
+	// Timing is off until enabled with profile().enable().
+	Play_Profile& profile()                     { return profile_; }
+	Play_Profile const& profile() const         { return profile_; }
+
 // Sound customization
 
 	// Adjust song tempo, where 1.0 = normal, 0.5 = half speed, 2.0 = double speed.
@@ -122,6 +150,10 @@ protected:
 	virtual blargg_err_t start_track_( int ) = 0; // tempo is set before this
 	virtual blargg_err_t play_( long count, sample_t* out ) = 0;
 	virtual blargg_err_t skip_( long count );
+
+	// Add the memory holding emulator state to 'out' (see Snapshot_Regions.h).
+	// The default marks snapshots as unsupported.
+	virtual void snapshot_regions_( Snapshot_Regions& out ) { out.set_unsupported(); }
 protected:
 	virtual void unload();
 	virtual void pre_load();
@@ -163,6 +195,28 @@ private:
 	blargg_vector<sample_t> buf;
 	void fill_buf();
 	void emu_play( long count, sample_t* out );
+	blargg_err_t skip_samples( long count, bool exact );
+	blargg_err_t play_through( long count );
+
+	// snapshots
+	struct snapshot_t {
+		blargg_long time;      // out_time when taken
+		long silence_time;
+	};
+	blargg_long snapshot_period;   // 0 if disabled
+	blargg_long snapshot_interval; // current interval, a multiple of the period
+	blargg_long next_snapshot;
+	long snapshot_budget;
+	int snapshot_count;
+	Snapshot_Regions snapshot_layout;
+	blargg_vector<snapshot_t> snapshots;
+	blargg_vector<char> snapshot_data;
+	void clear_snapshots();
+	void setup_snapshots();
+	void save_snapshot();
+	void load_snapshot( int );
+
+	Play_Profile profile_;
 
 	Multi_Buffer* effects_buffer;
 	friend Music_Emu* gme_new_emu( gme_type_t, int );
@@ -199,6 +253,7 @@ inline void Music_Emu::enable_accuracy( bool b )    { enable_accuracy_( b ); }
 inline void Music_Emu::set_tempo_( double t )       { tempo_ = t; }
 inline void Music_Emu::remute_voices()              { mute_voices( mute_mask_ ); }
 inline void Music_Emu::ignore_silence( bool b )     { ignore_silence_ = b; }
+inline bool Music_Emu::silence_ignored() const      { return ignore_silence_; }
 inline blargg_err_t Music_Emu::start_track_( int )  { return 0; }
 
 inline void Music_Emu::set_voice_names( const char* const* names )
@@ -485,6 +485,26 @@ blargg_err_t Nsf_Emu::start_track_( int track )
 	return 0;
 }
 
+void Nsf_Emu::snapshot_regions_( Snapshot_Regions& out )
+{
+	Classic_Emu::buffer_regions( out );
+	out.add( static_cast<cpu&> (*this) );
+	out.add( saved_state );
+	out.add( next_play );
+	out.add( play_extra );
+	out.add( play_ready );
+	out.add( apu );
+	out.add( sram );
+
+	#if !NSF_EMU_APU_ONLY
+	{
+		if ( namco ) out.add( *namco );
+		if ( vrc6  ) out.add( *vrc6 );
+		if ( fme7  ) out.add( *fme7 );
+	}
+	#endif
+}
+
 blargg_err_t Nsf_Emu::run_clocks( blip_time_t& duration, int )
 {
 	set_time( 0 );
@@ -0,0 +1,21 @@
+#include "Play_Profile.h"
+
+#include <time.h>
+
+void Play_Profile::clear()
+{
+	for ( int i = 0; i < stage_count; i++ )
+		time [i] = 0;
+}
+
+double Play_Profile::now()
+{
+	// time used by other threads (render-ahead, scout) would skew the stages
+	#ifdef CLOCK_THREAD_CPUTIME_ID
+		timespec ts;
+		if ( !clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts ) )
+			return ts.tv_sec + ts.tv_nsec * 1e-9;
+	#endif
+
+	return (double) clock() / CLOCKS_PER_SEC;
+}
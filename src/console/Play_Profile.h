@@ -0,0 +1,44 @@
+// CPU time spent in each stage of generating sound, for profiling
+
+#ifndef PLAY_PROFILE_H
+#define PLAY_PROFILE_H
+
+#include "blargg_common.h"
+
+class Play_Profile {
+public:
+	enum stage_t {
+		emulation,  // running CPUs and sound chips into Blip_Buffers/sample buffers
+		mixing,     // reading and mixing samples out of Blip_Buffers
+		resampling, // Fir_Resampler
+		stage_count
+	};
+
+	Play_Profile() { enabled = false; clear(); }
+
+	// Enable/disable timing. Disabled by default, where begin() and end() do
+	// nothing beyond a test.
+	void enable( bool b = true ) { enabled = b; }
+
+	// Reset all times to zero
+	void clear();
+
+	// Seconds of CPU time spent in stage
+	double seconds( stage_t s ) const { return time [s]; }
+
+	// Time a stage:
+	//     double t = profile.begin();
+	//     ...
+	//     profile.end( Play_Profile::mixing, t );
+	double begin() const { return enabled ? now() : -1.0; }
+	void end( stage_t s, double start ) { if ( start >= 0 ) time [s] += now() - start; }
+
+	// CPU time used by calling thread so far, in seconds
+	static double now();
+
+private:
+	bool enabled;
+	double time [stage_count];
+};
+
+#endif
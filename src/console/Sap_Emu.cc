@@ -446,6 +446,18 @@ blargg_err_t Sap_Emu::start_track_( int track )
 	return 0;
 }
 
+void Sap_Emu::snapshot_regions_( Snapshot_Regions& out )
+{
+	Classic_Emu::buffer_regions( out );
+	out.add( static_cast<cpu&> (*this) );
+	out.add( next_play );
+	out.add( time_mask );
+	out.add( apu );
+	out.add( apu2 );
+	out.add( mem );
+	out.add( apu_impl.synth );
+}
+
 // Emulation
 
 // see sap_cpu_io.h for read/write functions
@@ -39,6 +39,7 @@ protected:
 	void set_tempo_( double );
 	void set_voice( int, Blip_Buffer*, Blip_Buffer*, Blip_Buffer* );
 	void update_eq( blip_eq_t const& );
+	void snapshot_regions_( Snapshot_Regions& );
 public: private: friend class Sap_Cpu;
 	int cpu_read( sap_addr_t );
 	void cpu_write( sap_addr_t, int );
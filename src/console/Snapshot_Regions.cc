@@ -0,0 +1,75 @@
+#include "Snapshot_Regions.h"
+
+#include "Blip_Buffer.h"
+#include <string.h>
+
+void Snapshot_Regions::clear()
+{
+	count       = 0;
+	size_       = 0;
+	unsupported = false;
+}
+
+void Snapshot_Regions::add( void* begin, long size )
+{
+	if ( !begin || size <= 0 )
+		return;
+
+	// merge with previous region if adjacent
+	if ( count && (char*) regions [count - 1].begin + regions [count - 1].size == begin )
+	{
+		regions [count - 1].size += size;
+	}
+	else
+	{
+		if ( count >= max_regions )
+		{
+			unsupported = true;
+			return;
+		}
+		regions [count].begin = begin;
+		regions [count].size  = size;
+		count++;
+	}
+	size_ += size;
+}
+
+void Snapshot_Regions::add_buffer( Blip_Buffer& buf )
+{
+	add( buf );
+	add( buf.buffer_, (buf.buffer_size_ + blip_buffer_extra_) * (long) sizeof *buf.buffer_ );
+}
+
+void Snapshot_Regions::save( void* out ) const
+{
+	char* p = (char*) out;
+	for ( int i = 0; i < count; i++ )
+	{
+		memcpy( p, regions [i].begin, regions [i].size );
+		p += regions [i].size;
+	}
+}
+
+void Snapshot_Regions::load( void const* in ) const
+{
+	char const* p = (char const*) in;
+	for ( int i = 0; i < count; i++ )
+	{
+		memcpy( regions [i].begin, p, regions [i].size );
+		p += regions [i].size;
+	}
+}
+
+bool Snapshot_Regions::operator == ( Snapshot_Regions const& other ) const
+{
+	if ( count != other.count || size_ != other.size_ || unsupported != other.unsupported )
+		return false;
+
+	for ( int i = 0; i < count; i++ )
+	{
+		if ( regions [i].begin != other.regions [i].begin ||
+				regions [i].size != other.regions [i].size )
+			return false;
+	}
+	return true;
+}
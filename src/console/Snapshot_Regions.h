@@ -0,0 +1,65 @@
+// Memory holding the state of an emulator, for snapshots
+
+#ifndef SNAPSHOT_REGIONS_H
+#define SNAPSHOT_REGIONS_H
+
+#include "blargg_common.h"
+
+class Blip_Buffer;
+
+// List of memory regions which together hold the state of an emulator (CPU,
+// sound chips, buffers). A snapshot is a copy of these regions which is later
+// copied back in place, so pointers between them stay valid, but every region
+// must stay at the same address for as long as the snapshot is kept.
+class Snapshot_Regions {
+public:
+	Snapshot_Regions() { clear(); }
+
+	// Remove all regions
+	void clear();
+
+	// Add 'size' bytes at 'begin'
+	void add( void* begin, long size );
+
+	// Add object itself (not anything it points to)
+	template<class T>
+	void add( T& obj ) { add( &obj, sizeof obj ); }
+
+	// Add contents of vector
+	template<class T>
+	void add_contents( blargg_vector<T> const& v ) { add( v.begin(), (long) (v.size() * sizeof (T)) ); }
+
+	// Add Blip_Buffer along with its sample buffer
+	void add_buffer( Blip_Buffer& );
+
+	// Mark state as impossible to snapshot
+	void set_unsupported() { unsupported = true; }
+
+	// True if at least one region has been added and none were unsupported
+	bool supported() const { return !unsupported && count; }
+
+	// Total number of bytes in regions
+	long size() const { return size_; }
+
+	// Copy regions to 'size()' bytes at 'out'
+	void save( void* out ) const;
+
+	// Copy 'size()' bytes at 'in' back to regions
+	void load( void const* in ) const;
+
+	// True if both list the same regions
+	bool operator == ( Snapshot_Regions const& ) const;
+
+private:
+	enum { max_regions = 64 };
+	struct region_t {
+		void* begin;
+		long size;
+	};
+	region_t regions [max_regions];
+	int count;
+	long size_;
+	bool unsupported;
+};
+
+#endif
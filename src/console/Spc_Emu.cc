@@ -302,10 +302,19 @@ blargg_err_t Spc_Emu::start_track_( int track )
 	return 0;
 }
 
+void Spc_Emu::snapshot_regions_( Snapshot_Regions& out )
+{
+	out.add( apu );
+	out.add( filter );
+	resampler.snapshot_regions( out );
+}
+
 blargg_err_t Spc_Emu::play_and_filter( long count, sample_t out [] )
 {
+	double t = profile().begin();
 	RETURN_ERR( apu.play( count, out ) );
 	filter.run( out, count );
+	profile().end( Play_Profile::emulation, t );
 	return 0;
 }
 
@@ -339,7 +348,9 @@ blargg_err_t Spc_Emu::play_( long count, sample_t* out )
 	long remain = count;
 	while ( remain > 0 )
 	{
+		double t = profile().begin();
 		remain -= resampler.read( &out [count - remain], remain );
+		profile().end( Play_Profile::resampling, t );
 		if ( remain > 0 )
 		{
 			long n = resampler.max_write();
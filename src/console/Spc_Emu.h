@@ -67,6 +67,7 @@ protected:
 	void mute_voices_( int );
 	void set_tempo_( double );
 	void enable_accuracy_( bool );
+	void snapshot_regions_( Snapshot_Regions& );
 private:
 	byte const* file_data;
 	long        file_size;
@@ -399,6 +399,30 @@ blargg_err_t Vgm_Emu::start_track_( int track )
 	return 0;
 }
 
+void Vgm_Emu::snapshot_regions_( Snapshot_Regions& out )
+{
+	out.add( fm_time_offset );
+	out.add( vgm_time );
+	out.add( pos );
+	out.add( pcm_pos );
+	out.add( dac_amp );
+	out.add( dac_disabled );
+	out.add( psg );
+
+	if ( uses_fm )
+	{
+		ym2612.snapshot_regions( out );
+		ym2413.snapshot_regions( out );
+		out.add_buffer( blip_buf );
+		out.add( dac_synth );
+		Dual_Resampler::snapshot_regions( out );
+	}
+	else
+	{
+		Classic_Emu::buffer_regions( out );
+	}
+}
+
 blargg_err_t Vgm_Emu::run_clocks( blip_time_t& time_io, int msec )
 {
 	time_io = run_commands( msec * vgm_rate / 1000 );
@@ -411,6 +435,6 @@ blargg_err_t Vgm_Emu::play_( long count, sample_t* out )
 	if ( !uses_fm )
 		return Classic_Emu::play_( count, out );
 
-	Dual_Resampler::dual_play( count, out, blip_buf );
+	Dual_Resampler::dual_play( count, out, blip_buf, profile() );
 	return 0;
 }
@@ -2146,6 +2146,8 @@ OPLL_calc_stereo (OPLL * opll, e_int32 out[2])
 // Ym2413_Emu
 #include "Ym2413_Emu.h"
 
+#include "Snapshot_Regions.h"
+
 #include <assert.h>
 
 static int use_count = 0;
@@ -2214,3 +2216,8 @@ void Ym2413_Emu::run( int pair_count, sample_t* out )
 	}
 }
 
+void Ym2413_Emu::snapshot_regions( Snapshot_Regions& out )
+{
+	if ( opll )
+		out.add( *opll );
+}
@@ -4,6 +4,8 @@
 
 #include "Ym2612_Emu.h"
 
+#include "Snapshot_Regions.h"
+
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
@@ -845,6 +847,12 @@ Ym2612_Emu::~Ym2612_Emu()
 	free( impl );
 }
 
+void Ym2612_Emu::snapshot_regions( Snapshot_Regions& out )
+{
+	if ( impl )
+		out.add( impl->YM2612 );
+}
+
 inline void Ym2612_Impl::write0( int opn_addr, int data )
 {
 	assert( (unsigned) data <= 0xFF );
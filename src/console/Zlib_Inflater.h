@@ -23,6 +23,10 @@ public:
 	// True if begin() has been called with mode_ungz or mode_raw_deflate
 	bool deflated() const { return deflated_; }
 
+	// Number of bytes of data still in buffer when not deflated. Once these
+	// have been read, the rest can be accessed directly without read().
+	long buffered() const { return deflated_ ? 0 : zbuf.avail_in; }
+
 	// Read/inflate at most *count_io bytes into out and set *count_io to actual
 	// number of bytes read (less than requested if end of deflated data is reached).
 	// Keeps buffer full with user-provided callback.
@@ -26,6 +26,7 @@ const char * const ConsolePlugin::defaults[] = {
  "ignore_spc_length", "FALSE",
  "echo", "0",
  "inc_spc_reverb", "FALSE",
+ "profile", "FALSE",
  nullptr};
 
 bool ConsolePlugin::init ()
@@ -40,6 +41,7 @@ bool ConsolePlugin::init ()
     audcfg.ignore_spc_length = aud_get_bool (CON_CFGID, "ignore_spc_length");
     audcfg.echo = aud_get_int (CON_CFGID, "echo");
     audcfg.inc_spc_reverb = aud_get_bool (CON_CFGID, "inc_spc_reverb");
+    audcfg.profile = aud_get_bool (CON_CFGID, "profile");
 
     return true;
 }
@@ -54,4 +56,5 @@ void ConsolePlugin::cleanup ()
     aud_set_bool (CON_CFGID, "ignore_spc_length", audcfg.ignore_spc_length);
     aud_set_int (CON_CFGID, "echo", audcfg.echo);
     aud_set_bool (CON_CFGID, "inc_spc_reverb", audcfg.inc_spc_reverb);
+    aud_set_bool (CON_CFGID, "profile", audcfg.profile);
 }
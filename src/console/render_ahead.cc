@@ -0,0 +1,221 @@
+/*
+ * Audacious: Cross platform multimedia player
+ * Copyright (c) 2009-2014 Audacious Team
+ *
+ * Driver for Game_Music_Emu library. See details at:
+ * http://www.slack.net/~ant/libs/
+ */
+
+#include "render_ahead.h"
+
+#include <libaudcore/index.h>
+#include <libaudcore/runtime.h>
+
+// samples the scout plays between checks for work on the emulator
+static const int scout_samples = 16 * 1024;
+
+// same rounding as Music_Emu uses for seeking
+static long msec_to_samples(Music_Emu* emu, int msec)
+{
+    long rate = emu->sample_rate();
+    return (msec / 1000 * rate + msec % 1000 * rate / 1000) * 2;
+}
+
+RenderAhead::RenderAhead()
+{
+    m_emu = nullptr;
+    m_block = 0;
+    m_scout = nullptr;
+    m_scout_length = 0;
+    m_detected_length = -1;
+    m_running = false;
+    m_ring_time = 0;
+    m_ended = false;
+    m_seek_msec = -1;
+    m_quit = false;
+
+    pthread_mutex_init(&m_mutex, nullptr);
+    pthread_cond_init(&m_cond, nullptr);
+}
+
+RenderAhead::~RenderAhead()
+{
+    stop();
+
+    pthread_mutex_destroy(&m_mutex);
+    pthread_cond_destroy(&m_cond);
+}
+
+bool RenderAhead::start(Music_Emu* emu, int ahead_msec, int block,
+ Music_Emu* scout, int length)
+{
+    m_emu = emu;
+    m_block = block;
+    m_scout = scout;
+    m_scout_length = length;
+    m_detected_length = -1;
+
+    int size = msec_to_samples(emu, ahead_msec) / block;
+    m_ring.alloc(aud::max(size, 2) * block);
+
+    m_ring_time = msec_to_samples(emu, emu->tell());
+    m_ended = emu->track_ended();
+    m_seek_msec = -1;
+    m_quit = false;
+
+    if (pthread_create(&m_thread, nullptr, run, this))
+    {
+        AUDERR("Failed to create render-ahead thread.\n");
+        m_ring.destroy();
+        return false;
+    }
+
+    m_running = true;
+    return true;
+}
+
+void RenderAhead::stop()
+{
+    if (!m_running)
+        return;
+
+    pthread_mutex_lock(&m_mutex);
+    m_quit = true;
+    pthread_cond_broadcast(&m_cond);
+    pthread_mutex_unlock(&m_mutex);
+
+    pthread_join(m_thread, nullptr);
+    m_ring.destroy();
+    m_running = false;
+}
+
+int RenderAhead::read(Music_Emu::sample_t* out, int count)
+{
+    pthread_mutex_lock(&m_mutex);
+
+    while (m_ring.len() < count && !m_ended)
+        pthread_cond_wait(&m_cond, &m_mutex);
+
+    int n = aud::min(count, m_ring.len());
+    m_ring.move_out(out, n);
+    m_ring_time += n;
+
+    pthread_cond_broadcast(&m_cond);
+    pthread_mutex_unlock(&m_mutex);
+
+    return n;
+}
+
+void RenderAhead::seek(int msec)
+{
+    long time = msec_to_samples(m_emu, msec);
+
+    pthread_mutex_lock(&m_mutex);
+
+    if (m_seek_msec < 0 && time >= m_ring_time && time - m_ring_time <= m_ring.len())
+    {
+        // already rendered
+        m_ring.discard(time - m_ring_time);
+    }
+    else
+    {
+        m_ring.discard();
+        m_ended = false;
+        m_seek_msec = msec;
+    }
+
+    m_ring_time = time;
+
+    pthread_cond_broadcast(&m_cond);
+    pthread_mutex_unlock(&m_mutex);
+}
+
+int RenderAhead::detected_length()
+{
+    pthread_mutex_lock(&m_mutex);
+    int length = m_detected_length;
+    pthread_mutex_unlock(&m_mutex);
+
+    return length;
+}
+
+bool RenderAhead::scout_done()
+{
+    pthread_mutex_lock(&m_mutex);
+    bool done = !m_scout;
+    pthread_mutex_unlock(&m_mutex);
+
+    return done;
+}
+
+void RenderAhead::work()
+{
+    Index<Music_Emu::sample_t> buf;
+    buf.resize(m_block);
+
+    pthread_mutex_lock(&m_mutex);
+
+    while (!m_quit)
+    {
+        if (m_seek_msec >= 0)
+        {
+            int msec = m_seek_msec;
+            m_seek_msec = -1;
+
+            pthread_mutex_unlock(&m_mutex);
+            m_emu->seek(msec);
+            bool ended = m_emu->track_ended();
+            pthread_mutex_lock(&m_mutex);
+
+            // the ring was emptied when the seek was requested
+            if (m_seek_msec < 0)
+            {
+                m_ended = ended;
+                pthread_cond_broadcast(&m_cond);
+            }
+        }
+        else if (!m_ended && m_ring.space() >= m_block)
+        {
+            pthread_mutex_unlock(&m_mutex);
+            m_emu->play(m_block, buf.begin());
+            bool ended = m_emu->track_ended();
+            pthread_mutex_lock(&m_mutex);
+
+            // drop the block if a seek came in while rendering it
+            if (m_seek_msec < 0)
+            {
+                m_ring.copy_in(buf.begin(), m_block);
+                m_ended = ended;
+                pthread_cond_broadcast(&m_cond);
+            }
+        }
+        else if (m_scout)
+        {
+            Music_Emu* scout = m_scout;
+            pthread_mutex_unlock(&m_mutex);
+
+            // past the given length, only the fade is left to play
+            for (int n = 0; n < scout_samples && !scout->track_ended() &&
+             scout->tell() < m_scout_length; n += m_block)
+                scout->play(m_block, buf.begin());
+
+            bool ended = scout->track_ended();
+            int length = scout->tell();
+            pthread_mutex_lock(&m_mutex);
+
+            if (ended || length >= m_scout_length)
+            {
+                // silence ended the track before the given length
+                if (ended && length < m_scout_length)
+                    m_detected_length = length;
+
+                m_scout = nullptr;
+                pthread_cond_broadcast(&m_cond);
+            }
+        }
+        else
+            pthread_cond_wait(&m_cond, &m_mutex);
+    }
+
+    pthread_mutex_unlock(&m_mutex);
+}
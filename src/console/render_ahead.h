@@ -0,0 +1,79 @@
+/*
+ * Audacious: Cross platform multimedia player
+ * Copyright (c) 2009-2014 Audacious Team
+ *
+ * Driver for Game_Music_Emu library. See details at:
+ * http://www.slack.net/~ant/libs/
+ */
+
+#ifndef CONSOLE_RENDER_AHEAD_H
+#define CONSOLE_RENDER_AHEAD_H
+
+#include <pthread.h>
+
+#include <libaudcore/ringbuf.h>
+
+#include "Music_Emu.h"
+
+/* Runs an emulator on a worker thread, ahead of the play position, and keeps
+ * the audio it renders in a ring. Reads and forward seeks within the rendered
+ * range return at once; other seeks are passed to the emulator, which can use
+ * the snapshots it saved while rendering ahead.
+ *
+ * When the worker has nothing to render it can play a second instance of the
+ * same track (the "scout") up to the length it was given, to find out whether
+ * the track ends in silence sooner when its length isn't known. That only
+ * catches tracks that do fall silent; a track that loops forever is never
+ * found to end, and keeps the length it was given.
+ */
+class RenderAhead {
+public:
+    RenderAhead();
+    ~RenderAhead();
+
+    // Starts rendering 'emu', which must have a track started, up to
+    // 'ahead_msec' ahead of the play position, 'block' samples at a time.
+    // 'scout', if not null, must have the same track started with the fade
+    // set to end at 'length'. The worker uses both emulators until stop().
+    bool start(Music_Emu* emu, int ahead_msec, int block,
+     Music_Emu* scout = nullptr, int length = 0);
+    void stop();
+
+    // Copies up to 'count' samples to 'out', waiting for them to be
+    // rendered if needed. Returns fewer than 'count' only at end of track.
+    int read(Music_Emu::sample_t* out, int count);
+
+    void seek(int msec);
+
+    // Length of the track in milliseconds, once the scout has found that it
+    // ends before the length it was given, otherwise -1
+    int detected_length();
+
+    // True once the worker is done with the scout (or there is none), after
+    // which it may be deleted
+    bool scout_done();
+
+private:
+    static void* run(void* self) { ((RenderAhead*) self)->work(); return nullptr; }
+    void work();
+    bool scout_step();
+
+    Music_Emu* m_emu;
+    int m_block;
+    Music_Emu* m_scout;
+    int m_scout_length;
+    int m_detected_length;
+
+    pthread_t m_thread;
+    pthread_mutex_t m_mutex;
+    pthread_cond_t m_cond;       // signaled when anything below changes
+    bool m_running;
+
+    RingBuf<Music_Emu::sample_t> m_ring;
+    long m_ring_time;             // play position of first sample in ring
+    bool m_ended;                 // no more samples after those in ring
+    int m_seek_msec;              // -1 if none pending
+    bool m_quit;
+};
+
+#endif // CONSOLE_RENDER_AHEAD_H
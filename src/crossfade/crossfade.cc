@@ -17,11 +17,20 @@
  * the use of this software.
  */
 
+#include <math.h>
+#include <string.h>
+
+#include <libaudcore/drct.h>
 #include <libaudcore/i18n.h>
 #include <libaudcore/plugin.h>
 #include <libaudcore/preferences.h>
+#include <libaudcore/ringbuf.h>
 #include <libaudcore/runtime.h>
 
+#include "loudness.h"
+#include "../effect-common/channel-matrix.h"
+#include "../effect-common/effect-params.h"
+
 enum
 {
     STATE_OFF,
@@ -31,11 +40,41 @@ enum
     STATE_FLUSHED
 };
 
+enum
+{
+    CURVE_LINEAR,
+    CURVE_EQUAL_POWER,
+    CURVE_S,
+    CURVE_MATCHED  /* chosen automatically, see match_head() */
+};
+
+/* frames of gain values computed at once */
+#define FADE_BLOCK 256
+
+/* resampler kernel: zero crossings on either side, table resolution, and
+ * cut-off relative to the lower of the two Nyquist frequencies */
+#define SINC_HALF 16
+#define SINC_PHASES 256
+#define SINC_CUTOFF 0.9
+
+/* safety margin when using the song length to start buffering late, in
+ * multiples of the overlap, since reported lengths (of VBR files without an
+ * index, for example) can be off by seconds */
+#define LENGTH_MARGIN 2.0
+
+/* how far below the level of the outgoing song audio counts as silence, and
+ * the largest difference in level that loudness matching makes up for */
+#define MATCH_RANGE 20.0f /* LU */
+
 static const char * const crossfade_defaults[] = {
     "automatic", "TRUE",
     "length", "5",
     "manual", "TRUE",
     "manual_length", "0.2",
+    "curve", aud::numeric_string<CURVE_LINEAR>::str,
+    "loudness_match", "FALSE",
+    "loudness_delay", "3",
+    "late_buffering", "FALSE",
     nullptr
 };
 
@@ -43,20 +82,66 @@ static const char crossfade_about[] =
  N_("Crossfade Plugin for Audacious\n"
     "Copyright 2010-2014 John Lindgren");
 
+struct CrossfadeSettings {
+    bool automatic, manual, loudness_match, late_buffering;
+    double length, manual_length, loudness_delay;  /* seconds */
+    int curve;
+};
+
+/* Settings are published here when changed in the UI and picked up by the
+ * audio thread at the start of each call */
+static EffectParams<CrossfadeSettings> params;
+static CrossfadeSettings settings;
+
+static void update_config ()
+{
+    CrossfadeSettings s;
+
+    s.automatic = aud_get_bool ("crossfade", "automatic");
+    s.manual = aud_get_bool ("crossfade", "manual");
+    s.loudness_match = aud_get_bool ("crossfade", "loudness_match");
+    s.late_buffering = aud_get_bool ("crossfade", "late_buffering");
+    s.length = aud_get_double ("crossfade", "length");
+    s.manual_length = aud_get_double ("crossfade", "manual_length");
+    s.loudness_delay = aud_get_double ("crossfade", "loudness_delay");
+    s.curve = aud_get_int ("crossfade", "curve");
+
+    params.publish (s);
+}
+
+static const ComboItem curve_list[] = {
+    ComboItem (N_("Linear"), CURVE_LINEAR),
+    ComboItem (N_("Equal power"), CURVE_EQUAL_POWER),
+    ComboItem (N_("S-curve"), CURVE_S)
+};
+
 static const PreferencesWidget crossfade_widgets[] = {
     WidgetLabel (N_("<b>Crossfade</b>")),
     WidgetCheck (N_("On automatic song change"),
-        WidgetBool ("crossfade", "automatic")),
+        WidgetBool ("crossfade", "automatic", update_config)),
     WidgetSpin (N_("Overlap:"),
-        WidgetFloat ("crossfade", "length"),
+        WidgetFloat ("crossfade", "length", update_config),
         {1, 15, 0.5, N_("seconds")},
         WIDGET_CHILD),
+    WidgetCheck (N_("Buffer only the end of songs of known length"),
+        WidgetBool ("crossfade", "late_buffering", update_config),
+        WIDGET_CHILD),
+    WidgetCheck (N_("Match loudness (EBU R128)"),
+        WidgetBool ("crossfade", "loudness_match", update_config),
+        WIDGET_CHILD),
+    WidgetSpin (N_("Look ahead at most:"),
+        WidgetFloat ("crossfade", "loudness_delay", update_config),
+        {0.5, 5, 0.5, N_("seconds")},
+        WIDGET_CHILD),
     WidgetCheck (N_("On seek or manual song change"),
-        WidgetBool ("crossfade", "manual")),
+        WidgetBool ("crossfade", "manual", update_config)),
     WidgetSpin (N_("Overlap:"),
-        WidgetFloat ("crossfade", "manual_length"),
+        WidgetFloat ("crossfade", "manual_length", update_config),
         {0.1, 3.0, 0.1, N_("seconds")},
         WIDGET_CHILD),
+    WidgetCombo (N_("Fade curve:"),
+        WidgetInt ("crossfade", "curve", update_config),
+        {{curve_list}}),
     WidgetLabel (N_("<b>Tip</b>")),
     WidgetLabel (N_("For better crossfading, enable\n"
                     "the Silence Removal effect."))
@@ -91,102 +176,502 @@ EXPORT Crossfade aud_plugin_instance;
 
 static char state = STATE_OFF;
 static int current_channels, current_rate;
-static Index<float> buffer, output;
+static RingBuf<float> buffer;
+static Index<float> output, scratch;
 static int fadein_point;
 
+/* Position in and length of the current song, in frames (-1 if unknown, or
+ * if "late_buffering" was off when the song started).  These let us hold back
+ * the end of a song only when it is near, rather than delaying the whole song
+ * by the length of the crossfade.  This is off by default, since the buffer
+ * then grows near the end of the song, taking in two frames for every one it
+ * gives out, which a slow decoder or network stream may not keep up with.
+ * If a song ends before the full overlap has been buffered, lengths are not
+ * trusted again until playback stops, and the whole overlap is buffered at
+ * all times. */
+static int64_t song_frames, song_length;
+static bool trust_length;
+
+/* After a short crossfade, the overlap buffered before it (in seconds), from
+ * which the buffer grows back to the full overlap during the next song */
+static double regrow_overlap = -1;
+
+/* Loudness matching: the end of the outgoing song is trimmed back to its last
+ * audible block, the start of the incoming song is held back (up to
+ * "loudness_delay" seconds) so that leading silence can be skipped, and the
+ * fade curves are chosen from the levels of the two. */
+static LoudnessMeter meter;
+static bool metering, match_pending;
+static Index<float> head;
+static int head_skip;
+static float match_threshold, tail_energy, match_ratio;
+static int transition_curve = -1;
+
 bool Crossfade::init ()
 {
     aud_config_set_defaults ("crossfade", crossfade_defaults);
+    update_config ();
     return true;
 }
 
 void Crossfade::cleanup ()
 {
     state = STATE_OFF;
-    buffer.clear ();
+    buffer.destroy ();
     output.clear ();
+    scratch.clear ();
+    head.clear ();
+    match_pending = false;
+    transition_curve = -1;
+}
+
+/* The buffer is only ever filled and emptied a whole number of frames at a
+ * time and its size is a multiple of the frame size, so any part of it
+ * consists of at most two contiguous runs of whole frames: one up to the end
+ * of the storage and one from the start. */
+template<class F>
+static void for_each_run (int pos, int len, F func)
+{
+    int linear = buffer.linear ();
+
+    if (pos < linear)
+    {
+        int run = aud::min (len, linear - pos);
+        func (& buffer[pos], pos, run);
+        pos += run;
+        len -= run;
+    }
+
+    if (len > 0)
+        func (& buffer[pos], pos, len);
+}
+
+/* Changes the size of the buffer, keeping its contents.  The size is rounded
+ * to a whole number of frames (see above). */
+static void resize_buffer (int size)
+{
+    size -= size % current_channels;
+
+    scratch.resize (0);
+    buffer.move_out (scratch, -1, buffer.len ());
+    buffer.alloc (size);
+    buffer.copy_in (scratch.begin (), scratch.len ());
+}
+
+static void buffer_append (const float * data, int len)
+{
+    if (buffer.space () < len)
+        resize_buffer ((buffer.len () + len) * 3 / 2 + current_channels);
+
+    buffer.copy_in (data, len);
+}
+
+static void buffer_append_silence (int len)
+{
+    Index<float> silence;
+    silence.insert (0, len);
+    buffer_append (silence.begin (), len);
+}
+
+static float fade_gain (int curve, float x, bool fade_in)
+{
+    switch (curve)
+    {
+    case CURVE_EQUAL_POWER:
+        return fade_in ? sinf (x * (float) M_PI_2) : cosf (x * (float) M_PI_2);
+    case CURVE_S:
+    {
+        float s = x * x * (3 - 2 * x);
+        return fade_in ? s : 1 - s;
+    }
+    case CURVE_MATCHED:
+    {
+        /* Move the total energy smoothly (in dB) from the level of the
+         * outgoing song to that of the incoming one.  The outgoing song fades
+         * as in an equal-power fade, or faster if the incoming one is much
+         * quieter; the incoming song makes up the rest. */
+        float target = powf (match_ratio, x);
+        float c = cosf (x * (float) M_PI_2);
+        float out = aud::min (c * c, target);
+
+        if (! fade_in)
+            return sqrtf (out);
+
+        return sqrtf (aud::clamp ((target - out) / match_ratio, 0.0f, 1.0f));
+    }
+    default:
+        return fade_in ? x : 1 - x;
+    }
 }
 
-static void do_ramp (float * data, int length, float a, float b)
+/* Applies a fade to <frames> frames at <pos> frames into a fade of <length>
+ * frames.  The gains are computed a block at a time, so that the inner loop
+ * is a plain multiplication. */
+static void apply_fade (float * data, int frames, int pos, int length, bool fade_in)
+{
+    int curve = (transition_curve >= 0) ? transition_curve : settings.curve;
+    float gains[FADE_BLOCK];
+
+    while (frames > 0)
+    {
+        int block = aud::min (frames, FADE_BLOCK);
+
+        for (int f = 0; f < block; f ++)
+            gains[f] = fade_gain (curve, (float) (pos + f) / length, fade_in);
+
+        for (int f = 0; f < block; f ++)
+        {
+            for (int c = 0; c < current_channels; c ++)
+                data[c] *= gains[f];
+
+            data += current_channels;
+        }
+
+        pos += block;
+        frames -= block;
+    }
+}
+
+static void fade_buffer_out ()
+{
+    int length = buffer.len () / current_channels;
+
+    for_each_run (0, buffer.len (), [length] (float * data, int pos, int len)
+        { apply_fade (data, len / current_channels, pos / current_channels, length, false); });
+}
+
+static void mix (float * data, const float * add, int length)
 {
     for (int i = 0; i < length; i ++)
+        data[i] += add[i];
+}
+
+static double sinc_window (double x)
+{
+    double t = x / SINC_HALF;
+
+    if (x == 0)
+        return 1;
+    if (fabs (t) >= 1)
+        return 0;
+
+    /* Blackman window */
+    double window = 0.42 + 0.5 * cos (M_PI * t) + 0.08 * cos (2 * M_PI * t);
+
+    return sin (M_PI * x) / (M_PI * x) * window;
+}
+
+/* Converts <in> (interleaved, <frames> frames) to a new channel count, with
+ * the ITU-R BS.775 matrix the mixer plugin uses, or by nearest channel for
+ * layouts it does not know. */
+static void rechannel (const float * in, int frames, int old_channels,
+ Index<float> & out, int channels)
+{
+    ChannelMatrix matrix;
+
+    if (! channel_matrix_bs775 (matrix, old_channels, channels))
+    {
+        memset (matrix, 0, sizeof matrix);
+        for (int c = 0; c < channels; c ++)
+            matrix[c][c * old_channels / channels] = 1;
+    }
+
+    out.resize (frames * channels);
+    float * dest = out.begin ();
+
+    for (int f = 0; f < frames; f ++)
     {
-        * data = (* data) * (a * (length - i) + b * i) / length;
-        data ++;
+        for (int c = 0; c < channels; c ++)
+        {
+            float sum = 0;
+            for (int i = 0; i < old_channels; i ++)
+                sum += matrix[c][i] * in[i];
+
+            dest[c] = sum;
+        }
+
+        in += old_channels;
+        dest += channels;
     }
 }
 
-static void mix (float * data, float * add, int length)
+/* Converts the contents of <in> (interleaved, <frames> frames) to a new
+ * channel count and rate, using a windowed-sinc interpolator whose cut-off is
+ * lowered when reducing the rate, to avoid aliasing. */
+static void convert (const float * in, int frames, int old_channels, int old_rate,
+ Index<float> & out, int channels, int rate)
 {
-    while (length --)
-        (* data ++) += (* add ++);
+    Index<float> mixed;
+
+    if (channels != old_channels)
+    {
+        rechannel (in, frames, old_channels, mixed, channels);
+        in = mixed.begin ();
+    }
+
+    int new_frames = (int64_t) frames * rate / old_rate;
+
+    if (rate == old_rate)
+    {
+        if (channels != old_channels)
+            out = std::move (mixed);
+        else
+            out.insert (in, 0, frames * channels);
+
+        return;
+    }
+
+    out.resize (new_frames * channels);
+
+    /* kernel widths are in input frames */
+    double scale = aud::min (1.0, (double) rate / old_rate) * SINC_CUTOFF;
+    int half = (int) ceil (SINC_HALF / scale);
+    int taps = 2 * half;
+
+    /* table[p][k]: weight of input frame (i - half + 1 + k) for an output
+     * frame at input position i + p / SINC_PHASES */
+    Index<float> table;
+    table.resize ((SINC_PHASES + 1) * taps);
+
+    for (int p = 0; p <= SINC_PHASES; p ++)
+    {
+        for (int k = 0; k < taps; k ++)
+        {
+            double d = (double) p / SINC_PHASES + half - 1 - k;
+            table[p * taps + k] = scale * sinc_window (d * scale);
+        }
+    }
+
+    Index<float> weights;
+    weights.resize (taps);
+
+    for (int f = 0; f < new_frames; f ++)
+    {
+        int64_t fixed = (int64_t) f * old_rate * SINC_PHASES / rate;
+        int i = fixed / SINC_PHASES;
+        int phase = fixed % SINC_PHASES;
+
+        /* the kernel for in-between positions is interpolated linearly */
+        double t = ((double) f * old_rate / rate - i) * SINC_PHASES - phase;
+        const float * w0 = & table[phase * taps];
+        const float * w1 = w0 + taps;
+
+        for (int k = 0; k < taps; k ++)
+            weights[k] = w0[k] + (w1[k] - w0[k]) * (float) t;
+
+        int first = i - half + 1;
+        int k0 = aud::max (0, -first);
+        int k1 = aud::min (taps, frames - first);
+
+        for (int c = 0; c < channels; c ++)
+        {
+            const float * src = in + (int64_t) first * channels + c;
+            float sum = 0;
+
+            for (int k = k0; k < k1; k ++)
+                sum += src[k * channels] * weights[k];
+
+            out[f * channels + c] = sum;
+        }
+    }
 }
 
-/* stupid simple resampling/rechanneling algorithm */
 static void reformat (int channels, int rate)
 {
     if (channels == current_channels && rate == current_rate)
         return;
 
-    int old_frames = buffer.len () / current_channels;
-    int new_frames = (int64_t) old_frames * rate / current_rate;
+    Index<float> old;
+    buffer.move_out (old, -1, buffer.len ());
 
-    int map[AUD_MAX_CHANNELS];
-    for (int c = 0; c < channels; c ++)
-        map[c] = c * current_channels / channels;
+    Index<float> converted;
+    convert (old.begin (), old.len () / current_channels, current_channels,
+     current_rate, converted, channels, rate);
 
-    Index<float> new_buffer;
-    new_buffer.resize (new_frames * channels);
+    current_channels = channels;
+    current_rate = rate;
 
-    for (int f = 0; f < new_frames; f ++)
+    resize_buffer (converted.len () + channels * rate);
+    buffer.copy_in (converted.begin (), converted.len ());
+}
+
+/* When the song length is known, the full automatic crossfade only needs to
+ * be held back at the end of the song.  Buffering starts early enough, and
+ * grows slowly enough (by half a frame per frame played), that the decoder
+ * need only run at twice real time to keep up.  Otherwise the whole overlap
+ * is buffered all the time, as it always used to be. */
+static double automatic_overlap ()
+{
+    double overlap = settings.length;
+
+    if ((state == STATE_RUNNING || state == STATE_FADEIN) && trust_length &&
+     song_length > 0 && song_frames >= 0)
     {
-        int f0 = (int64_t) f * current_rate / rate;
-        int s0 = f0 * current_channels;
-        int s = f * channels;
+        double left = (double) (song_length - song_frames) / current_rate -
+         LENGTH_MARGIN * overlap;
+        return aud::clamp ((3 * overlap - left) / 2, 0.0, overlap);
+    }
 
-        for (int c = 0; c < channels; c ++)
-            new_buffer[s + c] = buffer[s0 + map[c]];
+    /* growing the buffer all at once would leave a gap in the output, so it
+     * grows by half a frame per frame, as above */
+    if (state == STATE_RUNNING && regrow_overlap >= 0 && song_frames >= 0)
+    {
+        double grown = aud::max (regrow_overlap, (double) song_frames / current_rate / 2);
+        if (grown < overlap)
+            return grown;
+
+        regrow_overlap = -1;
     }
 
-    buffer = std::move (new_buffer);
+    return overlap;
 }
 
 static int buffer_needed_for_state ()
 {
     double overlap = 0;
 
-    if (state != STATE_FLUSHED && aud_get_bool ("crossfade", "automatic"))
-        overlap = aud_get_double ("crossfade", "length");
+    if (state != STATE_FLUSHED && settings.automatic)
+        overlap = automatic_overlap ();
 
-    if (state != STATE_FINISHED && aud_get_bool ("crossfade", "manual"))
-        overlap = aud::max (overlap, aud_get_double ("crossfade", "manual_length"));
+    if (state != STATE_FINISHED && settings.manual)
+        overlap = aud::max (overlap, settings.manual_length);
 
     return current_channels * (int) (current_rate * overlap);
 }
 
+/* Called when a song ends: trims trailing silence from the buffer, and
+ * measures what is left. */
+static void match_tail ()
+{
+    int frames = buffer.len () / current_channels;
+    int block = meter.block_frames ();
+
+    match_threshold = aud::max (meter.program_energy () * powf (10, -MATCH_RANGE / 10),
+     LoudnessMeter::gate ());
+
+    int end = frames;
+
+    for (int ago = 0; ago < frames; ago += block)
+    {
+        float energy = meter.block_energy (ago);
+        if (energy < 0 || energy >= match_threshold)
+        {
+            end = ago;
+            break;
+        }
+    }
+
+    /* leave one block of decay */
+    int trim = aud::max (0, end - block);
+
+    if (trim > 0)
+    {
+        Index<float> keep;
+        buffer.move_out (keep, -1, (frames - trim) * current_channels);
+        buffer.discard ();
+        buffer.copy_in (keep.begin (), keep.len ());
+
+        AUDDBG ("Trimmed %d ms of silence.\n", aud::rescale (trim, current_rate, 1000));
+    }
+
+    /* the short-term loudness as the song fades from hearing */
+    tail_energy = aud::max (meter.short_term_energy (trim), 0.0f);
+
+    head.resize (0);
+    match_pending = true;
+}
+
+/* Called as the next song starts: collects its first blocks in <head> and,
+ * once there is enough (or <force> is set), replaces <data> with them and
+ * sets up the transition.  Enough is a short-term window of audio after any
+ * leading silence, or "loudness_delay" seconds in all if that comes first.
+ * Returns false if more data is needed. */
+static bool match_head (Index<float> & data, bool force)
+{
+    head.insert (data.begin (), -1, data.len ());
+
+    int frames = head.len () / current_channels;
+    int block = meter.block_frames ();
+    int window = block * LoudnessMeter::SHORT_TERM_BLOCKS;
+
+    /* the head is everything the meter has seen of this song */
+    int skip = frames;
+
+    for (int f = 0; f < frames; f += block)
+    {
+        float energy = meter.block_energy (frames - 1 - f);
+        if (energy < 0 || energy >= match_threshold)
+        {
+            skip = aud::max (0, f - block);
+            break;
+        }
+    }
+
+    if (! force && frames - skip < window && frames < current_rate * settings.loudness_delay)
+        return false;
+
+    /* the loudness of the first (up to) 3 seconds heard */
+    float head_energy = meter.mean_energy (aud::max (0, frames - skip - window), frames - skip);
+    float range = powf (10, MATCH_RANGE / 10);
+
+    if (tail_energy > 0 && head_energy > 0)
+        match_ratio = aud::clamp (head_energy / tail_energy, 1 / range, range);
+    else
+        match_ratio = 1;
+
+    AUDDBG ("Skipping %d ms of silence, level difference %.1f LU.\n",
+     aud::rescale (skip, current_rate, 1000), 10 * log10f (match_ratio));
+
+    transition_curve = CURVE_MATCHED;
+    head_skip = skip * current_channels;
+    match_pending = false;
+
+    data = std::move (head);
+    return true;
+}
+
 static void output_data_as_ready (int buffer_needed, bool exact)
 {
     int copy = buffer.len () - buffer_needed;
 
     /* if allowed, wait until we have at least 1/2 second ready to output */
     if (exact ? (copy > 0) : (copy >= current_channels * (current_rate / 2)))
-        output.move_from (buffer, 0, -1, copy, true, true);
+        buffer.move_out (output, -1, copy);
 }
 
 void Crossfade::start (int & channels, int & rate)
 {
+    params.fetch (settings);
+
     if (state != STATE_OFF)
         reformat (channels, rate);
 
     current_channels = channels;
     current_rate = rate;
 
+    int length = aud_drct_get_length ();
+    song_length = (settings.late_buffering && length > 0) ?
+     aud::rescale<int64_t> (length, 1000, rate) : -1;
+    song_frames = 0;
+
+    metering = settings.automatic && settings.loudness_match;
+
+    if (metering)
+        meter.start (channels, rate);
+    else
+        match_pending = false;
+
     if (state == STATE_OFF)
     {
-        if (aud_get_bool ("crossfade", "manual"))
+        /* start over with a buffer sized for this frame size */
+        buffer.destroy ();
+        trust_length = true;
+        regrow_overlap = -1;
+
+        if (settings.manual)
         {
             state = STATE_FLUSHED;
-            buffer.insert (0, buffer_needed_for_state ());
+            buffer_append_silence (buffer_needed_for_state ());
         }
         else
             state = STATE_RUNNING;
@@ -195,49 +680,74 @@ void Crossfade::start (int & channels, int & rate)
 
 static void run_fadeout ()
 {
-    do_ramp (buffer.begin (), buffer.len (), 1.0, 0.0);
+    fade_buffer_out ();
 
     state = STATE_FADEIN;
     fadein_point = 0;
 }
 
-static void run_fadein (Index<float> & data)
+/* returns the number of samples of <data> used (including any skipped at the
+ * start of a loudness-matched transition) */
+static int run_fadein (Index<float> & data)
 {
     int length = buffer.len ();
+    int offset = aud::min (head_skip, data.len ());
+    int copy = 0;
+
+    head_skip = 0;
 
     if (fadein_point < length)
     {
-        int copy = aud::min (data.len (), length - fadein_point);
-        float a = (float) fadein_point / length;
-        float b = (float) (fadein_point + copy) / length;
+        copy = aud::min (data.len () - offset, length - fadein_point);
+        float * src = data.begin () + offset;
+
+        apply_fade (src, copy / current_channels,
+         fadein_point / current_channels, length / current_channels, true);
 
-        do_ramp (data.begin (), copy, a, b);
-        mix (& buffer[fadein_point], data.begin (), copy);
-        data.remove (0, copy);
+        for_each_run (fadein_point, copy, [src] (float * dest, int pos, int len)
+            { mix (dest, src + (pos - fadein_point), len); });
 
         fadein_point += copy;
     }
 
     if (fadein_point == length)
+    {
         state = STATE_RUNNING;
+        transition_curve = -1;
+    }
+
+    return offset + copy;
 }
 
 Index<float> & Crossfade::process (Index<float> & data)
 {
+    params.fetch (settings);
+
     if (state == STATE_OFF)
         return data;
 
     output.resize (0);
 
+    if (song_frames >= 0)
+        song_frames += data.len () / current_channels;
+
+    if (metering)
+        meter.analyze (data.begin (), data.len () / current_channels);
+
+    if (state == STATE_FINISHED && match_pending && ! match_head (data, false))
+        return output;
+
     if (state == STATE_FINISHED || state == STATE_FLUSHED)
         run_fadeout ();
 
+    int used = 0;
+
     if (state == STATE_FADEIN)
-        run_fadein (data);
+        used = run_fadein (data);
 
     if (state == STATE_RUNNING)
     {
-        buffer.insert (data.begin (), -1, data.len ());
+        buffer_append (data.begin () + used, data.len () - used);
         output_data_as_ready (buffer_needed_for_state (), false);
     }
 
@@ -246,46 +756,96 @@ Index<float> & Crossfade::process (Index<float> & data)
 
 bool Crossfade::flush (bool force)
 {
+    params.fetch (settings);
+
     if (state == STATE_OFF)
         return true;
 
-    if (! force && aud_get_bool ("crossfade", "manual"))
+    /* after a seek, we no longer know where we are in the song */
+    song_frames = -1;
+    regrow_overlap = -1;
+
+    match_pending = false;
+    head.resize (0);
+    head_skip = 0;
+    transition_curve = -1;
+
+    if (! force && settings.manual)
     {
         state = STATE_FLUSHED;
         int buffer_needed = buffer_needed_for_state ();
+
+        /* keep the oldest part of the buffer */
         if (buffer.len () > buffer_needed)
-            buffer.remove (buffer_needed, -1);
+        {
+            Index<float> keep;
+            buffer.move_out (keep, -1, buffer_needed);
+            buffer.discard ();
+            buffer.copy_in (keep.begin (), keep.len ());
+        }
 
         return false;
     }
 
     state = STATE_RUNNING;
-    buffer.resize (0);
+    buffer.discard ();
 
     return true;
 }
 
 Index<float> & Crossfade::finish (Index<float> & data, bool end_of_playlist)
 {
+    params.fetch (settings);
+
     if (state == STATE_OFF)
         return data;
 
     output.resize (0);
 
+    if (song_frames >= 0)
+        song_frames += data.len () / current_channels;
+
+    if (metering)
+        meter.analyze (data.begin (), data.len () / current_channels);
+
+    if (state == STATE_FINISHED && match_pending)
+    {
+        match_head (data, true);
+        run_fadeout ();
+    }
+
+    int used = 0;
+
     if (state == STATE_FADEIN)
-        run_fadein (data);
+        used = run_fadein (data);
 
     if (state == STATE_RUNNING || state == STATE_FINISHED || state == STATE_FLUSHED)
     {
-        buffer.insert (data.begin (), -1, data.len ());
+        buffer_append (data.begin () + used, data.len () - used);
         output_data_as_ready (buffer_needed_for_state (), state != STATE_RUNNING);
     }
 
     if (state == STATE_FADEIN || state == STATE_RUNNING)
     {
-        if (aud_get_bool ("crossfade", "automatic"))
+        if (settings.automatic)
         {
+            /* the song was shorter than it claimed, so the crossfade will be
+             * too; go back to buffering the whole overlap */
+            double overlap = automatic_overlap ();
+
+            if (overlap < settings.length)
+            {
+                AUDDBG ("Song ended %d ms early, ignoring song lengths.\n",
+                 (int) aud::rescale<int64_t> (song_length - song_frames, current_rate, 1000));
+                trust_length = false;
+                regrow_overlap = overlap;
+            }
+
             state = STATE_FINISHED;
+
+            if (metering)
+                match_tail ();
+
             output_data_as_ready (buffer_needed_for_state (), true);
         }
         else
@@ -297,9 +857,10 @@ Index<float> & Crossfade::finish (Index<float> & data, bool end_of_playlist)
 
     if (end_of_playlist && (state == STATE_FINISHED || state == STATE_FLUSHED))
     {
-        do_ramp (buffer.begin (), buffer.len (), 1.0, 0.0);
+        fade_buffer_out ();
 
         state = STATE_OFF;
+        match_pending = false;
         output_data_as_ready (0, true);
     }
 
@@ -308,5 +869,6 @@ Index<float> & Crossfade::finish (Index<float> & data, bool end_of_playlist)
 
 int Crossfade::adjust_delay (int delay)
 {
-    return delay + aud::rescale<int64_t> (buffer.len () / current_channels, current_rate, 1000);
+    int frames = (buffer.len () + head.len ()) / current_channels;
+    return delay + aud::rescale<int64_t> (frames, current_rate, 1000);
 }
@@ -0,0 +1,204 @@
+/*
+ * Loudness Meter for the Crossfade Plugin
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "loudness.h"
+
+#include <math.h>
+
+#include <libaudcore/objects.h>
+
+#define BLOCK_TIME 0.1 /* seconds */
+
+float LoudnessMeter::gate ()
+{
+    return powf (10, (-70 + 0.691f) / 10);
+}
+
+/* The K-weighting filter of BS.1770 (a high shelf followed by a high pass),
+ * specified by its analog prototype so that it works at any sample rate. */
+void LoudnessMeter::start (int channels, int rate)
+{
+    m_channels = channels;
+    m_block_frames = (int) (rate * BLOCK_TIME);
+
+    double f0 = 1681.974450955533;
+    double gain = 3.999843853973347;
+    double q = 0.7071752369554196;
+
+    double k = tan (M_PI * f0 / rate);
+    double vh = pow (10, gain / 20);
+    double vb = pow (vh, 0.4996667741545416);
+    double a0 = 1 + k / q + k * k;
+
+    m_shelf.b0 = (vh + vb * k / q + k * k) / a0;
+    m_shelf.b1 = 2 * (k * k - vh) / a0;
+    m_shelf.b2 = (vh - vb * k / q + k * k) / a0;
+    m_shelf.a1 = 2 * (k * k - 1) / a0;
+    m_shelf.a2 = (1 - k / q + k * k) / a0;
+
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+    k = tan (M_PI * f0 / rate);
+    a0 = 1 + k / q + k * k;
+
+    m_highpass.b0 = 1;
+    m_highpass.b1 = -2;
+    m_highpass.b2 = 1;
+    m_highpass.a1 = 2 * (k * k - 1) / a0;
+    m_highpass.a2 = (1 - k / q + k * k) / a0;
+
+    m_state.resize (4 * channels);
+    m_blocks.resize (MAX_BLOCKS);
+    m_short_term.resize (MAX_BLOCKS);
+
+    reset ();
+}
+
+void LoudnessMeter::reset ()
+{
+    for (float & z : m_state)
+        z = 0;
+
+    m_count = 0;
+    m_frames = 0;
+    m_sum = 0;
+    m_filled = 0;
+    m_window_sum = 0;
+    m_gated_sum = 0;
+    m_gated_blocks = 0;
+}
+
+void LoudnessMeter::analyze (const float * data, int frames)
+{
+    const Biquad s = m_shelf, h = m_highpass;
+    const int channels = m_channels;
+    float * z1 = m_state.begin ();
+    float * z2 = z1 + channels;
+    float * z3 = z2 + channels;
+    float * z4 = z3 + channels;
+
+    m_frames += frames;
+
+    while (frames > 0)
+    {
+        int chunk = aud::min (frames, m_block_frames - m_filled);
+        float sum = 0;
+
+        /* transposed direct form II; the channels of a frame are independent,
+         * so the inner loop can be vectorized */
+        for (int f = 0; f < chunk; f ++)
+        {
+            for (int c = 0; c < channels; c ++)
+            {
+                float x = data[c];
+
+                float y = s.b0 * x + z1[c];
+                z1[c] = s.b1 * x - s.a1 * y + z2[c];
+                z2[c] = s.b2 * x - s.a2 * y;
+
+                float w = h.b0 * y + z3[c];
+                z3[c] = h.b1 * y - h.a1 * w + z4[c];
+                z4[c] = h.b2 * y - h.a2 * w;
+
+                sum += w * w;
+            }
+
+            data += channels;
+        }
+
+        m_sum += sum;
+        m_filled += chunk;
+        frames -= chunk;
+
+        if (m_filled == m_block_frames)
+        {
+            float energy = m_sum / m_block_frames;
+
+            /* slide the short-term window along by one block */
+            m_window_sum += energy;
+            if (m_count >= SHORT_TERM_BLOCKS)
+                m_window_sum -= m_blocks[(m_count - SHORT_TERM_BLOCKS) % MAX_BLOCKS];
+
+            int window = aud::min (m_count + 1, (int64_t) SHORT_TERM_BLOCKS);
+
+            m_blocks[m_count % MAX_BLOCKS] = energy;
+            m_short_term[m_count % MAX_BLOCKS] = aud::max (m_window_sum / window, 0.0);
+            m_count ++;
+
+            if (energy > gate ())
+            {
+                m_gated_sum += energy;
+                m_gated_blocks ++;
+            }
+
+            m_sum = 0;
+            m_filled = 0;
+        }
+    }
+}
+
+float LoudnessMeter::block_energy (int64_t frames_ago) const
+{
+    int64_t frame = m_frames - 1 - frames_ago;
+
+    if (frame < 0 || ! m_block_frames)
+        return -1;
+
+    int64_t block = frame / m_block_frames;
+
+    if (block >= m_count)
+        return m_filled ? m_sum / m_filled : -1;
+    if (block < m_count - MAX_BLOCKS)
+        return -1;
+
+    return m_blocks[block % MAX_BLOCKS];
+}
+
+float LoudnessMeter::short_term_energy (int64_t frames_ago) const
+{
+    int64_t frame = m_frames - 1 - frames_ago;
+
+    if (frame < 0 || ! m_block_frames)
+        return -1;
+
+    int64_t block = aud::min (frame / m_block_frames, m_count - 1);
+
+    if (block < 0 || block < m_count - MAX_BLOCKS)
+        return -1;
+
+    return m_short_term[block % MAX_BLOCKS];
+}
+
+float LoudnessMeter::mean_energy (int64_t from_ago, int64_t to_ago) const
+{
+    double sum = 0;
+    int count = 0;
+
+    for (int64_t ago = from_ago; ago < to_ago; ago += m_block_frames)
+    {
+        float energy = block_energy (ago);
+
+        if (energy > gate ())
+        {
+            sum += energy;
+            count ++;
+        }
+    }
+
+    return count ? sum / count : 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * Loudness Meter for the Crossfade Plugin
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef CROSSFADE_LOUDNESS_H
+#define CROSSFADE_LOUDNESS_H
+
+#include <stdint.h>
+
+#include <libaudcore/index.h>
+
+/* Streaming loudness envelope as in EBU R128 / ITU-R BS.1770: the audio is
+ * K-weighted and its mean square is taken over 100 ms blocks, and over the
+ * 3-second short-term window ending with each block.  Values are returned as
+ * mean-square energies (linear); the loudness in LUFS is -0.691 + 10 log10
+ * (energy).  The most recent MAX_BLOCKS blocks are kept. */
+class LoudnessMeter
+{
+public:
+    static constexpr int MAX_BLOCKS = 256;
+    static constexpr int SHORT_TERM_BLOCKS = 30;
+
+    void start (int channels, int rate);
+    void reset ();
+
+    void analyze (const float * data, int frames);
+
+    /* energy of the block containing the frame <frames_ago> frames before the
+     * newest one analyzed (the newest block may be incomplete), or -1 if that
+     * block is no longer kept */
+    float block_energy (int64_t frames_ago) const;
+
+    /* short-term energy: the mean of the (up to) SHORT_TERM_BLOCKS blocks
+     * ending with the one containing the frame <frames_ago> frames before the
+     * newest one analyzed, or with the last complete block if that one is
+     * not; -1 if there is no such block kept */
+    float short_term_energy (int64_t frames_ago) const;
+
+    /* mean energy of the blocks covering the given range (the same way as
+     * above, <to_ago> exclusive), ignoring blocks below the absolute gate;
+     * 0 if there are none */
+    float mean_energy (int64_t from_ago, int64_t to_ago) const;
+
+    /* mean energy of all blocks since reset() above the absolute gate */
+    float program_energy () const
+        { return m_gated_blocks ? m_gated_sum / m_gated_blocks : 0; }
+
+    int block_frames () const
+        { return m_block_frames; }
+
+    static float gate ();  /* the absolute gate, -70 LUFS */
+
+private:
+    struct Biquad {
+        float b0, b1, b2, a1, a2;
+    };
+
+    int m_channels = 0, m_block_frames = 0;
+    Biquad m_shelf {}, m_highpass {};
+    Index<float> m_state;        /* 4 values per channel */
+
+    Index<float> m_blocks;       /* ring of MAX_BLOCKS */
+    Index<float> m_short_term;   /* ring of MAX_BLOCKS */
+    double m_window_sum = 0;     /* of the last SHORT_TERM_BLOCKS blocks */
+    int64_t m_count = 0;         /* complete blocks since reset() */
+    int64_t m_frames = 0;        /* frames since reset() */
+    double m_sum = 0;            /* of the incomplete block */
+    int m_filled = 0;
+
+    double m_gated_sum = 0;
+    int64_t m_gated_blocks = 0;
+};
+
+#endif
@@ -23,14 +23,23 @@
 #include <libaudcore/plugin.h>
 #include <libaudcore/preferences.h>
 
+#include "../effect-common/effect-params.h"
+
 static const char * const cryst_defaults[] = {
  "intensity", "1",
  nullptr};
 
+static EffectParams<float> cryst_params;
+
+static void update_config ()
+{
+    cryst_params.publish (aud_get_double ("crystalizer", "intensity"));
+}
+
 static const PreferencesWidget cryst_widgets[] = {
     WidgetLabel (N_("<b>Crystalizer</b>")),
     WidgetSpin (N_("Intensity:"),
-        WidgetFloat ("crystalizer", "intensity"),
+        WidgetFloat ("crystalizer", "intensity", update_config),
         {0, 10, 0.1})
 };
 
@@ -60,10 +69,12 @@ EXPORT Crystalizer aud_plugin_instance;
 
 static int cryst_channels;
 static Index<float> cryst_prev;
+static SmoothedParam cryst_intensity;
 
 bool Crystalizer::init ()
 {
     aud_config_set_defaults ("crystalizer", cryst_defaults);
+    update_config ();
     return true;
 }
 
@@ -77,14 +88,25 @@ void Crystalizer::start (int & channels, int & rate)
     cryst_channels = channels;
     cryst_prev.resize (cryst_channels);
     cryst_prev.erase (0, cryst_channels);
+
+    float value;
+    if (cryst_params.fetch (value))
+        cryst_intensity.reset (value);
 }
 
 Index<float> & Crystalizer::process (Index<float> & data)
 {
-    float value = aud_get_double ("crystalizer", "intensity");
+    float target;
+    if (cryst_params.fetch (target))
+        cryst_intensity.set (target);
+
     float * f = data.begin ();
     float * end = data.end ();
 
+    /* changes are spread over the block */
+    float value = cryst_intensity.value ();
+    float step = cryst_intensity.step (data.len () / cryst_channels);
+
     while (f < end)
     {
         for (int channel = 0; channel < cryst_channels; channel ++)
@@ -93,8 +115,11 @@ Index<float> & Crystalizer::process (Index<float> & data)
             * f ++ = current + (current - cryst_prev[channel]) * value;
             cryst_prev[channel] = current;
         }
+
+        value += step;
     }
 
+    cryst_intensity.settle ();
     return data;
 }
 
@@ -1,9 +1,23 @@
+#include <math.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include <libaudcore/i18n.h>
 #include <libaudcore/runtime.h>
 #include <libaudcore/plugin.h>
 #include <libaudcore/preferences.h>
 
+#include "../effect-common/effect-params.h"
+
 #define MAX_DELAY 1000
+#define MAX_TAPS 4
+
+/* frames processed at once; also the length of the repeating gain rows */
+#define MAX_SPAN 1024
+#define ROW_FRAMES 64
 
 static const char echo_about[] =
  N_("Echo Plugin\n"
@@ -11,23 +25,93 @@ static const char echo_about[] =
     "Surround echo by Carl van Schaik, 1999\n"
     "Updated for Audacious by William Pitcock and John Lindgren, 2010-2014");
 
+/* The first tap keeps the setting names of the original single-tap echo. */
 static const char * const echo_defaults[] = {
  "delay", "500",
  "feedback", "50",
  "volume", "50",
+ "pan", "0",
+ "delay2", "250",
+ "feedback2", "0",
+ "volume2", "0",
+ "pan2", "-50",
+ "delay3", "750",
+ "feedback3", "0",
+ "volume3", "0",
+ "pan3", "50",
+ "delay4", "1000",
+ "feedback4", "0",
+ "volume4", "0",
+ "pan4", "0",
+ "damping", "0",
  nullptr};
 
+static const char * const tap_keys[MAX_TAPS][4] = {
+    {"delay", "feedback", "volume", "pan"},
+    {"delay2", "feedback2", "volume2", "pan2"},
+    {"delay3", "feedback3", "volume3", "pan3"},
+    {"delay4", "feedback4", "volume4", "pan4"}
+};
+
+struct EchoTap {
+    int delay;  /* frames */
+    float feedback, volume, pan;
+};
+
+struct EchoSettings {
+    EchoTap taps[MAX_TAPS];  /* delays in ms */
+    int damping;
+};
+
+/* Settings are published here when changed in the UI; the audio thread picks
+ * up changes at the start of the next block. */
+static EffectParams<EchoSettings> echo_params;
+static EchoSettings config;
+
+static void update_config ()
+{
+    EchoSettings settings;
+
+    for (int t = 0; t < MAX_TAPS; t ++)
+    {
+        settings.taps[t].delay = aud_get_int ("echo_plugin", tap_keys[t][0]);
+        settings.taps[t].feedback = aud_get_int ("echo_plugin", tap_keys[t][1]) / 100.0f;
+        settings.taps[t].volume = aud_get_int ("echo_plugin", tap_keys[t][2]) / 100.0f;
+        settings.taps[t].pan = aud_get_int ("echo_plugin", tap_keys[t][3]) / 100.0f;
+    }
+
+    settings.damping = aud_get_int ("echo_plugin", "damping");
+
+    echo_params.publish (settings);
+}
+
+#define TAP_WIDGETS(t) \
+    WidgetSpin (N_("Delay:"), \
+        WidgetInt ("echo_plugin", tap_keys[t][0], update_config), \
+        {0, MAX_DELAY, 10, N_("ms")}), \
+    WidgetSpin (N_("Feedback:"), \
+        WidgetInt ("echo_plugin", tap_keys[t][1], update_config), \
+        {0, 100, 1, "%"}), \
+    WidgetSpin (N_("Volume:"), \
+        WidgetInt ("echo_plugin", tap_keys[t][2], update_config), \
+        {0, 100, 1, "%"}), \
+    WidgetSpin (N_("Pan:"), \
+        WidgetInt ("echo_plugin", tap_keys[t][3], update_config), \
+        {-100, 100, 5, "%"})
+
 static const PreferencesWidget echo_widgets[] = {
     WidgetLabel (N_("<b>Echo</b>")),
-    WidgetSpin (N_("Delay:"),
-        WidgetInt ("echo_plugin", "delay"),
-        {0, MAX_DELAY, 10, N_("ms")}),
-    WidgetSpin (N_("Feedback:"),
-        WidgetInt ("echo_plugin", "feedback"),
-        {0, 100, 1, "%"}),
-    WidgetSpin (N_("Volume:"),
-        WidgetInt ("echo_plugin", "volume"),
-        {0, 100, 1, "%"})
+    TAP_WIDGETS (0),
+    WidgetLabel (N_("<b>Second Tap</b>")),
+    TAP_WIDGETS (1),
+    WidgetLabel (N_("<b>Third Tap</b>")),
+    TAP_WIDGETS (2),
+    WidgetLabel (N_("<b>Fourth Tap</b>")),
+    TAP_WIDGETS (3),
+    WidgetLabel (N_("<b>Feedback Filter</b>")),
+    WidgetSpin (N_("Low-pass cutoff:"),
+        WidgetInt ("echo_plugin", "damping", update_config),
+        {0, 20000, 100, N_("Hz (0 = off)")})
 };
 
 static const PluginPreferences echo_prefs = {{echo_widgets}};
@@ -53,22 +137,130 @@ public:
 
 EXPORT EchoPlugin aud_plugin_instance;
 
+/* The delay line holds a power of two frames, so that positions wrap with a
+ * mask.  It is processed in spans that are contiguous in the delay line for
+ * the write position and every tap, and no longer than the shortest delay,
+ * so that nothing written during a span is read back in the same span. */
 static Index<float> buffer;
-static int w_ofs;
+static int buffer_frames;
+static int w_pos;  /* frames */
+
+/* active taps, with their gains repeated over a row of ROW_FRAMES frames so
+ * that per-channel gains can be applied in plain vector loops */
+static EchoTap taps[MAX_TAPS];
+static int n_taps;
+static Index<float> feedback_rows, volume_rows;
+static Index<float> feedback_sum;
+
+static float damping_coef;  /* 0 for no filter */
+static Index<float> damping_state;
+
+static int echo_channels = 0;
+static int echo_rate = 0;
 
 bool EchoPlugin::init ()
 {
     aud_config_set_defaults ("echo_plugin", echo_defaults);
+    update_config ();
     return true;
 }
 
 void EchoPlugin::cleanup ()
 {
     buffer.clear ();
+    feedback_rows.clear ();
+    volume_rows.clear ();
+    feedback_sum.clear ();
+    damping_state.clear ();
+
+    echo_channels = 0;
+    echo_rate = 0;
 }
 
-static int echo_channels = 0;
-static int echo_rate = 0;
+/* dest[i] += src[i] * gains[i] */
+static void mac (float * dest, const float * src, const float * gains, int len)
+{
+    int i = 0;
+
+#ifdef __SSE2__
+    for (; i + 4 <= len; i += 4)
+    {
+        __m128 x = _mm_mul_ps (_mm_loadu_ps (src + i), _mm_loadu_ps (gains + i));
+        _mm_storeu_ps (dest + i, _mm_add_ps (_mm_loadu_ps (dest + i), x));
+    }
+#endif
+
+    for (; i < len; i ++)
+        dest[i] += src[i] * gains[i];
+}
+
+/* dest[i] = a[i] + b[i] */
+static void add (float * dest, const float * a, const float * b, int len)
+{
+    int i = 0;
+
+#ifdef __SSE2__
+    for (; i + 4 <= len; i += 4)
+        _mm_storeu_ps (dest + i, _mm_add_ps (_mm_loadu_ps (a + i), _mm_loadu_ps (b + i)));
+#endif
+
+    for (; i < len; i ++)
+        dest[i] = a[i] + b[i];
+}
+
+/* mac() over a span, with a gain row that repeats every ROW_FRAMES frames */
+static void mac_rows (float * dest, const float * src, const float * row, int len)
+{
+    int row_len = ROW_FRAMES * echo_channels;
+
+    for (int i = 0; i < len; i += row_len)
+        mac (dest + i, src + i, row, aud::min (row_len, len - i));
+}
+
+static void apply_config ()
+{
+    int row_len = ROW_FRAMES * echo_channels;
+    int max_delay = buffer_frames - MAX_SPAN;
+
+    feedback_rows.resize (MAX_TAPS * row_len);
+    volume_rows.resize (MAX_TAPS * row_len);
+
+    n_taps = 0;
+
+    for (const EchoTap & setting : config.taps)
+    {
+        if (setting.feedback == 0 && setting.volume == 0)
+            continue;
+
+        EchoTap & tap = taps[n_taps];
+        float * fb_row = & feedback_rows[n_taps * row_len];
+        float * vol_row = & volume_rows[n_taps * row_len];
+
+        tap = setting;
+        tap.delay = aud::clamp (aud::rescale (setting.delay, 1000, echo_rate), 1, max_delay);
+
+        for (int f = 0; f < ROW_FRAMES; f ++)
+        {
+            for (int c = 0; c < echo_channels; c ++)
+            {
+                /* pan only applies to stereo; it attenuates the far side */
+                float pan = 1;
+                if (echo_channels == 2)
+                    pan = aud::min (1.0f, c ? 1 + tap.pan : 1 - tap.pan);
+
+                fb_row[f * echo_channels + c] = tap.feedback;
+                vol_row[f * echo_channels + c] = tap.volume * pan;
+            }
+        }
+
+        n_taps ++;
+    }
+
+    if (config.damping > 0 && config.damping < echo_rate / 2)
+        damping_coef = 1 - expf (-2 * (float) M_PI * config.damping / echo_rate);
+    else
+        damping_coef = 0;
+}
 
 void EchoPlugin::start (int & channels, int & rate)
 {
@@ -77,38 +269,83 @@ void EchoPlugin::start (int & channels, int & rate)
         echo_channels = channels;
         echo_rate = rate;
 
-        buffer.resize (aud::rescale (MAX_DELAY, 1000, rate) * channels);
+        int frames = aud::rescale (MAX_DELAY, 1000, rate) + MAX_SPAN;
+
+        buffer_frames = 1;
+        while (buffer_frames < frames)
+            buffer_frames <<= 1;
+
+        buffer.resize (buffer_frames * channels);
         buffer.erase (0, -1);
 
-        w_ofs = 0;
+        feedback_sum.resize (MAX_SPAN * channels);
+        damping_state.resize (channels);
+        damping_state.erase (0, -1);
+
+        w_pos = 0;
+
+        echo_params.fetch (config);
+        apply_config ();
     }
 }
 
 Index<float> & EchoPlugin::process (Index<float> & data)
 {
-    int delay = aud_get_int ("echo_plugin", "delay");
-    float feedback = aud_get_int ("echo_plugin", "feedback") / 100.0f;
-    float volume = aud_get_int ("echo_plugin", "volume") / 100.0f;
+    if (echo_params.fetch (config))
+        apply_config ();
 
-    int interval = aud::rescale (delay, 1000, echo_rate) * echo_channels;
-    interval = aud::clamp (interval, 0, buffer.len ());  // sanity check
+    const int channels = echo_channels;
+    const int mask = buffer_frames - 1;
+    const int row_len = ROW_FRAMES * channels;
 
-    int r_ofs = w_ofs - interval;
-    if (r_ofs < 0)
-        r_ofs += buffer.len ();
+    float * samples = data.begin ();
+    int frames = data.len () / channels;
 
-    float * end = data.end ();
-
-    for (float * f = data.begin (); f < end; f++)
+    while (frames > 0)
     {
-        float in = * f;
-        float buf = buffer[r_ofs];
+        int span = aud::min (frames, aud::min (MAX_SPAN, buffer_frames - w_pos));
+        int r_pos[MAX_TAPS];
+
+        for (int t = 0; t < n_taps; t ++)
+        {
+            r_pos[t] = (w_pos - taps[t].delay) & mask;
+            span = aud::min (span, aud::min (taps[t].delay, buffer_frames - r_pos[t]));
+        }
+
+        int len = span * channels;
+        float * write = & buffer[w_pos * channels];
+        float * fb = feedback_sum.begin ();
+
+        /* sum of the feedback from all taps */
+        memset (fb, 0, sizeof (float) * len);
+
+        for (int t = 0; t < n_taps; t ++)
+            mac_rows (fb, & buffer[r_pos[t] * channels], & feedback_rows[t * row_len], len);
+
+        if (damping_coef)
+        {
+            float * state = damping_state.begin ();
+
+            for (int f = 0; f < span; f ++)
+            {
+                for (int c = 0; c < channels; c ++)
+                {
+                    state[c] += damping_coef * (fb[f * channels + c] - state[c]);
+                    fb[f * channels + c] = state[c];
+                }
+            }
+        }
+
+        /* the delay line gets the dry input plus feedback ... */
+        add (write, samples, fb, len);
 
-        * f = in + buf * volume;
-        buffer[w_ofs] = in + buf * feedback;
+        /* ... and the output is the dry input plus the taps */
+        for (int t = 0; t < n_taps; t ++)
+            mac_rows (samples, & buffer[r_pos[t] * channels], & volume_rows[t * row_len], len);
 
-        r_ofs = (r_ofs + 1) % buffer.len ();
-        w_ofs = (w_ofs + 1) % buffer.len ();
+        w_pos = (w_pos + span) & mask;
+        samples += len;
+        frames -= span;
     }
 
     return data;
@@ -0,0 +1,177 @@
+/*
+ * Shared Channel Conversion for Audacious Effect Plugins
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef EFFECT_COMMON_CHANNEL_MATRIX_H
+#define EFFECT_COMMON_CHANNEL_MATRIX_H
+
+#include <math.h>
+
+#include <libaudcore/audio.h>
+
+/* Mixing matrices between the usual speaker layouts for 1 to 8 channels, in
+ * the order used by Audacious (the WAVE order).  Output channel o is the sum
+ * over input channels i of matrix[o][i] * input i. */
+
+typedef float ChannelMatrix[AUD_MAX_CHANNELS][AUD_MAX_CHANNELS];
+
+#define CHANNEL_LAYOUT_MAX 8
+
+enum {
+    SPEAKER_FL, SPEAKER_FR, SPEAKER_FC, SPEAKER_LFE, SPEAKER_RL, SPEAKER_RR,
+    SPEAKER_RC, SPEAKER_SL, SPEAKER_SR
+};
+
+static const int channel_layouts[CHANNEL_LAYOUT_MAX + 1][CHANNEL_LAYOUT_MAX] = {
+    {},
+    {SPEAKER_FC},
+    {SPEAKER_FL, SPEAKER_FR},
+    {SPEAKER_FL, SPEAKER_FR, SPEAKER_FC},
+    {SPEAKER_FL, SPEAKER_FR, SPEAKER_RL, SPEAKER_RR},
+    {SPEAKER_FL, SPEAKER_FR, SPEAKER_FC, SPEAKER_RL, SPEAKER_RR},
+    {SPEAKER_FL, SPEAKER_FR, SPEAKER_FC, SPEAKER_LFE, SPEAKER_RL, SPEAKER_RR},
+    {SPEAKER_FL, SPEAKER_FR, SPEAKER_FC, SPEAKER_LFE, SPEAKER_RC, SPEAKER_SL, SPEAKER_SR},
+    {SPEAKER_FL, SPEAKER_FR, SPEAKER_FC, SPEAKER_LFE, SPEAKER_RL, SPEAKER_RR, SPEAKER_SL, SPEAKER_SR}
+};
+
+#define MINUS_3DB 0.70710678f
+
+static inline int channel_find_speaker (int channels, int speaker)
+{
+    for (int c = 0; c < channels; c ++)
+    {
+        if (channel_layouts[channels][c] == speaker)
+            return c;
+    }
+
+    return -1;
+}
+
+/* Adds one input speaker to the output channels with the given gain.  A
+ * speaker missing from the output is folded into its neighbours at -3 dB each
+ * as in ITU-R BS.775; the LFE channel is dropped. */
+static inline void channel_route (ChannelMatrix matrix, int out_channels,
+ int in, int speaker, float gain)
+{
+    int out = channel_find_speaker (out_channels, speaker);
+
+    if (out >= 0)
+    {
+        matrix[out][in] += gain;
+        return;
+    }
+
+    switch (speaker)
+    {
+    case SPEAKER_FL:
+    case SPEAKER_FR:
+        channel_route (matrix, out_channels, in, SPEAKER_FC, gain * MINUS_3DB);
+        break;
+
+    case SPEAKER_FC:
+        channel_route (matrix, out_channels, in, SPEAKER_FL, gain * MINUS_3DB);
+        channel_route (matrix, out_channels, in, SPEAKER_FR, gain * MINUS_3DB);
+        break;
+
+    case SPEAKER_RL:
+    case SPEAKER_SL:
+    {
+        int other = (speaker == SPEAKER_RL) ? SPEAKER_SL : SPEAKER_RL;
+
+        if (channel_find_speaker (out_channels, other) >= 0)
+            channel_route (matrix, out_channels, in, other, gain);
+        else
+            channel_route (matrix, out_channels, in, SPEAKER_FL, gain * MINUS_3DB);
+        break;
+    }
+
+    case SPEAKER_RR:
+    case SPEAKER_SR:
+    {
+        int other = (speaker == SPEAKER_RR) ? SPEAKER_SR : SPEAKER_RR;
+
+        if (channel_find_speaker (out_channels, other) >= 0)
+            channel_route (matrix, out_channels, in, other, gain);
+        else
+            channel_route (matrix, out_channels, in, SPEAKER_FR, gain * MINUS_3DB);
+        break;
+    }
+
+    case SPEAKER_RC:
+        if (channel_find_speaker (out_channels, SPEAKER_RL) >= 0)
+        {
+            channel_route (matrix, out_channels, in, SPEAKER_RL, gain * MINUS_3DB);
+            channel_route (matrix, out_channels, in, SPEAKER_RR, gain * MINUS_3DB);
+        }
+        else
+        {
+            channel_route (matrix, out_channels, in, SPEAKER_SL, gain * MINUS_3DB);
+            channel_route (matrix, out_channels, in, SPEAKER_SR, gain * MINUS_3DB);
+        }
+        break;
+    }
+}
+
+/* Sets <matrix> to the ITU-R BS.775 conversion from <in_channels> to
+ * <out_channels>; returns false if either is not a layout listed above. */
+static inline bool channel_matrix_bs775 (ChannelMatrix matrix, int in_channels,
+ int out_channels)
+{
+    if (in_channels < 1 || in_channels > CHANNEL_LAYOUT_MAX ||
+     out_channels < 1 || out_channels > CHANNEL_LAYOUT_MAX)
+        return false;
+
+    for (int o = 0; o < AUD_MAX_CHANNELS; o ++)
+    {
+        for (int i = 0; i < AUD_MAX_CHANNELS; i ++)
+            matrix[o][i] = 0;
+    }
+
+    for (int i = 0; i < in_channels; i ++)
+        channel_route (matrix, out_channels, i, channel_layouts[in_channels][i], 1);
+
+    return true;
+}
+
+/* scales the matrix so that no output can exceed full scale */
+static inline void channel_matrix_normalize (ChannelMatrix matrix, int in_channels,
+ int out_channels)
+{
+    float max_sum = 0;
+
+    for (int o = 0; o < out_channels; o ++)
+    {
+        float sum = 0;
+        for (int i = 0; i < in_channels; i ++)
+            sum += fabsf (matrix[o][i]);
+
+        if (sum > max_sum)
+            max_sum = sum;
+    }
+
+    if (max_sum > 1)
+    {
+        for (int o = 0; o < out_channels; o ++)
+        {
+            for (int i = 0; i < in_channels; i ++)
+                matrix[o][i] /= max_sum;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ * Shared Parameter Handling for Audacious Effect Plugins
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef EFFECT_COMMON_EFFECT_PARAMS_H
+#define EFFECT_COMMON_EFFECT_PARAMS_H
+
+#include <atomic>
+
+/* Settings handed from the main thread (which publishes them whenever they
+ * change in the UI) to the audio thread (which picks them up at the start of a
+ * block), so that the audio thread never has to look up the config.
+ *
+ * This is a triple buffer: the main thread fills a spare slot and swaps it
+ * with the middle one, marking it as new; the audio thread swaps the middle
+ * slot with its own only when it is marked.  Neither side ever waits, and the
+ * audio thread never sees a partial update.  There must be only one thread
+ * publishing, normally the main thread. */
+template<class T>
+class EffectParams
+{
+public:
+    void publish (const T & params)
+    {
+        m_slots[m_back] = params;
+        m_back = m_middle.exchange (m_back | FRESH, std::memory_order_acq_rel) & SLOT;
+    }
+
+    /* copies the newest parameters into <params> if there are any that have
+     * not been fetched yet, and returns whether it did */
+    bool fetch (T & params)
+    {
+        if (! (m_middle.load (std::memory_order_relaxed) & FRESH))
+            return false;
+
+        m_front = m_middle.exchange (m_front, std::memory_order_acq_rel) & SLOT;
+        params = m_slots[m_front];
+        return true;
+    }
+
+private:
+    static constexpr int SLOT = 3, FRESH = 4;
+
+    T m_slots[3] {};
+    int m_back = 0, m_front = 2;
+    std::atomic<int> m_middle {1};
+};
+
+/* A parameter that moves linearly to a new value over one block, instead of
+ * jumping to it, to avoid zipper noise.  Typical use:
+ *
+ *     float value = param.value (), step = param.step (frames);
+ *     for (...) { ...; value += step; }
+ *     param.settle (); */
+class SmoothedParam
+{
+public:
+    void reset (float value)
+        { m_value = m_target = value; }
+    void set (float target)
+        { m_target = target; }
+
+    float value () const
+        { return m_value; }
+    float target () const
+        { return m_target; }
+
+    /* increment per frame to reach the target by the end of <frames> frames */
+    float step (int frames) const
+        { return (frames > 0) ? (m_target - m_value) / frames : 0; }
+
+    void settle ()
+        { m_value = m_target; }
+
+private:
+    float m_value = 0, m_target = 0;
+};
+
+#endif /* EFFECT_COMMON_EFFECT_PARAMS_H */
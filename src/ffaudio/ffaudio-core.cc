@@ -24,6 +24,11 @@
 #include "ffaudio-stdinc.h"
 
 #include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
 
 #include <audacious/audtag.h>
 #include <libaudcore/audstrings.h>
@@ -67,6 +72,12 @@ public:
 
 EXPORT FFaudio aud_plugin_instance;
 
+static const char * const ffaudio_defaults[] = {
+    "local_buffer_kb", "32",
+    "remote_buffer_kb", "64",
+    nullptr
+};
+
 typedef struct
 {
     int stream_idx;
@@ -102,10 +113,13 @@ struct ScopedPacket : public AVPacket
     ScopedPacket () : AVPacket ()
         { av_init_packet (this); }
 
+    ~ScopedPacket () { unref (); }
+
+    /* drops the payload but keeps the packet usable for the next read */
 #if CHECK_LIBAVCODEC_VERSION (55, 25, 100, 55, 16, 0)
-    ~ScopedPacket () { av_packet_unref (this); }
+    void unref () { av_packet_unref (this); }
 #else
-    ~ScopedPacket () { av_free_packet (this); }
+    void unref () { av_free_packet (this); }
 #endif
 };
 
@@ -128,6 +142,55 @@ struct ScopedFrame
 #endif
 };
 
+/* Identifies a local file by name, size and modification time */
+struct FileID
+{
+    String uri;
+    int64_t size = -1, mtime = -1;
+
+    FileID () {}
+    FileID (const char * filename);
+
+    bool valid () const
+        { return (bool) uri; }
+    bool operator== (const FileID & b) const
+        { return size == b.size && mtime == b.mtime && uri == b.uri; }
+};
+
+#ifdef ALLOC_CONTEXT
+static void free_codecpar (AVCodecParameters * par)
+    { avcodec_parameters_free (& par); }
+#endif
+
+/* Cached results of format probing and stream info discovery, so that
+ * is_our_file, read_tag and play do not each have to repeat them */
+struct ProbeResult
+{
+    FileID id;
+    AVInputFormat * format = nullptr;
+    int stream_idx = -1;  /* -1 if only the format is known */
+#ifdef ALLOC_CONTEXT
+    SmartPtr<AVCodecParameters, free_codecpar> codecpar;
+#endif
+    int64_t duration = AV_NOPTS_VALUE;
+    int64_t bit_rate = 0;
+
+    /* stream timing, which avformat_find_stream_info() may also fill in */
+    int64_t start_time = AV_NOPTS_VALUE;
+    AVRational stream_time_base = {0, 1};
+    int64_t stream_start_time = AV_NOPTS_VALUE;
+    int64_t stream_duration = AV_NOPTS_VALUE;
+
+    ProbeResult () {}
+    ProbeResult (const FileID & id, AVInputFormat * format) :
+        id (id), format (format) {}
+};
+
+#define PROBE_CACHE_SIZE 32
+
+static pthread_mutex_t probe_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Index<ProbeResult> probe_cache;  /* most recently used first */
+
 static SimpleHash<String, AVInputFormat *> extension_dict;
 
 static void create_extension_dict ();
@@ -189,6 +252,8 @@ static void ffaudio_log_cb (void * avcl, int av_level, const char * fmt, va_list
 
 bool FFaudio::init ()
 {
+    aud_config_set_defaults ("ffaudio", ffaudio_defaults);
+
     av_register_all();
     av_lockmgr_register (lockmgr);
 
@@ -203,6 +268,10 @@ void FFaudio::cleanup ()
 {
     extension_dict.clear ();
 
+    pthread_mutex_lock (& probe_mutex);
+    probe_cache.clear ();
+    pthread_mutex_unlock (& probe_mutex);
+
     av_lockmgr_register (nullptr);
 }
 
@@ -238,6 +307,76 @@ static void create_extension_dict ()
     }
 }
 
+FileID::FileID (const char * filename)
+{
+    if (strncmp (filename, "file://", 7))
+        return;
+
+    StringBuf path = uri_to_filename (filename);
+    GStatBuf st;
+
+    if (! path || g_stat (path, & st) < 0)
+        return;
+
+    uri = String (filename);
+    size = st.st_size;
+    mtime = st.st_mtime;
+}
+
+/* must be called with probe_mutex held; moves the entry to the front */
+static ProbeResult * probe_cache_find (const FileID & id)
+{
+    for (int i = 0; i < probe_cache.len (); i ++)
+    {
+        if (probe_cache[i].id == id)
+        {
+            if (i > 0)
+            {
+                ProbeResult entry = std::move (probe_cache[i]);
+                probe_cache.remove (i, 1);
+                probe_cache.insert (0, 1);
+                probe_cache[0] = std::move (entry);
+            }
+
+            return & probe_cache[0];
+        }
+    }
+
+    return nullptr;
+}
+
+static AVInputFormat * probe_cache_get_format (const FileID & id)
+{
+    if (! id.valid ())
+        return nullptr;
+
+    pthread_mutex_lock (& probe_mutex);
+    ProbeResult * entry = probe_cache_find (id);
+    AVInputFormat * f = entry ? entry->format : nullptr;
+    pthread_mutex_unlock (& probe_mutex);
+
+    return f;
+}
+
+static void probe_cache_add_format (const FileID & id, AVInputFormat * f)
+{
+    if (! id.valid ())
+        return;
+
+    pthread_mutex_lock (& probe_mutex);
+
+    if (! probe_cache_find (id))
+    {
+        if (probe_cache.len () >= PROBE_CACHE_SIZE)
+            probe_cache.remove (PROBE_CACHE_SIZE - 1, -1);
+
+        probe_cache.insert (0, 1);
+        probe_cache[0] = ProbeResult (id, f);
+    }
+
+    pthread_mutex_unlock (& probe_mutex);
+}
+
 static AVInputFormat * get_format_by_extension (const char * name)
 {
     StringBuf ext = uri_get_extension (name);
@@ -255,7 +394,9 @@ static AVInputFormat * get_format_by_extension (const char * name)
     return f ? * f : nullptr;
 }
 
-static AVInputFormat * get_format_by_content (const char * name, VFSFile & file)
+/* Probes through the same I/O context that is later used for demuxing, so
+ * that the probe data stays in its buffer and rewinding is (usually) free. */
+static AVInputFormat * get_format_by_content (const char * name, AVIOContext * io)
 {
     AUDDBG ("Get format by content: %s\n", name);
 
@@ -270,7 +411,11 @@ static AVInputFormat * get_format_by_content (const char * name, VFSFile & file)
     while (1)
     {
         if (filled < size)
-            filled += file.fread (buf + filled, 1, size - filled);
+        {
+            int ret = avio_read (io, buf + filled, size - filled);
+            if (ret > 0)
+                filled += ret;
+        }
 
         memset (buf + filled, 0, AVPROBE_PADDING_SIZE);
         AVProbeData d = {name, buf, filled};
@@ -293,30 +438,35 @@ static AVInputFormat * get_format_by_content (const char * name, VFSFile & file)
     else
         AUDDBG ("Format unknown.\n");
 
-    if (file.fseek (0, VFS_SEEK_SET) < 0)
+    if (avio_seek (io, 0, SEEK_SET) < 0)
         ; /* ignore errors here */
 
     return f;
 }
 
-static AVInputFormat * get_format (const char * name, VFSFile & file)
+static AVInputFormat * get_format (const char * name, AVIOContext * io)
 {
     AVInputFormat * f = get_format_by_extension (name);
-    return f ? f : get_format_by_content (name, file);
+    return f ? f : get_format_by_content (name, io);
 }
 
-static AVFormatContext * open_input_file (const char * name, VFSFile & file)
+static AVFormatContext * open_input_file (const char * name, VFSFile & file,
+ const FileID & id)
 {
-    AVInputFormat * f = get_format (name, file);
+    AVIOContext * io = io_context_new (file);
+    AVInputFormat * f = probe_cache_get_format (id);
+
+    if (! f && (f = get_format (name, io)))
+        probe_cache_add_format (id, f);
 
     if (! f)
     {
         AUDERR ("Unknown format for %s.\n", name);
+        io_context_free (io);
         return nullptr;
     }
 
     AVFormatContext * c = avformat_alloc_context ();
-    AVIOContext * io = io_context_new (file);
     c->pb = io;
 
     if (LOG (avformat_open_input, & c, name, f, nullptr) < 0)
@@ -336,8 +486,94 @@ static void close_input_file (AVFormatContext * c)
     io_context_free (io);
 }
 
-static bool find_codec (AVFormatContext * c, CodecInfo * cinfo)
+/* Fills in the stream parameters from the probe cache, so that
+ * avformat_find_stream_info() can be skipped */
+static bool find_codec_cached (AVFormatContext * c, CodecInfo * cinfo, const FileID & id)
+{
+#ifdef ALLOC_CONTEXT
+    if (! id.valid ())
+        return false;
+
+    bool found = false;
+
+    pthread_mutex_lock (& probe_mutex);
+
+    ProbeResult * entry = probe_cache_find (id);
+
+    if (entry && entry->stream_idx >= 0 && entry->stream_idx < (int) c->nb_streams)
+    {
+        AVStream * stream = c->streams[entry->stream_idx];
+        AVCodec * codec = avcodec_find_decoder (entry->codecpar->codec_id);
+
+        /* the stream timing is in the time base set when the header was
+         * read; if that differs, the demuxer isn't behaving as it did */
+        if (codec && ! av_cmp_q (stream->time_base, entry->stream_time_base) &&
+         avcodec_parameters_copy (stream->codecpar, entry->codecpar.get ()) >= 0)
+        {
+            if (c->duration == AV_NOPTS_VALUE)
+                c->duration = entry->duration;
+            if (c->start_time == (int64_t) AV_NOPTS_VALUE)
+                c->start_time = entry->start_time;
+            if (! c->bit_rate)
+                c->bit_rate = entry->bit_rate;
+            if (stream->start_time == (int64_t) AV_NOPTS_VALUE)
+                stream->start_time = entry->stream_start_time;
+            if (stream->duration == (int64_t) AV_NOPTS_VALUE)
+                stream->duration = entry->stream_duration;
+
+            cinfo->stream_idx = entry->stream_idx;
+            cinfo->stream = stream;
+            cinfo->codec = codec;
+            found = true;
+        }
+    }
+
+    pthread_mutex_unlock (& probe_mutex);
+
+    return found;
+#else
+    return false;
+#endif
+}
+
+static void probe_cache_add_stream (const FileID & id, AVFormatContext * c, const CodecInfo & cinfo)
 {
+#ifdef ALLOC_CONTEXT
+    if (! id.valid ())
+        return;
+
+    pthread_mutex_lock (& probe_mutex);
+
+    ProbeResult * entry = probe_cache_find (id);
+
+    /* Seeking and position reporting need the start time of the stream.  If
+     * even avformat_find_stream_info() couldn't find it, don't cache the
+     * stream, so that the next open runs it again rather than going without. */
+    if (entry && entry->stream_idx < 0 && cinfo.stream->start_time != (int64_t) AV_NOPTS_VALUE)
+    {
+        entry->codecpar.capture (avcodec_parameters_alloc ());
+
+        if (avcodec_parameters_copy (entry->codecpar.get (), cinfo.stream->codecpar) >= 0)
+        {
+            entry->stream_idx = cinfo.stream_idx;
+            entry->duration = c->duration;
+            entry->bit_rate = c->bit_rate;
+            entry->start_time = c->start_time;
+            entry->stream_time_base = cinfo.stream->time_base;
+            entry->stream_start_time = cinfo.stream->start_time;
+            entry->stream_duration = cinfo.stream->duration;
+        }
+    }
+
+    pthread_mutex_unlock (& probe_mutex);
+#endif
+}
+
+static bool find_codec (AVFormatContext * c, CodecInfo * cinfo, const FileID & id)
+{
+    if (find_codec_cached (c, cinfo, id))
+        return true;
+
     avformat_find_stream_info (c, nullptr);
 
     for (unsigned i = 0; i < c->nb_streams; i++)
@@ -357,6 +593,7 @@ static bool find_codec (AVFormatContext * c, CodecInfo * cinfo)
                 cinfo->stream = stream;
                 cinfo->codec = codec;
 
+                probe_cache_add_stream (id, c, * cinfo);
                 return true;
             }
         }
@@ -368,7 +605,24 @@ static bool find_codec (AVFormatContext * c, CodecInfo * cinfo)
 
 bool FFaudio::is_our_file (const char * filename, VFSFile & file)
 {
-    return (bool) get_format (filename, file);
+    if (get_format_by_extension (filename))
+        return true;
+
+    FileID id (filename);
+    if (probe_cache_get_format (id))
+        return true;
+
+    AVIOContext * io = io_context_new (file);
+    AVInputFormat * f = get_format_by_content (filename, io);
+    io_context_free (io);
+
+    if (f)
+        probe_cache_add_format (id, f);
+
+    if (file.fseek (0, VFS_SEEK_SET) < 0)
+        ; /* ignore errors here */
+
+    return (bool) f;
 }
 
 static const struct {
@@ -409,14 +663,15 @@ static void read_metadata_dict (Tuple & tuple, AVDictionary * dict)
 
 bool FFaudio::read_tag (const char * filename, VFSFile & file, Tuple & tuple, Index<char> * image)
 {
+    FileID id (filename);
     SmartPtr<AVFormatContext, close_input_file>
-     ic (open_input_file (filename, file));
+     ic (open_input_file (filename, file, id));
 
     if (! ic)
         return false;
 
     CodecInfo cinfo;
-    if (! find_codec (ic.get (), & cinfo))
+    if (! find_codec (ic.get (), & cinfo, id))
         return false;
 
     tuple.set_int (Tuple::Length, ic->duration / 1000);
@@ -459,6 +714,294 @@ bool FFaudio::write_tuple (const char * filename, VFSFile & file, const Tuple &
     return audtag::write_tuple (file, tuple, audtag::TagType::None);
 }
 
+/* Planar to interleaved conversion.  The channel count is a template parameter
+ * for the common layouts so that the compiler can unroll (and vectorize) the
+ * inner loop; other layouts take the generic path. */
+template<class T, int channels>
+static void interleave_fixed (const void * const * planes, T * out, int frames)
+{
+    const T * in[channels];
+    for (int c = 0; c < channels; c ++)
+        in[c] = (const T *) planes[c];
+
+    for (int f = 0; f < frames; f ++)
+    {
+        for (int c = 0; c < channels; c ++)
+            out[c] = in[c][f];
+
+        out += channels;
+    }
+}
+
+template<class T>
+static void interleave_generic (const void * const * planes, int channels, T * out, int frames)
+{
+    for (int c = 0; c < channels; c ++)
+    {
+        const T * in = (const T *) planes[c];
+        T * set = out + c;
+
+        for (int f = 0; f < frames; f ++)
+        {
+            * set = in[f];
+            set += channels;
+        }
+    }
+}
+
+template<class T>
+static void interleave_typed (const void * const * planes, int channels, void * out, int frames)
+{
+    switch (channels)
+    {
+    case 1:
+        memcpy (out, planes[0], sizeof (T) * frames);
+        break;
+    case 2:
+        interleave_fixed<T, 2> (planes, (T *) out, frames);
+        break;
+    case 4:
+        interleave_fixed<T, 4> (planes, (T *) out, frames);
+        break;
+    case 6:
+        interleave_fixed<T, 6> (planes, (T *) out, frames);
+        break;
+    case 8:
+        interleave_fixed<T, 8> (planes, (T *) out, frames);
+        break;
+    default:
+        interleave_generic<T> (planes, channels, (T *) out, frames);
+        break;
+    }
+}
+
+/* Only the sample size matters for interleaving, so float shares the
+ * 32-bit integer path. */
+static void interleave (const void * const * planes, int fmt, int channels,
+ void * out, int frames)
+{
+    switch (FMT_SIZEOF (fmt))
+    {
+    case 1: interleave_typed<uint8_t> (planes, channels, out, frames); break;
+    case 2: interleave_typed<uint16_t> (planes, channels, out, frames); break;
+    case 4: interleave_typed<uint32_t> (planes, channels, out, frames); break;
+    default: audio_interlace (planes, fmt, channels, out, frames); break;
+    }
+}
+
+/* Seek index: demuxers without a seek function or an index of their own
+ * (ADTS, raw MP3 and the like) note the position and decoding timestamp of
+ * each keyframe packet read in a generic index.  When playback ends, that
+ * index is saved, about one entry per second of audio, and loaded again next
+ * time so that seeks in the same file can jump straight to a nearby keyframe
+ * instead of reading their way there.  Demuxers with their own index (MP4,
+ * Matroska, ...) already seek exactly and are left alone.
+ *
+ * The file starts with a header (magic, version, size and modification time
+ * of the audio file it belongs to), followed by (position, timestamp, size)
+ * entries.  All numbers are little-endian, whatever the host byte order.
+ * Entries are thinned to at most SEEK_INDEX_MAX per file, and the least
+ * recently used files are removed when they take up more than
+ * SEEK_INDEX_TOTAL bytes together. */
+#define SEEK_INDEX_MAGIC "AUDFFIDX"
+#define SEEK_INDEX_VERSION 2  /* version 1 had presentation timestamps */
+#define SEEK_INDEX_HEADER (8 + 4 + 8 + 8)
+#define SEEK_INDEX_ENTRY (8 + 8 + 4)
+#define SEEK_INDEX_MAX 4096
+#define SEEK_INDEX_TOTAL (8 << 20)
+
+static StringBuf seek_index_dir ()
+{
+    return filename_build ({aud_get_path (AudPath::UserDir), "ffaudio-index"});
+}
+
+static StringBuf seek_index_path (const FileID & id)
+{
+    char * hash = g_compute_checksum_for_string (G_CHECKSUM_SHA1, id.uri, -1);
+    StringBuf path = filename_build ({seek_index_dir (), hash});
+    g_free (hash);
+    return path;
+}
+
+static void put_le (Index<unsigned char> & out, uint64_t val, int bytes)
+{
+    for (int i = 0; i < bytes; i ++)
+        out.append ((unsigned char) (val >> (8 * i)));
+}
+
+static uint64_t get_le (const unsigned char * in, int bytes)
+{
+    uint64_t val = 0;
+    for (int i = 0; i < bytes; i ++)
+        val |= (uint64_t) in[i] << (8 * i);
+
+    return val;
+}
+
+static bool use_seek_index (AVFormatContext * ic)
+{
+    return ! ic->iformat->read_seek && ! ic->iformat->read_seek2 &&
+     (ic->iformat->flags & AVFMT_GENERIC_INDEX);
+}
+
+/* Returns the number of entries added */
+static int load_seek_index (const FileID & id, AVStream * stream)
+{
+    StringBuf path = seek_index_path (id);
+    char * data;
+    size_t len;
+    int count = 0;
+
+    if (! g_file_get_contents (path, & data, & len, nullptr))
+        return 0;
+
+    auto p = (const unsigned char *) data;
+
+    if (len >= SEEK_INDEX_HEADER && ! memcmp (p, SEEK_INDEX_MAGIC, 8) &&
+     get_le (p + 8, 4) == SEEK_INDEX_VERSION &&
+     (int64_t) get_le (p + 12, 8) == id.size &&
+     (int64_t) get_le (p + 20, 8) == id.mtime)
+    {
+        count = (len - SEEK_INDEX_HEADER) / SEEK_INDEX_ENTRY;
+        count = aud::min (count, SEEK_INDEX_MAX);
+
+        for (int i = 0; i < count; i ++)
+        {
+            const unsigned char * e = p + SEEK_INDEX_HEADER + SEEK_INDEX_ENTRY * i;
+            av_add_index_entry (stream, get_le (e, 8), get_le (e + 8, 8),
+             (int) get_le (e + 16, 4), 0, AVINDEX_KEYFRAME);
+        }
+
+        /* mark as recently used */
+        g_utime (path, nullptr);
+
+        AUDDBG ("Loaded %d seek index entries.\n", count);
+    }
+
+    g_free (data);
+    return count;
+}
+
+struct IndexFile {
+    String path;
+    int64_t size;
+    int64_t mtime;
+};
+
+/* Removes the least recently used index files until they fit SEEK_INDEX_TOTAL */
+static void trim_seek_index (const char * keep)
+{
+    StringBuf dir = seek_index_dir ();
+    GDir * handle = g_dir_open (dir, 0, nullptr);
+    if (! handle)
+        return;
+
+    Index<IndexFile> files;
+    int64_t total = 0;
+
+    const char * name;
+    while ((name = g_dir_read_name (handle)))
+    {
+        StringBuf path = filename_build ({dir, name});
+        GStatBuf st;
+
+        if (g_stat (path, & st) < 0 || ! S_ISREG (st.st_mode))
+            continue;
+
+        files.append (IndexFile {String (path), (int64_t) st.st_size, (int64_t) st.st_mtime});
+        total += st.st_size;
+    }
+
+    g_dir_close (handle);
+
+    if (total <= SEEK_INDEX_TOTAL)
+        return;
+
+    /* oldest first */
+    files.sort ([] (const IndexFile & a, const IndexFile & b)
+        { return (a.mtime > b.mtime) - (a.mtime < b.mtime); });
+
+    for (const IndexFile & file : files)
+    {
+        if (total <= SEEK_INDEX_TOTAL)
+            break;
+
+        if (! strcmp (file.path, keep))
+            continue;
+
+        AUDDBG ("Removing seek index %s.\n", (const char *) file.path);
+        g_unlink (file.path);
+        total -= file.size;
+    }
+}
+
+/* Saves keyframe entries at least <interval> apart, widening the spacing as
+ * needed to stay within SEEK_INDEX_MAX; the demuxer's own index may have an
+ * entry for every packet. */
+static void save_seek_index (const FileID & id, AVStream * stream, int64_t interval)
+{
+    Index<const AVIndexEntry *> keep;
+    interval = aud::max (interval, (int64_t) 1);
+
+    while (1)
+    {
+        int64_t last = AV_NOPTS_VALUE;
+        keep.clear ();
+
+        for (int i = 0; i < stream->nb_index_entries; i ++)
+        {
+            const AVIndexEntry & entry = stream->index_entries[i];
+
+            if ((entry.flags & AVINDEX_KEYFRAME) && (last == (int64_t) AV_NOPTS_VALUE ||
+             entry.timestamp - last >= interval))
+            {
+                keep.append (& entry);
+                last = entry.timestamp;
+            }
+        }
+
+        if (keep.len () <= SEEK_INDEX_MAX)
+            break;
+
+        interval *= 2;
+    }
+
+    Index<unsigned char> data;
+    data.insert (0, 8);
+    memcpy (data.begin (), SEEK_INDEX_MAGIC, 8);
+    put_le (data, SEEK_INDEX_VERSION, 4);
+    put_le (data, id.size, 8);
+    put_le (data, id.mtime, 8);
+
+    for (const AVIndexEntry * entry : keep)
+    {
+        put_le (data, entry->pos, 8);
+        put_le (data, entry->timestamp, 8);
+        put_le (data, entry->size, 4);
+    }
+
+    StringBuf path = seek_index_path (id);
+    StringBuf dir = filename_get_parent (path);
+
+    if (g_mkdir_with_parents (dir, 0755) < 0 ||
+     ! g_file_set_contents (path, (const char *) data.begin (), data.len (), nullptr))
+    {
+        AUDERR ("Failed to write %s.\n", (const char *) path);
+        return;
+    }
+
+    trim_seek_index (path);
+}
+
+static int64_t frame_timestamp (AVFrame * frame)
+{
+#ifdef HAVE_FFMPEG
+    return frame->best_effort_timestamp;
+#else
+    return frame->pts;
+#endif
+}
+
 static bool convert_format (int ff_fmt, int & aud_fmt, bool & planar)
 {
     switch (ff_fmt)
@@ -483,14 +1026,15 @@ static bool convert_format (int ff_fmt, int & aud_fmt, bool & planar)
 
 bool FFaudio::play (const char * filename, VFSFile & file)
 {
+    FileID id (filename);
     SmartPtr<AVFormatContext, close_input_file>
-     ic (open_input_file (filename, file));
+     ic (open_input_file (filename, file, id));
 
     if (! ic)
         return false;
 
     CodecInfo cinfo;
-    if (! find_codec (ic.get (), & cinfo))
+    if (! find_codec (ic.get (), & cinfo, id))
     {
         AUDERR ("No codec found for %s.\n", filename);
         return false;
@@ -513,6 +1057,33 @@ bool FFaudio::play (const char * filename, VFSFile & file)
     int errcount = 0;
     bool eof = false;
 
+    AVStream * stream = cinfo.stream;
+    AVRational ms_base = {1, 1000};
+    AVRational sample_base = {1, context->sample_rate};
+
+    bool use_index = id.valid () && use_seek_index (ic.get ());
+
+    /* The demuxer has indexed the first packets while opening the file */
+    int64_t first_pos = stream->nb_index_entries ? stream->index_entries[0].pos : 0;
+    int loaded = use_index ? load_seek_index (id, stream) : 0;
+
+    int index_entries = stream->nb_index_entries;
+    int64_t index_interval = av_rescale_q (AV_TIME_BASE, AV_TIME_BASE_Q, stream->time_base);
+
+    /* After a seek, decoded audio is discarded up to this timestamp */
+    int64_t seek_target = AV_NOPTS_VALUE;
+
+    /* After a seek through a loaded index, the first packet must be the
+     * keyframe the index pointed to */
+    int64_t check_pos = -1, check_dts = AV_NOPTS_VALUE;
+
+    /* Without a usable index, audio is counted from the first packet instead */
+    int64_t drop_samples = 0;
+
+    /* The packet, the frame and the interleave buffer are reused for the
+     * whole decode loop, so that steady-state decoding does not allocate. */
+    ScopedPacket pkt;
+    ScopedFrame frame;
     Index<char> buf;
 
     while (! eof && ! check_stop ())
@@ -521,15 +1092,34 @@ bool FFaudio::play (const char * filename, VFSFile & file)
 
         if (seek_value >= 0)
         {
-            if (LOG (av_seek_frame, ic.get (), -1, (int64_t) seek_value *
-             AV_TIME_BASE / 1000, AVSEEK_FLAG_ANY) >= 0)
+            /* Seek to the keyframe before the target, then decode and drop
+             * samples until we reach the exact position */
+            int64_t target = av_rescale_q (seek_value, ms_base, stream->time_base);
+            if (stream->start_time != (int64_t) AV_NOPTS_VALUE)
+                target += stream->start_time;
+
+            if (LOG (av_seek_frame, ic.get (), cinfo.stream_idx, target,
+             AVSEEK_FLAG_BACKWARD) >= 0)
+            {
+                avcodec_flush_buffers (context.ptr);
+                seek_target = target;
                 errcount = 0;
+                check_pos = -1;
+                drop_samples = 0;
+
+                int entry = loaded ? av_index_search_timestamp (stream, target,
+                 AVSEEK_FLAG_BACKWARD) : -1;
 
-            seek_value = -1;
+                if (entry >= 0)
+                {
+                    check_pos = stream->index_entries[entry].pos;
+                    check_dts = stream->index_entries[entry].timestamp;
+                }
+            }
         }
 
         /* Read next frame (or more) of data */
-        ScopedPacket pkt;
+        pkt.unref ();
         int ret = LOG (av_read_frame, ic.get (), & pkt);
 
         if (ret < 0)
@@ -548,6 +1138,37 @@ bool FFaudio::play (const char * filename, VFSFile & file)
             /* Ignore any other substreams */
             if (pkt.stream_index != cinfo.stream_idx)
                 continue;
+
+            if (check_pos >= 0)
+            {
+                if (pkt.pos != check_pos || pkt.dts != check_dts)
+                {
+                    /* The file changed in a way its size and modification
+                     * time do not show.  The loaded entries cannot be taken
+                     * out of the demuxer again, so go back to the first
+                     * packet and count the audio up to the target, as a
+                     * plain seek without an index would have to. */
+                    AUDERR ("Seek index for %s is wrong, removing it.\n", filename);
+                    g_unlink (seek_index_path (id));
+                    use_index = false;
+                    check_pos = -1;
+
+                    if (LOG (av_seek_frame, ic.get (), -1, first_pos, AVSEEK_FLAG_BYTE) >= 0)
+                    {
+                        avcodec_flush_buffers (context.ptr);
+
+                        int64_t start = (stream->start_time != (int64_t) AV_NOPTS_VALUE) ?
+                         stream->start_time : 0;
+                        drop_samples = av_rescale_q (seek_target - start,
+                         stream->time_base, sample_base);
+                    }
+
+                    seek_target = AV_NOPTS_VALUE;
+                    continue;
+                }
+
+                check_pos = -1;
+            }
         }
 
         /* Decode and play packet/frame */
@@ -568,8 +1189,6 @@ bool FFaudio::play (const char * filename, VFSFile & file)
 
         while (! check_stop ())
         {
-            ScopedFrame frame;
-
 #ifdef SEND_PACKET
             if ((ret = LOG (avcodec_receive_frame, context.ptr, frame.ptr)) < 0)
                 break; /* read next packet (continue past errors) */
@@ -592,22 +1211,57 @@ bool FFaudio::play (const char * filename, VFSFile & file)
             }
 #endif
 
-            int size = FMT_SIZEOF (out_fmt) * context->channels * frame->nb_samples;
+            /* Number of samples to drop from the start of this frame */
+            int64_t skip = 0;
+
+            if (seek_target != (int64_t) AV_NOPTS_VALUE)
+            {
+                int64_t pts = frame_timestamp (frame.ptr);
+
+                if (pts != (int64_t) AV_NOPTS_VALUE)
+                {
+                    skip = av_rescale_q (seek_target - pts, stream->time_base, sample_base);
+
+                    if (skip >= frame->nb_samples)
+                        continue; /* entire frame is before the target */
+                }
+
+                skip = aud::max (skip, (int64_t) 0);
+                seek_target = AV_NOPTS_VALUE;
+            }
+            else if (drop_samples > 0)
+            {
+                if (drop_samples >= frame->nb_samples)
+                {
+                    drop_samples -= frame->nb_samples;
+                    continue;
+                }
+
+                skip = drop_samples;
+                drop_samples = 0;
+            }
+
+            int frame_size = FMT_SIZEOF (out_fmt) * context->channels;
+            int size = frame_size * (frame->nb_samples - skip);
 
             if (planar)
             {
-                if (size > buf.len ())
-                    buf.resize (size);
+                int full_size = frame_size * frame->nb_samples;
+                if (full_size > buf.len ())
+                    buf.resize (full_size);
 
-                audio_interlace ((const void * *) frame->data, out_fmt,
+                interleave ((const void * const *) frame->extended_data, out_fmt,
                  context->channels, buf.begin (), frame->nb_samples);
-                write_audio (buf.begin (), size);
+                write_audio (buf.begin () + frame_size * skip, size);
             }
             else
-                write_audio (frame->data[0], size);
+                write_audio (frame->data[0] + frame_size * skip, size);
         }
     }
 
+    if (use_index && stream->nb_index_entries > index_entries)
+        save_seek_index (id, stream, index_interval);
+
     return true;
 }
 
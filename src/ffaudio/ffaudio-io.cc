@@ -19,7 +19,18 @@
 #define WANT_VFS_STDIO_COMPAT
 #include "ffaudio-stdinc.h"
 
-#define IOBUF 4096
+#include <string.h>
+
+#include <libaudcore/runtime.h>
+
+/* Size of the buffer FFmpeg reads into, in KiB, set by "local_buffer_kb" and
+ * "remote_buffer_kb" in the config (defaults in ffaudio-core.cc).  Every
+ * refill is a call through the VFS layer.  For local files, which come from
+ * the page cache, 32 KiB makes those calls cheap next to decoding; for
+ * network transports every read may block and take locks, so the default is
+ * larger. */
+#define IOBUF_MIN_KB 4
+#define IOBUF_MAX_KB 4096
 
 static int read_cb (void * file, unsigned char * buf, int size)
 {
@@ -37,8 +48,12 @@ static int64_t seek_cb (void * file, int64_t offset, int whence)
 
 AVIOContext * io_context_new (VFSFile & file)
 {
-    void * buf = av_malloc (IOBUF);
-    return avio_alloc_context ((unsigned char *) buf, IOBUF, 0, & file, read_cb, nullptr, seek_cb);
+    bool remote = strncmp (file.filename (), "file://", 7);
+    int kb = aud_get_int ("ffaudio", remote ? "remote_buffer_kb" : "local_buffer_kb");
+    int size = aud::clamp (kb, IOBUF_MIN_KB, IOBUF_MAX_KB) * 1024;
+
+    void * buf = av_malloc (size);
+    return avio_alloc_context ((unsigned char *) buf, size, 0, & file, read_cb, nullptr, seek_cb);
 }
 
 void io_context_free (AVIOContext * io)
@@ -18,6 +18,7 @@
  */
 
 #include <assert.h>
+#include <string.h>
 
 #include "ladspa.h"
 #include "plugin.h"
@@ -26,12 +27,55 @@
 
 static int ladspa_channels, ladspa_rate;
 
+/* The whole chain runs on planar data: the input is deinterleaved once into
+ * one of two banks of LADSPA_BUFLEN samples per channel, each plugin reads
+ * from one bank and writes to the other, and the result is interleaved once
+ * at the end.  A plugin's audio ports stay connected to the banks for as long
+ * as its position in the chain does not change.
+ *
+ * Optionally, the chain is split into pipeline stages, each with its own pair
+ * of banks.  Every chunk then moves one stage along per step, so that all the
+ * stages can run at once, at the cost of one chunk of latency per stage after
+ * the first.  The output then no longer matches the input in length. */
+struct Stage {
+    Index<float> banks[2];
+    int frames;  /* in banks[0] before a step, in banks[out] after it */
+    int out;
+};
+
+/* Runs one instance (lane) of each plugin in a range of the chain.  Plugins
+ * with the same number of instances use the same channels for each instance,
+ * so the jobs for the different lanes of such a range are independent. */
+struct Job {
+    Stage * stage;
+    int first, last;
+    int lane;
+};
+
+static Index<Stage> stages;
+static Index<int> stage_starts;  /* index into chain, one more than stages */
+static Index<LoadedPlugin *> chain;
+static Index<Job> jobs;
+static Index<int> phase_ends;  /* index into jobs */
+static Index<float> output;
+
+/* Worker threads take jobs of one phase at a time; the calling thread takes
+ * jobs as well, and waits for the workers before the next phase. */
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static Index<pthread_t> workers;
+static int work_serial, work_pending;
+static bool workers_quit;
+static int job_next, job_end;
+
 static void start_plugin (LoadedPlugin & loaded)
 {
     if (loaded.active)
         return;
 
     loaded.active = 1;
+    loaded.in_bank = nullptr;
 
     PluginData & plugin = loaded.plugin;
     const LADSPA_Descriptor & desc = plugin.desc;
@@ -53,9 +97,6 @@ static void start_plugin (LoadedPlugin & loaded)
 
     int instances = ladspa_channels / ports;
 
-    loaded.in_bufs.insert (0, ladspa_channels);
-    loaded.out_bufs.insert (0, ladspa_channels);
-
     for (int i = 0; i < instances; i ++)
     {
         LADSPA_Handle handle = desc.instantiate (& desc, ladspa_rate);
@@ -65,80 +106,328 @@ static void start_plugin (LoadedPlugin & loaded)
         for (int c = 0; c < controls; c ++)
             desc.connect_port (handle, plugin.controls[c].port, & loaded.values[c]);
 
+        if (desc.activate)
+            desc.activate (handle);
+    }
+}
+
+static void connect_plugin (LoadedPlugin & loaded, float * in, float * out)
+{
+    PluginData & plugin = loaded.plugin;
+    const LADSPA_Descriptor & desc = plugin.desc;
+
+    int ports = plugin.in_ports.len ();
+    int instances = loaded.instances.len ();
+    assert (ports * instances == ladspa_channels);
+
+    for (int i = 0; i < instances; i ++)
+    {
+        LADSPA_Handle handle = loaded.instances[i];
+
         for (int p = 0; p < ports; p ++)
         {
             int channel = ports * i + p;
+            desc.connect_port (handle, plugin.in_ports[p], in + channel * LADSPA_BUFLEN);
+            desc.connect_port (handle, plugin.out_ports[p], out + channel * LADSPA_BUFLEN);
+        }
+    }
 
-            Index<float> & in = loaded.in_bufs[channel];
-            in.insert (0, LADSPA_BUFLEN);
-            desc.connect_port (handle, plugin.in_ports[p], in.begin ());
+    loaded.in_bank = in;
+}
+
+static void deinterleave (const float * data, float * bank, int frames)
+{
+    for (int c = 0; c < ladspa_channels; c ++)
+    {
+        const float * get = data + c;
+        float * set = bank + c * LADSPA_BUFLEN;
+        float * set_end = set + frames;
 
-            Index<float> & out = loaded.out_bufs[channel];
-            out.insert (0, LADSPA_BUFLEN);
-            desc.connect_port (handle, plugin.out_ports[p], out.begin ());
+        while (set < set_end)
+        {
+            * set ++ = * get;
+            get += ladspa_channels;
         }
+    }
+}
 
-        if (desc.activate)
-            desc.activate (handle);
+static void interleave (const float * bank, float * data, int frames)
+{
+    for (int c = 0; c < ladspa_channels; c ++)
+    {
+        const float * get = bank + c * LADSPA_BUFLEN;
+        const float * get_end = get + frames;
+        float * set = data + c;
+
+        while (get < get_end)
+        {
+            * set = * get ++;
+            set += ladspa_channels;
+        }
     }
 }
 
-static void run_plugin (LoadedPlugin & loaded, float * data, int samples)
+static void run_job (const Job & job)
 {
-    if (! loaded.instances.len ())
+    for (int i = job.first; i < job.last; i ++)
+    {
+        LoadedPlugin & loaded = * chain[i];
+        loaded.plugin.desc.run (loaded.instances[job.lane], job.stage->frames);
+    }
+}
+
+static void take_jobs ()
+{
+    int i;
+    while ((i = __sync_fetch_and_add (& job_next, 1)) < job_end)
+        run_job (jobs[i]);
+}
+
+static void * worker_thread (void *)
+{
+    int serial = 0;
+
+    pthread_mutex_lock (& pool_mutex);
+
+    while (1)
+    {
+        while (! workers_quit && work_serial == serial)
+            pthread_cond_wait (& work_cond, & pool_mutex);
+
+        if (workers_quit)
+            break;
+
+        serial = work_serial;
+        pthread_mutex_unlock (& pool_mutex);
+
+        take_jobs ();
+
+        pthread_mutex_lock (& pool_mutex);
+
+        if (! -- work_pending)
+            pthread_cond_signal (& done_cond);
+    }
+
+    pthread_mutex_unlock (& pool_mutex);
+    return nullptr;
+}
+
+static void run_jobs (int first, int last)
+{
+    job_next = first;
+    job_end = last;
+
+    if (workers.len () && last - first > 1)
+    {
+        pthread_mutex_lock (& pool_mutex);
+        work_pending = workers.len ();
+        work_serial ++;
+        pthread_cond_broadcast (& work_cond);
+        pthread_mutex_unlock (& pool_mutex);
+
+        take_jobs ();
+
+        pthread_mutex_lock (& pool_mutex);
+        while (work_pending)
+            pthread_cond_wait (& done_cond, & pool_mutex);
+        pthread_mutex_unlock (& pool_mutex);
+    }
+    else
+        take_jobs ();
+}
+
+static void start_workers (int count)
+{
+    for (int i = 0; i < count; i ++)
+    {
+        pthread_t thread;
+        if (pthread_create (& thread, nullptr, worker_thread, nullptr))
+        {
+            AUDERR ("Failed to create worker thread.\n");
+            break;
+        }
+
+        workers.append (thread);
+    }
+}
+
+static void stop_workers ()
+{
+    if (! workers.len ())
         return;
 
-    PluginData & plugin = loaded.plugin;
-    const LADSPA_Descriptor & desc = plugin.desc;
+    pthread_mutex_lock (& pool_mutex);
+    workers_quit = true;
+    pthread_cond_broadcast (& work_cond);
+    pthread_mutex_unlock (& pool_mutex);
 
-    int ports = plugin.in_ports.len ();
-    int instances = loaded.instances.len ();
-    assert (ports * instances == ladspa_channels);
+    for (pthread_t thread : workers)
+        pthread_join (thread, nullptr);
 
-    while (samples / ladspa_channels > 0)
+    workers.clear ();
+    workers_quit = false;
+    work_serial = 0;
+}
+
+/* collects the running plugins, splits them into stages and connects them */
+static void build_chain ()
+{
+    chain.resize (0);
+
+    for (auto & loaded : loadeds)
     {
-        int frames = aud::min (samples / ladspa_channels, LADSPA_BUFLEN);
+        start_plugin (* loaded);
+        if (loaded->instances.len ())
+            chain.append (loaded.get ());
+    }
 
-        for (int i = 0; i < instances; i ++)
+    int n_stages = stages.len ();
+
+    for (int s = 0; s <= n_stages; s ++)
+        stage_starts[s] = chain.len () * s / n_stages;
+
+    for (int s = 0; s < n_stages; s ++)
+    {
+        Stage & stage = stages[s];
+        int bank = 0;
+
+        for (int i = stage_starts[s]; i < stage_starts[s + 1]; i ++)
         {
-            LADSPA_Handle handle = loaded.instances[i];
+            float * in = stage.banks[bank].begin ();
+            if (chain[i]->in_bank != in)
+                connect_plugin (* chain[i], in, stage.banks[! bank].begin ());
 
-            for (int p = 0; p < ports; p ++)
-            {
-                int channel = ports * i + p;
-                float * get = data + channel;
-                float * in = loaded.in_bufs[channel].begin ();
-                float * in_end = in + frames;
+            bank = ! bank;
+        }
 
-                while (in < in_end)
-                {
-                    * in ++ = * get;
-                    get += ladspa_channels;
-                }
-            }
+        stage.out = bank;
+    }
+}
 
-            desc.run (handle, frames);
+/* Moves the data one stage along, feeds the given frames (if any) into the
+ * first stage and runs all the stages.  Each stage is cut into ranges of
+ * plugins with the same number of instances; the nth ranges of all stages
+ * form a phase, whose jobs can all run at once. */
+static void run_step (const float * data, int frames)
+{
+    for (int s = stages.len () - 1; s > 0; s --)
+    {
+        Stage & from = stages[s - 1];
+        Stage & to = stages[s];
+
+        for (int c = 0; c < ladspa_channels && from.frames; c ++)
+            memcpy (& to.banks[0][c * LADSPA_BUFLEN],
+             & from.banks[from.out][c * LADSPA_BUFLEN], sizeof (float) * from.frames);
+
+        to.frames = from.frames;
+    }
+
+    if (frames)
+        deinterleave (data, stages[0].banks[0].begin (), frames);
+
+    stages[0].frames = frames;
+
+    jobs.resize (0);
+    phase_ends.resize (0);
+
+    for (int phase = 0;; phase ++)
+    {
+        for (Stage & stage : stages)
+        {
+            if (! stage.frames)
+                continue;
 
-            for (int p = 0; p < ports; p ++)
+            int s = & stage - stages.begin ();
+            int first = stage_starts[s], range = 0;
+
+            /* find the range of plugins for this phase */
+            while (first < stage_starts[s + 1])
             {
-                int channel = ports * i + p;
-                float * set = data + channel;
-                float * out = loaded.out_bufs[channel].begin ();
-                float * out_end = out + frames;
+                int last = first + 1;
+                int lanes = chain[first]->instances.len ();
+
+                while (last < stage_starts[s + 1] && chain[last]->instances.len () == lanes)
+                    last ++;
 
-                while (out < out_end)
+                if (range ++ == phase)
                 {
-                    * set = * out ++;
-                    set += ladspa_channels;
+                    for (int lane = 0; lane < lanes; lane ++)
+                        jobs.append (Job {& stage, first, last, lane});
+
+                    break;
                 }
+
+                first = last;
             }
         }
 
+        int end = jobs.len ();
+        if (end == (phase ? phase_ends[phase - 1] : 0))
+            break;
+
+        phase_ends.append (end);
+    }
+
+    int first = 0;
+    for (int end : phase_ends)
+    {
+        run_jobs (first, end);
+        first = end;
+    }
+}
+
+/* interleaves the output of the last stage, either into <data> or, if that
+ * is null, at the end of the output buffer */
+static void emit (float * data)
+{
+    Stage & last = stages[stages.len () - 1];
+
+    if (! last.frames)
+        return;
+
+    if (! data)
+    {
+        int old = output.len ();
+        output.insert (-1, last.frames * ladspa_channels);
+        data = & output[old];
+    }
+
+    interleave (last.banks[last.out].begin (), data, last.frames);
+}
+
+/* With a single stage, the data is processed in place; otherwise the output
+ * is appended to the output buffer. */
+static void run_chain (float * data, int samples)
+{
+    build_chain ();
+
+    bool in_place = (stages.len () == 1);
+
+    if (in_place && ! chain.len ())
+        return;
+
+    while (samples / ladspa_channels > 0)
+    {
+        int frames = aud::min (samples / ladspa_channels, LADSPA_BUFLEN);
+
+        run_step (data, frames);
+        emit (in_place ? data : nullptr);
+
         data += ladspa_channels * frames;
         samples -= ladspa_channels * frames;
     }
 }
 
+/* passes the data left in the pipeline through the remaining stages */
+static void drain_chain ()
+{
+    for (int s = 1; s < stages.len (); s ++)
+    {
+        run_step (nullptr, 0);
+        emit (nullptr);
+    }
+}
+
 static void flush_plugin (LoadedPlugin & loaded)
 {
     if (! loaded.instances.len ())
@@ -181,20 +470,53 @@ void shutdown_plugin_locked (LoadedPlugin & loaded)
     }
 
     loaded.instances.clear ();
-    loaded.in_bufs.clear ();
-    loaded.out_bufs.clear ();
+}
+
+void cleanup_effect ()
+{
+    stop_workers ();
+
+    stages.clear ();
+    stage_starts.clear ();
+    chain.clear ();
+    jobs.clear ();
+    phase_ends.clear ();
+    output.clear ();
 }
 
 void LADSPAHost::start (int & channels, int & rate)
 {
     pthread_mutex_lock (& mutex);
 
+    stop_workers ();
+
     for (auto & loaded : loadeds)
         shutdown_plugin_locked (* loaded);
 
     ladspa_channels = channels;
     ladspa_rate = rate;
 
+    int n_stages = aud::clamp (aud_get_int ("ladspa", "pipeline_stages"), 1, MAX_STAGES);
+    int threads = aud::clamp (aud_get_int ("ladspa", "threads"), 1, MAX_THREADS);
+
+    stages.resize (0);
+    stages.insert (0, n_stages);
+    stage_starts.resize (n_stages + 1);
+
+    for (Stage & stage : stages)
+    {
+        for (auto & bank : stage.banks)
+            bank.resize (channels * LADSPA_BUFLEN);
+
+        stage.frames = 0;
+        stage.out = 0;
+    }
+
+    start_workers (threads - 1);
+
+    if (n_stages > 1 || threads > 1)
+        AUDINFO ("Running LADSPA plugins in %d stages on %d threads.\n", n_stages, threads);
+
     pthread_mutex_unlock (& mutex);
 }
 
@@ -202,14 +524,11 @@ Index<float> & LADSPAHost::process (Index<float> & data)
 {
     pthread_mutex_lock (& mutex);
 
-    for (auto & loaded : loadeds)
-    {
-        start_plugin (* loaded);
-        run_plugin (* loaded, data.begin (), data.len ());
-    }
+    output.resize (0);
+    run_chain (data.begin (), data.len ());
 
     pthread_mutex_unlock (& mutex);
-    return data;
+    return (stages.len () == 1) ? data : output;
 }
 
 bool LADSPAHost::flush (bool force)
@@ -219,6 +538,9 @@ bool LADSPAHost::flush (bool force)
     for (auto & loaded : loadeds)
         flush_plugin (* loaded);
 
+    for (Stage & stage : stages)
+        stage.frames = 0;
+
     pthread_mutex_unlock (& mutex);
     return true;
 }
@@ -227,15 +549,29 @@ Index<float> & LADSPAHost::finish (Index<float> & data, bool end_of_playlist)
 {
     pthread_mutex_lock (& mutex);
 
-    for (auto & loaded : loadeds)
-    {
-        start_plugin (* loaded);
-        run_plugin (* loaded, data.begin (), data.len ());
+    output.resize (0);
+    run_chain (data.begin (), data.len ());
+    drain_chain ();
 
-        if (end_of_playlist)
+    if (end_of_playlist)
+    {
+        for (auto & loaded : loadeds)
             shutdown_plugin_locked (* loaded);
     }
 
     pthread_mutex_unlock (& mutex);
-    return data;
+    return (stages.len () == 1) ? data : output;
+}
+
+int LADSPAHost::adjust_delay (int delay)
+{
+    pthread_mutex_lock (& mutex);
+
+    /* frames waiting between stages */
+    int frames = 0;
+    for (int s = 0; s < stages.len () - 1; s ++)
+        frames += stages[s].frames;
+
+    pthread_mutex_unlock (& mutex);
+    return delay + aud::rescale (frames, ladspa_rate, 1000);
 }
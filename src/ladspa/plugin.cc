@@ -36,6 +36,8 @@
 
 const char * const LADSPAHost::defaults[] = {
  "plugin_count", "0",
+ "threads", "1",
+ "pipeline_stages", "1",
  nullptr};
 
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -320,6 +322,7 @@ void LADSPAHost::cleanup ()
 
     aud_set_str ("ladspa", "module_path", module_path);
     save_enabled_to_config ();
+    cleanup_effect ();
     close_modules ();
 
     modules.clear ();
@@ -555,7 +558,15 @@ const char LADSPAHost::about[] =
     "Copyright 2011 John Lindgren");
 
 const PreferencesWidget LADSPAHost::widgets[] = {
-    WidgetCustomGTK (make_config_widget)
+    WidgetCustomGTK (make_config_widget),
+    WidgetSpin (N_("Threads:"),
+        WidgetInt ("ladspa", "threads"),
+        {1, MAX_THREADS, 1}),
+    WidgetSpin (N_("Pipeline stages:"),
+        WidgetInt ("ladspa", "pipeline_stages"),
+        {1, MAX_STAGES, 1}),
+    WidgetLabel (N_("<small>Each pipeline stage after the first adds up to "
+     "1024 samples of latency.</small>"))
 };
 
 const PluginPreferences LADSPAHost::prefs = {{widgets}};
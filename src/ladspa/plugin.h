@@ -29,6 +29,8 @@
 #include "ladspa.h"
 
 #define LADSPA_BUFLEN 1024
+#define MAX_THREADS 8
+#define MAX_STAGES 4
 
 struct PreferencesWidget;
 
@@ -59,7 +61,7 @@ struct LoadedPlugin
     bool selected = false;
     bool active = false;
     Index<LADSPA_Handle> instances;
-    Index<Index<float>> in_bufs, out_bufs;
+    float * in_bank = nullptr;  /* buffer the inputs are connected to (effect.c) */
     GtkWidget * settings_win = nullptr;
 
     LoadedPlugin (PluginData & plugin) :
@@ -90,6 +92,7 @@ public:
     Index<float> & process (Index<float> & data);
     bool flush (bool force);
     Index<float> & finish (Index<float> & data, bool end_of_playlist);
+    int adjust_delay (int delay);
 };
 
 /* plugin.c */
@@ -113,6 +116,7 @@ void disable_plugin_locked (LoadedPlugin & loaded);
 /* effect.c */
 
 void shutdown_plugin_locked (LoadedPlugin & loaded);
+void cleanup_effect ();
 
 /* plugin-list.c */
 
@@ -17,14 +17,22 @@
  * the use of this software.
  */
 
-/* TODO: implement more surround converters */
-
+#include <math.h>
 #include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
+#include <libaudcore/audstrings.h>
 #include <libaudcore/i18n.h>
 #include <libaudcore/runtime.h>
 #include <libaudcore/plugin.h>
 #include <libaudcore/preferences.h>
+#include <libaudcore/vfs.h>
+
+#include "../effect-common/channel-matrix.h"
 
 class ChannelMixer : public EffectPlugin
 {
@@ -53,163 +61,310 @@ public:
 
 EXPORT ChannelMixer aud_plugin_instance;
 
-typedef Index<float> & (* Converter) (Index<float> & data);
+enum {
+    MATRIX_CLASSIC,  /* the converters of earlier versions, ITU-R BS.775 otherwise */
+    MATRIX_ITU,      /* ITU-R BS.775 down-mix coefficients */
+    MATRIX_FILE      /* loaded from a text file */
+};
+
+/* output channel o = sum over input channels i of matrix[o][i] * input i */
+static ChannelMatrix matrix;
 
+static int input_channels, output_channels;
+static bool pass_through;
 static Index<float> mixer_buf;
 
-static Index<float> & mono_to_stereo (Index<float> & data)
+/* the fixed converters of earlier versions, for compatibility */
+static bool set_classic_matrix ()
 {
-    int frames = data.len ();
-    mixer_buf.resize (2 * frames);
+    static const float mono_to_stereo[] = {1, 1};
+    static const float stereo_to_mono[] = {0.5, 0.5};
+    static const float quadro_to_stereo[] = {
+        1, 0, 0.7, 0,
+        0, 1, 0, 0.7
+    };
+    static const float quadro_5_to_stereo[] = {
+        1, 0, 0.5, 1, 0,
+        0, 1, 0.5, 0, 1
+    };
+    static const float surround_5p1_to_stereo[] = {
+        1, 0, 0.5, 0.5, 0.5, 0,
+        0, 1, 0.5, 0.5, 0, 0.5
+    };
 
-    float * get = data.begin ();
-    float * set = mixer_buf.begin ();
+    const float * gains =
+     (input_channels == 1 && output_channels == 2) ? mono_to_stereo :
+     (input_channels == 2 && output_channels == 1) ? stereo_to_mono :
+     (input_channels == 4 && output_channels == 2) ? quadro_to_stereo :
+     (input_channels == 5 && output_channels == 2) ? quadro_5_to_stereo :
+     (input_channels == 6 && output_channels == 2) ? surround_5p1_to_stereo : nullptr;
 
-    while (frames --)
+    if (! gains)
+        return false;
+
+    for (int o = 0; o < output_channels; o ++)
     {
-        float val = * get ++;
-        * set ++ = val;
-        * set ++ = val;
+        for (int i = 0; i < input_channels; i ++)
+            matrix[o][i] = gains[o * input_channels + i];
     }
 
-    return mixer_buf;
+    return true;
 }
 
-static Index<float> & stereo_to_mono (Index<float> & data)
+/* The file has one line per output channel, each with one gain per input
+ * channel, separated by spaces or commas.  Blank lines and lines starting
+ * with # are ignored. */
+static bool load_matrix_file ()
 {
-    int frames = data.len () / 2;
-    mixer_buf.resize (frames);
-
-    float * get = data.begin ();
-    float * set = mixer_buf.begin ();
-
-    while (frames --)
+    String path = aud_get_str ("mixer", "matrix_file");
+    if (! path[0])
     {
-        float val = * get ++;
-        val += * get ++;
-        * set ++ = val / 2;
+        AUDERR ("No matrix file has been set.\n");
+        return false;
     }
 
-    return mixer_buf;
-}
+    VFSFile file (strstr (path, "://") ? (const char *) path : (const char *) filename_to_uri (path), "r");
+    if (! file)
+        return false;
 
-static Index<float> & quadro_to_stereo (Index<float> & data)
-{
-    int frames = data.len () / 4;
-    mixer_buf.resize (2 * frames);
+    Index<char> text = file.read_all ();
+    text.append (0);
 
-    float * get = data.begin ();
-    float * set = mixer_buf.begin ();
+    int rows = 0;
+    char * line = text.begin ();
 
-    while (frames --)
+    while (line && * line)
     {
-        float front_left  = * get ++;
-        float front_right = * get ++;
-        float back_left   = * get ++;
-        float back_right  = * get ++;
-        * set ++ = front_left + (back_left * 0.7);
-        * set ++ = front_right + (back_right * 0.7);
+        char * next = strchr (line, '\n');
+        if (next)
+            * next ++ = 0;
+
+        while (* line == ' ' || * line == '\t')
+            line ++;
+
+        if (* line && * line != '#' && * line != '\r')
+        {
+            if (rows == output_channels)
+                goto ERR;
+
+            int cols = 0;
+            char * end;
+
+            while (1)
+            {
+                float gain = strtof (line, & end);
+                if (end == line)
+                    break;
+
+                if (cols == input_channels)
+                    goto ERR;
+
+                matrix[rows][cols ++] = gain;
+                line = end + strspn (end, " \t,\r");
+            }
+
+            if (* line || cols != input_channels)
+                goto ERR;
+
+            rows ++;
+        }
+
+        line = next;
     }
 
-    return mixer_buf;
+    if (rows == output_channels)
+        return true;
+
+ERR:
+    AUDERR ("%s does not hold a valid %d x %d matrix.\n", (const char *) path,
+     output_channels, input_channels);
+    return false;
 }
 
-static Index<float> & surround_5p1_to_stereo (Index<float> & data)
+/* Mixing kernels.  The common shapes are compiled with the channel counts as
+ * constants, so that the inner loops are fully unrolled; with SSE2, four
+ * frames are mixed at once, with the gains for each pair of channels held in
+ * a register.  Since each block is read before it is written, the output may
+ * overlap the input if it has no more channels. */
+
+typedef void (* MixFunc) (const float * in, float * out, int frames);
+
+template<int IN, int OUT>
+static void mix_fixed (const float * in, float * out, int frames)
 {
-    int frames = data.len () / 6;
-    mixer_buf.resize (2 * frames);
+    int f = 0;
 
-    float * get = data.begin ();
-    float * set = mixer_buf.begin ();
+#ifdef __SSE2__
+    __m128 gains[OUT][IN];
+    for (int o = 0; o < OUT; o ++)
+    {
+        for (int i = 0; i < IN; i ++)
+            gains[o][i] = _mm_set1_ps (matrix[o][i]);
+    }
 
-    while (frames --)
+    for (; f + 4 <= frames; f += 4)
     {
-        float front_left  = * get ++;
-        float front_right = * get ++;
-        float center = * get ++;
-        float lfe    = * get ++;
-        float rear_left   = * get ++;
-        float rear_right  = * get ++;
-        * set ++ = front_left + (center * 0.5) + (lfe * 0.5) + (rear_left * 0.5);
-        * set ++ = front_right + (center * 0.5) + (lfe * 0.5) + (rear_right * 0.5);
+        __m128 x[IN];
+        for (int i = 0; i < IN; i ++)
+            x[i] = _mm_setr_ps (in[i], in[IN + i], in[2 * IN + i], in[3 * IN + i]);
+
+        float y[OUT][4];
+        for (int o = 0; o < OUT; o ++)
+        {
+            __m128 sum = _mm_mul_ps (gains[o][0], x[0]);
+            for (int i = 1; i < IN; i ++)
+                sum = _mm_add_ps (sum, _mm_mul_ps (gains[o][i], x[i]));
+
+            _mm_storeu_ps (y[o], sum);
+        }
+
+        for (int k = 0; k < 4; k ++)
+        {
+            for (int o = 0; o < OUT; o ++)
+                out[k * OUT + o] = y[o][k];
+        }
+
+        in += 4 * IN;
+        out += 4 * OUT;
     }
+#endif
 
-    return mixer_buf;
+    float gains1[OUT][IN];
+    for (int o = 0; o < OUT; o ++)
+    {
+        for (int i = 0; i < IN; i ++)
+            gains1[o][i] = matrix[o][i];
+    }
+
+    for (; f < frames; f ++)
+    {
+        float x[IN];
+        for (int i = 0; i < IN; i ++)
+            x[i] = in[i];
+
+        for (int o = 0; o < OUT; o ++)
+        {
+            float sum = 0;
+            for (int i = 0; i < IN; i ++)
+                sum += gains1[o][i] * x[i];
+
+            out[o] = sum;
+        }
+
+        in += IN;
+        out += OUT;
+    }
 }
 
-/* 5 channels case. Quad + center channel */
-static Index<float> & quadro_5_to_stereo (Index<float> & data)
+static void mix_generic (const float * in, float * out, int frames)
 {
-    int frames = data.len () / 5;
-    mixer_buf.resize (2 * frames);
-
-    float * get = data.begin ();
-    float * set = mixer_buf.begin ();
+    const int n_in = input_channels, n_out = output_channels;
+    float x[AUD_MAX_CHANNELS];
 
     while (frames --)
     {
-        float front_left  = * get ++;
-        float front_right = * get ++;
-        float center = * get ++;
-        float rear_left   = * get ++;
-        float rear_right  = * get ++;
-        * set ++ = front_left + (center * 0.5) + rear_left;
-        * set ++ = front_right + (center * 0.5) + rear_right;
-    }
+        for (int i = 0; i < n_in; i ++)
+            x[i] = in[i];
 
-    return mixer_buf;
+        for (int o = 0; o < n_out; o ++)
+        {
+            float sum = 0;
+            for (int i = 0; i < n_in; i ++)
+                sum += matrix[o][i] * x[i];
+
+            out[o] = sum;
+        }
+
+        in += n_in;
+        out += n_out;
+    }
 }
 
-static Converter get_converter (int in, int out)
+static MixFunc get_mix_func (int in, int out)
 {
-    if (in == 1 && out == 2)
-        return mono_to_stereo;
-    if (in == 2 && out == 1)
-        return stereo_to_mono;
-    if (in == 4 && out == 2)
-        return quadro_to_stereo;
-    if (in == 5 && out == 2)
-        return quadro_5_to_stereo;
-    if (in == 6 && out == 2)
-        return surround_5p1_to_stereo;
-
-    return nullptr;
+#define SHAPE(i, o) if (in == i && out == o) return mix_fixed<i, o>;
+    SHAPE (1, 2)
+    SHAPE (2, 1)
+    SHAPE (2, 2)
+    SHAPE (4, 2)
+    SHAPE (5, 2)
+    SHAPE (6, 2)
+    SHAPE (7, 2)
+    SHAPE (8, 2)
+    SHAPE (6, 6)
+    SHAPE (8, 6)
+    SHAPE (2, 6)
+    SHAPE (2, 8)
+    SHAPE (6, 8)
+#undef SHAPE
+
+    return mix_generic;
 }
 
-static int input_channels, output_channels;
+static MixFunc mix_func;
 
 void ChannelMixer::start (int & channels, int & rate)
 {
     input_channels = channels;
-    output_channels = aud_get_int ("mixer", "channels");
+    output_channels = aud::clamp (aud_get_int ("mixer", "channels"), 1, AUD_MAX_CHANNELS);
 
-    if (input_channels == output_channels)
+    int type = aud_get_int ("mixer", "matrix");
+
+    pass_through = (input_channels == output_channels && type != MATRIX_FILE);
+    if (pass_through)
         return;
 
-    if (! get_converter (input_channels, output_channels))
+    memset (matrix, 0, sizeof matrix);
+
+    bool valid = false;
+
+    if (type == MATRIX_FILE)
+        valid = load_matrix_file ();
+    if (! valid && type == MATRIX_CLASSIC)
+        valid = set_classic_matrix ();
+    if (! valid)
+        valid = channel_matrix_bs775 (matrix, input_channels, output_channels);
+
+    if (! valid)
     {
         AUDERR ("Converting %d to %d channels is not implemented.\n",
          input_channels, output_channels);
+        pass_through = true;
         return;
     }
 
+    if (aud_get_bool ("mixer", "normalize"))
+        channel_matrix_normalize (matrix, input_channels, output_channels);
+
+    mix_func = get_mix_func (input_channels, output_channels);
     channels = output_channels;
 }
 
 Index<float> & ChannelMixer::process (Index<float> & data)
 {
-    if (input_channels == output_channels)
+    if (pass_through)
         return data;
 
-    Converter converter = get_converter (input_channels, output_channels);
-    if (converter)
-        return converter (data);
+    int frames = data.len () / input_channels;
+
+    /* mix in place unless there are more output channels */
+    if (output_channels <= input_channels)
+    {
+        mix_func (data.begin (), data.begin (), frames);
+        data.resize (frames * output_channels);
+        return data;
+    }
 
-    return data;
+    mixer_buf.resize (frames * output_channels);
+    mix_func (data.begin (), mixer_buf.begin (), frames);
+    return mixer_buf;
 }
 
 const char * const ChannelMixer::defaults[] = {
  "channels", "2",
+ "matrix", aud::numeric_string<MATRIX_CLASSIC>::str,
+ "matrix_file", "",
+ "normalize", "FALSE",
   nullptr};
 
 bool ChannelMixer::init ()
@@ -227,11 +382,24 @@ const char ChannelMixer::about[] =
  N_("Channel Mixer Plugin for Audacious\n"
     "Copyright 2011-2012 John Lindgren and Michał Lipski");
 
+static const ComboItem matrix_list[] = {
+    ComboItem (N_("Classic"), MATRIX_CLASSIC),
+    ComboItem (N_("ITU-R BS.775"), MATRIX_ITU),
+    ComboItem (N_("From file"), MATRIX_FILE)
+};
+
 const PreferencesWidget ChannelMixer::widgets[] = {
     WidgetLabel (N_("<b>Channel Mixer</b>")),
     WidgetSpin (N_("Output channels:"),
         WidgetInt ("mixer", "channels"),
-        {1, AUD_MAX_CHANNELS, 1})
+        {1, AUD_MAX_CHANNELS, 1}),
+    WidgetCombo (N_("Mixing matrix:"),
+        WidgetInt ("mixer", "matrix"),
+        {{matrix_list}}),
+    WidgetEntry (N_("Matrix file:"),
+        WidgetString ("mixer", "matrix_file")),
+    WidgetCheck (N_("Scale down to avoid clipping"),
+        WidgetBool ("mixer", "normalize"))
 };
 
 const PluginPreferences ChannelMixer::prefs = {{widgets}};
@@ -0,0 +1,382 @@
+/*
+ *  On-disk byte cache for the neon plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#define __STDC_FORMAT_MACROS
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <libaudcore/audstrings.h>
+#include <libaudcore/runtime.h>
+
+#include "disk_cache.h"
+
+/* guards open_entries, cache_total and the files in the cache directory */
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Index<DiskCacheEntry *> open_entries;
+
+/* Estimated size of the cache on disk: what the last scan found, plus the
+ * bytes cached since then (-1 before the first scan).  The directory is only
+ * scanned again once this goes over the limit; eviction then goes down to
+ * TRIM_TARGET percent of the limit, so that the next scan is some way off. */
+static int64_t cache_total = -1;
+
+#define TRIM_TARGET 90
+
+static bool is_open (const char * base)
+{
+    for (DiskCacheEntry * entry : open_entries)
+    {
+        if (! strcmp (entry->base (), base))
+            return true;
+    }
+
+    return false;
+}
+
+static StringBuf cache_dir ()
+{
+    return filename_build ({aud_get_path (AudPath::UserDir), "neon-cache"});
+}
+
+DiskCacheEntry * DiskCacheEntry::open (const char * url, const char * validator,
+ int64_t length)
+{
+    if (! aud_get_bool ("neon", "disk_cache") || length <= 0)
+        return nullptr;
+
+    StringBuf dir = cache_dir ();
+
+    if (g_mkdir_with_parents (dir, 0700) < 0)
+    {
+        AUDERR ("Failed to create %s: %s\n", (const char *) dir, strerror (errno));
+        return nullptr;
+    }
+
+    char * hash = g_compute_checksum_for_string (G_CHECKSUM_SHA1, url, -1);
+    String base (filename_build ({dir, hash}));
+    g_free (hash);
+
+    pthread_mutex_lock (& cache_mutex);
+
+    /* Another file (e.g. a second instance of the same stream) is using the
+     * entry.  Sharing it would mean coordinating writes between the two, and
+     * opening it again would truncate the data under the other one. */
+    if (is_open (base))
+    {
+        AUDDBG ("Cache entry for %s is in use, not caching\n", url);
+        pthread_mutex_unlock (& cache_mutex);
+        return nullptr;
+    }
+
+    StringBuf data_uri = filename_to_uri (str_concat ({base, ".data"}));
+
+    /* reuse the old data only if it is still the same resource */
+    DiskCacheEntry probe {String (base), VFSFile ()};
+    bool valid = probe.load_index () && ! strcmp (probe.m_url, url) &&
+     ! strcmp (probe.m_validator, validator) && probe.m_length == length;
+
+    VFSFile data;
+    if (valid)
+        data = VFSFile (data_uri, "r+");
+    if (! data)
+    {
+        valid = false;
+        data = VFSFile (data_uri, "w+");
+    }
+
+    if (! data)
+    {
+        AUDERR ("Failed to open cache file for %s: %s\n", url, data.error ());
+        pthread_mutex_unlock (& cache_mutex);
+        return nullptr;
+    }
+
+    auto entry = new DiskCacheEntry (std::move (base), std::move (data));
+
+    entry->m_url = String (url);
+    entry->m_validator = String (validator);
+    entry->m_length = length;
+
+    if (valid)
+        entry->m_ranges = std::move (probe.m_ranges);
+
+    /* always rewrite the index when closing, so that its mtime reflects the
+     * last use; until then the entry is protected by being open */
+    entry->m_changed = true;
+
+    open_entries.append (entry);
+    pthread_mutex_unlock (& cache_mutex);
+
+    AUDDBG ("Cache entry for %s: %d cached ranges\n", url, entry->m_ranges.len ());
+
+    return entry;
+}
+
+DiskCacheEntry::~DiskCacheEntry ()
+{
+    pthread_mutex_lock (& cache_mutex);
+
+    int i = open_entries.find (this);
+    if (i >= 0)
+        open_entries.remove (i, 1);
+
+    bool changed = m_changed;
+    if (changed)
+        save_index ();
+
+    int64_t limit = (int64_t) aud_get_int ("neon", "disk_cache_mb") << 20;
+    bool trim = false;
+
+    if (changed)
+    {
+        if (cache_total >= 0)
+            cache_total += m_added;
+
+        trim = (cache_total < 0 || cache_total > limit);
+    }
+
+    pthread_mutex_unlock (& cache_mutex);
+
+    if (trim)
+        disk_cache_trim ();
+}
+
+bool DiskCacheEntry::load_index ()
+{
+    GKeyFile * key = g_key_file_new ();
+    StringBuf path = str_concat ({m_base, ".idx"});
+
+    if (! g_key_file_load_from_file (key, path, G_KEY_FILE_NONE, nullptr))
+    {
+        g_key_file_free (key);
+        return false;
+    }
+
+    char * url = g_key_file_get_string (key, "entry", "url", nullptr);
+    char * validator = g_key_file_get_string (key, "entry", "validator", nullptr);
+    char * ranges = g_key_file_get_string (key, "entry", "ranges", nullptr);
+
+    m_url = String (url);
+    m_validator = String (validator);
+    m_length = g_key_file_get_int64 (key, "entry", "length", nullptr);
+
+    m_ranges.clear ();
+
+    if (ranges)
+    {
+        for (const String & item : str_list_to_index (ranges, ";"))
+        {
+            int64_t start, end;
+            if (sscanf (item, "%" SCNd64 "-%" SCNd64, & start, & end) == 2 && start < end)
+                add_range (start, end);
+        }
+    }
+
+    g_free (url);
+    g_free (validator);
+    g_free (ranges);
+    g_key_file_free (key);
+
+    return m_url && m_validator;
+}
+
+void DiskCacheEntry::save_index ()
+{
+    GKeyFile * key = g_key_file_new ();
+
+    StringBuf ranges (0);
+    for (const Range & range : m_ranges)
+        str_append_printf (ranges, "%" PRId64 "-%" PRId64 ";", range.start, range.end);
+
+    g_key_file_set_string (key, "entry", "url", m_url);
+    g_key_file_set_string (key, "entry", "validator", m_validator);
+    g_key_file_set_int64 (key, "entry", "length", m_length);
+    g_key_file_set_string (key, "entry", "ranges", ranges);
+
+    size_t len;
+    char * contents = g_key_file_to_data (key, & len, nullptr);
+    StringBuf path = str_concat ({m_base, ".idx"});
+
+    GError * error = nullptr;
+    if (! g_file_set_contents (path, contents, len, & error))
+    {
+        AUDERR ("Failed to write %s: %s\n", (const char *) path, error->message);
+        g_error_free (error);
+    }
+
+    g_free (contents);
+    g_key_file_free (key);
+
+    m_changed = false;
+}
+
+void DiskCacheEntry::add_range (int64_t start, int64_t end)
+{
+    int i = 0;
+
+    /* skip ranges that end before the new one starts */
+    while (i < m_ranges.len () && m_ranges[i].end < start)
+        i ++;
+
+    /* absorb ranges that overlap or touch the new one */
+    while (i < m_ranges.len () && m_ranges[i].start <= end)
+    {
+        start = aud::min (start, m_ranges[i].start);
+        end = aud::max (end, m_ranges[i].end);
+        m_ranges.remove (i, 1);
+    }
+
+    m_ranges.insert (i, 1);
+    m_ranges[i] = {start, end};
+}
+
+int64_t DiskCacheEntry::cached_at (int64_t pos) const
+{
+    for (const Range & range : m_ranges)
+    {
+        if (range.start > pos)
+            break;
+        if (range.end > pos)
+            return range.end - pos;
+    }
+
+    return 0;
+}
+
+int64_t DiskCacheEntry::read (void * ptr, int64_t pos, int64_t len)
+{
+    len = aud::min (len, cached_at (pos));
+
+    if (len <= 0 || m_data.fseek (pos, VFS_SEEK_SET) != 0)
+        return 0;
+
+    return m_data.fread (ptr, 1, len);
+}
+
+void DiskCacheEntry::write (const void * ptr, int64_t pos, int64_t len)
+{
+    len = aud::min (len, m_length - pos);
+
+    if (len <= 0 || cached_at (pos) >= len)
+        return;
+
+    if (m_data.fseek (pos, VFS_SEEK_SET) != 0 || m_data.fwrite (ptr, 1, len) != len)
+    {
+        AUDERR ("Failed to write to cache file for %s\n", (const char *) m_url);
+        return;
+    }
+
+    int64_t before = cached_bytes ();
+    add_range (pos, pos + len);
+    m_added += cached_bytes () - before;
+    m_changed = true;
+}
+
+int64_t DiskCacheEntry::cached_bytes () const
+{
+    int64_t total = 0;
+    for (const Range & range : m_ranges)
+        total += range.end - range.start;
+
+    return total;
+}
+
+struct CacheFile {
+    String base;
+    int64_t size;
+    int64_t mtime;
+    bool in_use;
+};
+
+void disk_cache_trim ()
+{
+    int64_t limit = (int64_t) aud_get_int ("neon", "disk_cache_mb") << 20;
+
+    StringBuf dir = cache_dir ();
+    GDir * handle = g_dir_open (dir, 0, nullptr);
+    if (! handle)
+        return;
+
+    pthread_mutex_lock (& cache_mutex);
+
+    Index<CacheFile> files;
+    int64_t total = 0;
+
+    const char * name;
+    while ((name = g_dir_read_name (handle)))
+    {
+        if (! g_str_has_suffix (name, ".idx"))
+            continue;
+
+        StringBuf base = filename_build ({dir, name});
+        base.resize (base.len () - 4);
+
+        GStatBuf idx_stat, data_stat;
+        if (g_stat (str_concat ({base, ".idx"}), & idx_stat) < 0)
+            continue;
+
+        /* the data files are sparse, so count the blocks actually used */
+        int64_t size = 0;
+        if (g_stat (str_concat ({base, ".data"}), & data_stat) == 0)
+#ifdef _WIN32
+            size = data_stat.st_size;
+#else
+            size = (int64_t) data_stat.st_blocks * 512;
+#endif
+
+        files.append (CacheFile {String (base), size, (int64_t) idx_stat.st_mtime,
+         is_open (base)});
+        total += size;
+    }
+
+    g_dir_close (handle);
+
+    if (total > limit)
+    {
+        int64_t target = limit / 100 * TRIM_TARGET;
+
+        /* oldest first */
+        files.sort ([] (const CacheFile & a, const CacheFile & b)
+            { return (a.mtime > b.mtime) - (a.mtime < b.mtime); });
+
+        for (const CacheFile & file : files)
+        {
+            if (total <= target)
+                break;
+
+            /* open entries count towards the limit, but stay */
+            if (file.in_use)
+                continue;
+
+            AUDDBG ("Evicting %s from cache\n", (const char *) file.base);
+            g_unlink (str_concat ({file.base, ".idx"}));
+            g_unlink (str_concat ({file.base, ".data"}));
+            total -= file.size;
+        }
+    }
+
+    cache_total = total;
+
+    pthread_mutex_unlock (& cache_mutex);
+}
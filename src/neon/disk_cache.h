@@ -0,0 +1,86 @@
+/*
+ *  On-disk byte cache for the neon plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef NEON_DISK_CACHE_H
+#define NEON_DISK_CACHE_H
+
+#include <stdint.h>
+
+#include <libaudcore/index.h>
+#include <libaudcore/objects.h>
+#include <libaudcore/vfs.h>
+
+/* One cached resource.  The bytes received so far are stored at their own
+ * offsets in a sparse data file; a small index file next to it records the
+ * URL, the validator (ETag or Last-Modified) and which byte ranges of the
+ * data file are actually filled in.  Only one entry per resource can be open
+ * at a time in this process, and open entries are never evicted. */
+class DiskCacheEntry
+{
+public:
+    /* Returns nullptr if the cache is disabled or cannot be used, or if the
+     * resource is already open in another entry.  Any cached data with a
+     * different validator or length is thrown away. */
+    static DiskCacheEntry * open (const char * url, const char * validator,
+     int64_t length);
+
+    ~DiskCacheEntry ();
+
+    /* Path of the cache files, without extension */
+    const char * base () const
+        { return m_base; }
+
+    /* Number of bytes cached contiguously starting at <pos> */
+    int64_t cached_at (int64_t pos) const;
+
+    /* Reads up to <len> cached bytes starting at <pos>, returns the number read */
+    int64_t read (void * ptr, int64_t pos, int64_t len);
+
+    /* Stores <len> bytes received from the network at <pos> */
+    void write (const void * ptr, int64_t pos, int64_t len);
+
+private:
+    struct Range {
+        int64_t start, end;
+    };
+
+    DiskCacheEntry (String && base, VFSFile && data) :
+        m_base (std::move (base)),
+        m_data (std::move (data)) {}
+
+    String m_base;
+    VFSFile m_data;
+    String m_url, m_validator;
+    int64_t m_length = -1;
+    Index<Range> m_ranges;  /* sorted, non-overlapping, non-adjacent */
+    int64_t m_added = 0;    /* bytes cached since opening */
+    bool m_changed = false;
+
+    bool load_index ();
+    void save_index ();
+    void add_range (int64_t start, int64_t end);
+    int64_t cached_bytes () const;
+};
+
+/* Measures the cache directory and, if it is over its size limit, removes
+ * the least recently used entries that are not open until it is comfortably
+ * under.  Entries call this when closed, but only when the running estimate
+ * of the cache size says it may be needed. */
+void disk_cache_trim ();
+
+#endif
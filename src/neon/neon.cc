@@ -20,6 +20,7 @@
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
 #include <pthread.h>
+#include <atomic>
 #include <stdint.h>
 #include <string.h>
 
@@ -28,7 +29,7 @@
 #include <libaudcore/audstrings.h>
 #include <libaudcore/i18n.h>
 #include <libaudcore/plugin.h>
-#include <libaudcore/ringbuf.h>
+#include <libaudcore/preferences.h>
 #include <libaudcore/runtime.h>
 
 #include <ne_auth.h>
@@ -40,10 +41,15 @@
 #include <ne_utils.h>
 
 #include "cert_verification.h"
+#include "disk_cache.h"
+#include "spsc_ring.h"
 
-#define NEON_NETBLKSIZE     (4096)
+#define NEON_NETBLKSIZE_MIN (4096)
+#define NEON_NETBLKSIZE_MAX (65536)
 #define NEON_ICY_BUFSIZE    (4096)
 #define NEON_RETRY_COUNT 6
+#define NEON_MAX_IDLE_SESSIONS 8
+#define NEON_RANGE_SIZE (1024 * 1024)  /* bytes per request in read-ahead mode */
 
 enum FillBufferResult {
     FILL_BUFFER_SUCCESS,
@@ -59,24 +65,41 @@ enum neon_reader_t {
     NEON_READER_TERM
 };
 
+/* The data itself is passed through a lock-free ring; the mutex and
+ * condition are only used to put either thread to sleep when the ring is
+ * full or empty, and to hand over status changes. */
 struct reader_status
 {
-    bool reading = false;
-    neon_reader_t status = NEON_READER_INIT;
+    std::atomic<bool> reading {false};
+    std::atomic<neon_reader_t> status {NEON_READER_INIT};
+
+    /* set (under the mutex) while a thread sleeps waiting for the ring */
+    std::atomic<bool> writer_waiting {false};
+    std::atomic<bool> reader_waiting {false};
 
     pthread_mutex_t mutex;
     pthread_cond_t cond;
+    pthread_cond_t fetch_cond;  /* signalled by the range fetch threads */
+
+    void wake ()
+    {
+        pthread_mutex_lock (& mutex);
+        pthread_cond_broadcast (& cond);
+        pthread_mutex_unlock (& mutex);
+    }
 
     reader_status ()
     {
         pthread_mutex_init (& mutex, nullptr);
         pthread_cond_init (& cond, nullptr);
+        pthread_cond_init (& fetch_cond, nullptr);
     }
 
     ~reader_status ()
     {
         pthread_mutex_destroy (& mutex);
         pthread_cond_destroy (& cond);
+        pthread_cond_destroy (& fetch_cond);
     }
 };
 
@@ -89,12 +112,143 @@ struct icy_metadata
     int stream_bitrate = 0;
 };
 
+class NeonFile;
+
+/* A neon session kept alive between requests.  Sessions are shared between
+ * NeonFile instances (and between seeks within one file) so that a new
+ * request to the same server can reuse an open connection, or at least
+ * resume the TLS session, instead of reconnecting from scratch. */
+struct PooledSession
+{
+    String key;                   /* scheme://userinfo@host:port plus proxy settings */
+    ne_session * session = nullptr;
+    NeonFile * owner = nullptr;   /* NeonFile currently using the session */
+};
+
+/* A byte range fetched ahead on a session of its own, by a thread of its own,
+ * while the range before it is still being read; see NeonFile::fill_buffer.
+ * The data is copied into the ringbuffer from here as it arrives. */
+struct RangeFetch
+{
+    NeonFile * file = nullptr;
+    int64_t start = 0, end = 0;   /* end is exclusive */
+    Index<char> data;             /* sized to the range up front */
+    int64_t received = 0;         /* protected by the reader_status mutex */
+    bool done = false;            /* ditto; failed if received is short */
+    std::atomic<bool> cancel {false};
+    pthread_t thread;
+};
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Index<PooledSession *> idle_sessions;
+
+static PooledSession * session_acquire (const char * key)
+{
+    PooledSession * pooled = nullptr;
+
+    pthread_mutex_lock (& pool_mutex);
+
+    /* search from the end so that the most recently used session wins */
+    for (int i = idle_sessions.len () - 1; i >= 0; i --)
+    {
+        if (! strcmp (idle_sessions[i]->key, key))
+        {
+            pooled = idle_sessions[i];
+            idle_sessions.remove (i, 1);
+            break;
+        }
+    }
+
+    pthread_mutex_unlock (& pool_mutex);
+
+    if (pooled)
+        AUDDBG ("Reusing session for %s\n", key);
+
+    return pooled;
+}
+
+static void session_destroy (PooledSession * pooled)
+{
+    ne_session_destroy (pooled->session);
+    delete pooled;
+}
+
+/* Returns a session to the pool.  If the last request was not read to the
+ * end, the connection is closed, but the session (including any cached TLS
+ * session) is still kept for later reuse. */
+static void session_release (PooledSession * pooled, bool clean)
+{
+    if (! clean)
+        ne_close_connection (pooled->session);
+
+    pooled->owner = nullptr;
+
+    PooledSession * evicted = nullptr;
+
+    pthread_mutex_lock (& pool_mutex);
+
+    idle_sessions.append (pooled);
+
+    if (idle_sessions.len () > NEON_MAX_IDLE_SESSIONS)
+    {
+        evicted = idle_sessions[0];
+        idle_sessions.remove (0, 1);
+    }
+
+    pthread_mutex_unlock (& pool_mutex);
+
+    if (evicted)
+        session_destroy (evicted);
+}
+
+static void session_pool_clear ()
+{
+    pthread_mutex_lock (& pool_mutex);
+
+    for (PooledSession * pooled : idle_sessions)
+        session_destroy (pooled);
+
+    idle_sessions.clear ();
+
+    pthread_mutex_unlock (& pool_mutex);
+}
+
 static const char * const neon_schemes[] = {"http", "https"};
 
+static const char * const neon_defaults[] = {
+    "disk_cache", "FALSE",
+    "disk_cache_mb", "1024",
+    "read_ahead", "FALSE",
+    nullptr
+};
+
+static const PreferencesWidget neon_widgets[] = {
+    WidgetLabel (N_("<b>Disk Cache</b>")),
+    WidgetCheck (N_("Keep downloaded streams on disk"),
+        WidgetBool ("neon", "disk_cache")),
+    WidgetSpin (N_("Cache size:"),
+        WidgetInt ("neon", "disk_cache_mb"),
+        {16, 65536, 16, N_("MiB")},
+        WIDGET_CHILD),
+    WidgetLabel (N_("Only servers that report the content length\n"
+                    "and support ranged requests are cached.")),
+    WidgetLabel (N_("<b>Read-ahead</b>")),
+    WidgetCheck (N_("Fetch the next part of seekable streams\n"
+                    "over a second connection"),
+        WidgetBool ("neon", "read_ahead"))
+};
+
+static const PluginPreferences neon_prefs = {{neon_widgets}};
+
 class NeonTransport : public TransportPlugin
 {
 public:
-    static constexpr PluginInfo info = {N_("Neon HTTP/HTTPS Plugin"), PACKAGE};
+    static constexpr PluginInfo info = {
+        N_("Neon HTTP/HTTPS Plugin"),
+        PACKAGE,
+        nullptr,
+        & neon_prefs
+    };
 
     constexpr NeonTransport () : TransportPlugin (info, neon_schemes) {}
 
@@ -108,6 +262,8 @@ EXPORT NeonTransport aud_plugin_instance;
 
 bool NeonTransport::init ()
 {
+    aud_config_set_defaults ("neon", neon_defaults);
+
     int ret = ne_sock_init ();
 
     if (ret != 0)
@@ -121,6 +277,7 @@ bool NeonTransport::init ()
 
 void NeonTransport::cleanup ()
 {
+    session_pool_clear ();
     ne_sock_exit ();
 }
 
@@ -131,6 +288,7 @@ public:
     ~NeonFile ();
 
     int open_handle (int64_t startbyte, String * error = nullptr);
+    void open_cache ();
 
 protected:
     int64_t fread (void * ptr, int64_t size, int64_t nmemb);
@@ -153,6 +311,11 @@ private:
     unsigned char m_redircount = 0;     /* Redirect count for the opened URL */
     int64_t m_pos = 0;                  /* Current position in the stream
                                            (number of last byte delivered to the player) */
+    int64_t m_net_pos = 0;              /* Position of the next byte the network request
+                                           delivers; differs from m_pos after reads
+                                           served from the disk cache */
+    int64_t m_write_pos = 0;            /* Position of the next byte to go into the
+                                           ringbuffer (reader thread) */
     int64_t m_content_start = 0;        /* Start position in the stream */
     int64_t m_content_length = -1;      /* Total content length, counting from
                                            content_start, if known. -1 if unknown */
@@ -164,30 +327,63 @@ private:
 
     bool m_eof = false;
 
-    RingBuf<char> m_rb;           /* Ringbuffer for our data */
+    bool m_read_ahead = false;          /* Request ranges of NEON_RANGE_SIZE and
+                                           fetch the next one ahead */
+    int64_t m_range_start = 0;          /* Range going into the ringbuffer now, */
+    int64_t m_range_end = -1;           /* -1 if not reading in ranges */
+    RangeFetch * m_fetch = nullptr;     /* Fetch the current range comes from, if
+                                           not from m_request */
+    RangeFetch * m_next = nullptr;      /* Fetch of the range after it */
+
+    SpscRing m_rb;                /* Ringbuffer for our data */
+    int m_blksize = NEON_NETBLKSIZE_MIN;  /* Current network block size */
     Index<char> m_icy_buf;        /* Buffer for ICY metadata */
     icy_metadata m_icy_metadata;  /* Current ICY metadata */
+    String m_validator;           /* ETag or Last-Modified header */
+    SmartPtr<DiskCacheEntry> m_cache;
 
+    String m_key;                 /* Pool key of the server, see open_handle () */
+    PooledSession * m_pooled = nullptr;
     ne_session * m_session = nullptr;
     ne_request * m_request = nullptr;
+    bool m_request_done = false;  /* true once the response has been read to the end */
 
     pthread_t m_reader;
     reader_status m_reader_status;
 
     void kill_reader ();
+    void close_handle ();
+    bool skip_buffered (int64_t bytes);
+    bool sync_network ();
     int server_auth (const char * realm, int attempt, char * username, char * password);
     void handle_headers ();
+    PooledSession * get_session (const char * key);
+    ne_request * create_request (ne_session * session, int64_t start, int64_t end);
     int open_request (int64_t startbyte, String * error);
+    RangeFetch * start_fetch (int64_t start);
+    void finish_fetch (RangeFetch * & fetch);
+    void cancel_fetches ();
+    void fetch_range (RangeFetch & fetch);
+    FillBufferResult next_range ();
+    FillBufferResult fill_from_fetch ();
     FillBufferResult fill_buffer ();
     void reader ();
     int64_t try_fread (void * ptr, int64_t size, int64_t nmemb, bool & data_read);
 
+    /* registered once per session, so look up whoever owns it right now */
     static int server_auth_callback (void * data, const char * realm, int attempt,
      char * username, char * password)
-        { return ((NeonFile *) data)->server_auth (realm, attempt, username, password); }
+        { return ((PooledSession *) data)->owner->server_auth (realm, attempt, username, password); }
 
     static void * reader_thread (void * data)
         { ((NeonFile *) data)->reader (); return nullptr; }
+
+    static void * fetch_thread (void * data)
+    {
+        RangeFetch * fetch = (RangeFetch *) data;
+        fetch->file->fetch_range (* fetch);
+        return nullptr;
+    }
 };
 
 NeonFile::NeonFile (const char * url) :
@@ -195,6 +391,8 @@ NeonFile::NeonFile (const char * url) :
 {
     int buffer_kb = aud_get_int (nullptr, "net_buffer_kb");
     m_rb.alloc (1024 * aud::clamp (buffer_kb, 16, 1024));
+
+    m_read_ahead = aud_get_bool ("neon", "read_ahead");
 }
 
 NeonFile::~NeonFile ()
@@ -202,10 +400,8 @@ NeonFile::~NeonFile ()
     if (m_reader_status.reading)
         kill_reader ();
 
-    if (m_request)
-        ne_request_destroy (m_request);
-    if (m_session)
-        ne_session_destroy (m_session);
+    cancel_fetches ();
+    close_handle ();
 
     ne_uri_free (& m_purl);
 }
@@ -324,6 +520,7 @@ void NeonFile::kill_reader ()
     pthread_mutex_lock (& m_reader_status.mutex);
     m_reader_status.reading = false;
     pthread_cond_broadcast (& m_reader_status.cond);
+    pthread_cond_broadcast (& m_reader_status.fetch_cond);
     pthread_mutex_unlock (& m_reader_status.mutex);
 
     AUDDBG ("Waiting for reader thread to die...\n");
@@ -331,6 +528,29 @@ void NeonFile::kill_reader ()
     AUDDBG ("Reader thread has died\n");
 }
 
+/* Destroys the current request and hands the session back to the pool.  The
+ * connection is kept open only if the response was read to the end; after an
+ * error or a partly read response it must not be reused. */
+void NeonFile::close_handle ()
+{
+    bool clean = m_request_done;
+
+    if (m_request)
+    {
+        ne_request_destroy (m_request);
+        m_request = nullptr;
+    }
+
+    if (m_pooled)
+    {
+        session_release (m_pooled, clean);
+        m_pooled = nullptr;
+        m_session = nullptr;
+    }
+
+    m_request_done = false;
+}
+
 int NeonFile::server_auth (const char * realm, int attempt, char * username, char * password)
 {
     if (! m_purl.userinfo || ! m_purl.userinfo[0])
@@ -363,6 +583,7 @@ void NeonFile::handle_headers ()
     const char * name;
     const char * value;
     void * cursor = nullptr;
+    int64_t range_last = -1, range_total = -1;
 
     AUDDBG ("Header responses:\n");
 
@@ -394,6 +615,34 @@ void NeonFile::handle_headers ()
             else
                 AUDERR ("Invalid content length header: %s\n", value);
         }
+        else if (neon_strcmp (name, "content-range"))
+        {
+            /* The part of the content we get: bytes <first>-<last>/<total> */
+            int64_t first, last, total;
+
+            if (sscanf (value, "bytes %" SCNd64 "-%" SCNd64 "/%" SCNd64,
+             & first, & last, & total) == 3 && first == m_content_start &&
+             last >= first && total > last)
+            {
+                AUDDBG ("Content range: %" PRId64 "-%" PRId64 " of %" PRId64 "\n",
+                 first, last, total);
+                range_last = last;
+                range_total = total;
+            }
+            else
+                AUDERR ("Invalid content range header: %s\n", value);
+        }
+        else if (neon_strcmp (name, "etag"))
+        {
+            /* Remember the entity tag to validate cached data */
+            m_validator = String (value);
+        }
+        else if (neon_strcmp (name, "last-modified"))
+        {
+            /* Use the modification time only if there is no entity tag */
+            if (! m_validator)
+                m_validator = String (value);
+        }
         else if (neon_strcmp (name, "content-type"))
         {
             /* The server sent us a content type. Save it for later */
@@ -429,6 +678,17 @@ void NeonFile::handle_headers ()
             m_icy_metadata.stream_bitrate = atoi (value);
         }
     }
+
+    /* For a range with an end (read-ahead mode), the content length is just
+     * that of the range; the total is in the content range. */
+    if (range_total >= 0)
+    {
+        m_content_length = range_total - m_content_start;
+        m_can_ranges = true;
+
+        if (range_last + 1 < range_total && ! m_icy_metaint)
+            m_range_end = range_last + 1;
+    }
 }
 
 static int neon_proxy_auth_cb (void * userdata, const char * realm, int attempt,
@@ -443,24 +703,40 @@ static int neon_proxy_auth_cb (void * userdata, const char * realm, int attempt,
     return attempt;
 }
 
-int NeonFile::open_request (int64_t startbyte, String * error)
+/* Creates a GET request for the URL from <start> up to <end> (exclusive), or
+ * up to the end of the content if <end> is -1 */
+ne_request * NeonFile::create_request (ne_session * session, int64_t start, int64_t end)
 {
-    int ret;
-    const ne_status * status;
-    ne_uri * rediruri;
+    ne_request * request;
 
     if (m_purl.query && * (m_purl.query))
     {
         StringBuf tmp = str_concat ({m_purl.path, "?", m_purl.query});
-        m_request = ne_request_create (m_session, "GET", tmp);
+        request = ne_request_create (session, "GET", tmp);
     }
     else
-        m_request = ne_request_create (m_session, "GET", m_purl.path);
+        request = ne_request_create (session, "GET", m_purl.path);
 
-    if (startbyte > 0)
-        ne_add_request_header (m_request, "Range", str_printf ("bytes=%" PRIu64 "-", startbyte));
+    if (end >= 0)
+        ne_add_request_header (request, "Range", str_printf ("bytes=%" PRIu64 "-%" PRIu64, start, end - 1));
+    else if (start > 0)
+        ne_add_request_header (request, "Range", str_printf ("bytes=%" PRIu64 "-", start));
+
+    ne_add_request_header (request, "Icy-MetaData", "1");
+
+    return request;
+}
+
+int NeonFile::open_request (int64_t startbyte, String * error)
+{
+    int ret;
+    const ne_status * status;
+    ne_uri * rediruri;
 
-    ne_add_request_header (m_request, "Icy-MetaData", "1");
+    /* In read-ahead mode, ask for the first range only; servers that cannot
+     * do ranges send everything anyway. */
+    m_request = create_request (m_session, startbyte,
+     m_read_ahead ? startbyte + NEON_RANGE_SIZE : -1);
 
     /* Try to connect to the server. */
     AUDDBG ("<%p> Connecting...\n", this);
@@ -483,8 +759,10 @@ int NeonFile::open_request (int64_t startbyte, String * error)
         case 302:
         case 303:
         case 307:
-            /* Redirect encountered. Reconnect. */
-            ne_end_request (m_request);
+            /* Redirect encountered.  Read the (usually short) body so that
+             * the connection can be reused for the next request. */
+            m_request_done = (ne_discard_response (m_request) == NE_OK &&
+             ne_end_request (m_request) == NE_OK);
             ret = NE_REDIRECT;
             break;
 
@@ -506,6 +784,10 @@ int NeonFile::open_request (int64_t startbyte, String * error)
             AUDDBG ("<%p> URL opened OK\n", this);
             m_content_start = startbyte;
             m_pos = startbyte;
+            m_net_pos = startbyte;
+            m_write_pos = startbyte;
+            m_range_start = startbyte;
+            m_range_end = -1;
             handle_headers ();
             return 0;
         }
@@ -549,6 +831,61 @@ int NeonFile::open_request (int64_t startbyte, String * error)
     return -1;
 }
 
+/* Takes a session to the server of the current URL from the pool, or creates
+ * one.  Also called from the range fetch threads, which is fine as long as
+ * m_purl does not change while they run. */
+PooledSession * NeonFile::get_session (const char * key)
+{
+    PooledSession * pooled = session_acquire (key);
+
+    if (! pooled)
+    {
+        AUDDBG ("<%p> Creating session to %s://%s:%d\n", this,
+         m_purl.scheme, m_purl.host, m_purl.port);
+
+        pooled = new PooledSession;
+        pooled->key = String (key);
+        pooled->session = ne_session_create (m_purl.scheme,
+         m_purl.host, m_purl.port);
+
+        ne_session * session = pooled->session;
+        ne_redirect_register (session);
+        ne_add_server_auth (session, NE_AUTH_BASIC, server_auth_callback, pooled);
+        ne_set_session_flag (session, NE_SESSFLAG_ICYPROTO, 1);
+        ne_set_session_flag (session, NE_SESSFLAG_PERSIST, 1);
+        ne_set_connect_timeout (session, 10);
+        ne_set_read_timeout (session, 10);
+        ne_set_useragent (session, "Audacious/" PACKAGE_VERSION);
+
+        if (aud_get_bool (nullptr, "use_proxy"))
+        {
+            String proxy_host = aud_get_str (nullptr, "proxy_host");
+            int proxy_port = aud_get_int (nullptr, "proxy_port");
+
+            AUDDBG ("<%p> Using proxy: %s:%d\n", this, (const char *) proxy_host, proxy_port);
+            ne_session_proxy (session, proxy_host, proxy_port);
+
+            if (aud_get_bool (nullptr, "use_proxy_auth"))
+            {
+                AUDDBG ("<%p> Using proxy authentication\n", this);
+                /* the session outlives this file, so no userdata */
+                ne_add_proxy_auth (session, NE_AUTH_BASIC,
+                 neon_proxy_auth_cb, nullptr);
+            }
+        }
+
+        if (! strcmp ("https", m_purl.scheme))
+        {
+            ne_ssl_trust_default_ca (session);
+            ne_ssl_set_verify (session,
+             neon_vfs_verify_environment_ssl_certs, session);
+        }
+    }
+
+    pooled->owner = this;
+    return pooled;
+}
+
 int NeonFile::open_handle (int64_t startbyte, String * error)
 {
     int ret;
@@ -582,37 +919,16 @@ int NeonFile::open_handle (int64_t startbyte, String * error)
         if (! m_purl.port)
             m_purl.port = ne_uri_defaultport (m_purl.scheme);
 
-        AUDDBG ("<%p> Creating session to %s://%s:%d\n", this,
-         m_purl.scheme, m_purl.host, m_purl.port);
-        m_session = ne_session_create (m_purl.scheme,
-         m_purl.host, m_purl.port);
-        ne_redirect_register (m_session);
-        ne_add_server_auth (m_session, NE_AUTH_BASIC, server_auth_callback, this);
-        ne_set_session_flag (m_session, NE_SESSFLAG_ICYPROTO, 1);
-        ne_set_session_flag (m_session, NE_SESSFLAG_PERSIST, 0);
-        ne_set_connect_timeout (m_session, 10);
-        ne_set_read_timeout (m_session, 10);
-        ne_set_useragent (m_session, "Audacious/" PACKAGE_VERSION);
+        StringBuf key = str_printf ("%s://%s@%s:%d", m_purl.scheme,
+         m_purl.userinfo ? m_purl.userinfo : "", m_purl.host, m_purl.port);
 
         if (use_proxy)
-        {
-            AUDDBG ("<%p> Using proxy: %s:%d\n", this, (const char *) proxy_host, proxy_port);
-            ne_session_proxy (m_session, proxy_host, proxy_port);
+            str_append_printf (key, " proxy=%s:%d%s", (const char *) proxy_host,
+             proxy_port, use_proxy_auth ? " auth" : "");
 
-            if (use_proxy_auth)
-            {
-                AUDDBG ("<%p> Using proxy authentication\n", this);
-                ne_add_proxy_auth (m_session, NE_AUTH_BASIC,
-                 neon_proxy_auth_cb, (void *) this);
-            }
-        }
-
-        if (! strcmp ("https", m_purl.scheme))
-        {
-            ne_ssl_trust_default_ca (m_session);
-            ne_ssl_set_verify (m_session,
-             neon_vfs_verify_environment_ssl_certs, m_session);
-        }
+        m_key = String (key);
+        m_pooled = get_session (key);
+        m_session = m_pooled->session;
 
         AUDDBG ("<%p> Creating request\n", this);
         ret = open_request (startbyte, error);
@@ -622,13 +938,18 @@ int NeonFile::open_handle (int64_t startbyte, String * error)
 
         if (ret == -1)
         {
-            ne_session_destroy (m_session);
+            /* don't keep a session around that just failed */
+            session_destroy (m_pooled);
+            m_request_done = false;
+            m_pooled = nullptr;
             m_session = nullptr;
             return -1;
         }
 
         AUDDBG ("<%p> Following redirect...\n", this);
-        ne_session_destroy (m_session);
+        session_release (m_pooled, m_request_done);
+        m_request_done = false;
+        m_pooled = nullptr;
         m_session = nullptr;
     }
 
@@ -640,20 +961,216 @@ int NeonFile::open_handle (int64_t startbyte, String * error)
     return 1;
 }
 
-FillBufferResult NeonFile::fill_buffer ()
+/* Starts fetching the given range ahead, on a session and a thread of its own */
+RangeFetch * NeonFile::start_fetch (int64_t start)
 {
-    char buffer[NEON_NETBLKSIZE];
-    int to_read;
+    RangeFetch * fetch = new RangeFetch;
+    fetch->file = this;
+    fetch->start = start;
+    fetch->end = aud::min (start + NEON_RANGE_SIZE, fsize ());
+    fetch->data.resize (fetch->end - fetch->start);
+
+    AUDDBG ("<%p> Fetching bytes %" PRId64 "-%" PRId64 " ahead\n", this,
+     fetch->start, fetch->end - 1);
+
+    if (pthread_create (& fetch->thread, nullptr, fetch_thread, fetch))
+    {
+        AUDERR ("<%p> Could not start fetch thread\n", this);
+        delete fetch;
+        return nullptr;
+    }
+
+    return fetch;
+}
+
+/* Stops the fetch if it is still running (which may take until the next
+ * block arrives from the network), and frees it */
+void NeonFile::finish_fetch (RangeFetch * & fetch)
+{
+    if (! fetch)
+        return;
+
+    fetch->cancel = true;
+    pthread_join (fetch->thread, nullptr);
+
+    delete fetch;
+    fetch = nullptr;
+}
+
+/* must be called with the reader thread stopped */
+void NeonFile::cancel_fetches ()
+{
+    finish_fetch (m_fetch);
+    finish_fetch (m_next);
+    m_range_end = -1;
+}
+
+/* Body of the fetch threads */
+void NeonFile::fetch_range (RangeFetch & fetch)
+{
+    PooledSession * pooled = get_session (m_key);
+    ne_request * request = create_request (pooled->session, fetch.start, fetch.end);
+
+    int64_t len = fetch.end - fetch.start;
+    int64_t received = 0;
+    bool clean = false;
+
+    int ret = ne_begin_request (request);
+    const ne_status * status = ne_get_status (request);
+
+    if (ret == NE_OK && status->code == 206)
+    {
+        while (received < len && ! fetch.cancel)
+        {
+            int bsize = ne_read_response_block (request, fetch.data.begin () + received,
+             aud::min (len - received, (int64_t) NEON_NETBLKSIZE_MAX));
+
+            if (bsize <= 0)
+                break;
+
+            received += bsize;
+
+            pthread_mutex_lock (& m_reader_status.mutex);
+            fetch.received = received;
+            pthread_cond_broadcast (& m_reader_status.fetch_cond);
+            pthread_mutex_unlock (& m_reader_status.mutex);
+        }
+
+        /* finish the response properly so the connection can be reused */
+        if (received == len)
+            clean = (ne_discard_response (request) == NE_OK &&
+             ne_end_request (request) == NE_OK);
+    }
+
+    if (received < len && ! fetch.cancel)
+    {
+        const char * ne_error = ne_get_error (pooled->session);
+        AUDERR ("<%p> Could not fetch bytes %" PRId64 "-%" PRId64 ": %d (%s)\n",
+         this, fetch.start, fetch.end - 1, status->code, ne_error ? ne_error : "");
+    }
+
+    ne_request_destroy (request);
+    session_release (pooled, clean);
+
+    pthread_mutex_lock (& m_reader_status.mutex);
+    fetch.done = true;
+    pthread_cond_broadcast (& m_reader_status.fetch_cond);
+    pthread_mutex_unlock (& m_reader_status.mutex);
+}
+
+/* Moves on once the current range is all in the ringbuffer: to the range
+ * fetched ahead, or if that has not been started, to a new fetch */
+FillBufferResult NeonFile::next_range ()
+{
+    /* the request made when opening has been read up to the end of its
+     * range; finish it so that its connection goes back to the pool */
+    if (m_request && ! m_request_done)
+        m_request_done = (ne_discard_response (m_request) == NE_OK &&
+         ne_end_request (m_request) == NE_OK);
+
+    close_handle ();
+    finish_fetch (m_fetch);
+
+    if (m_range_end >= fsize ())
+    {
+        AUDDBG ("<%p> End of file encountered\n", this);
+        finish_fetch (m_next);
+        return FILL_BUFFER_EOF;
+    }
+
+    if (! m_next)
+        m_next = start_fetch (m_range_end);
+    if (! m_next)
+        return FILL_BUFFER_ERROR;
+
+    m_fetch = m_next;
+    m_next = nullptr;
+
+    m_range_start = m_fetch->start;
+    m_range_end = m_fetch->end;
+
+    return FILL_BUFFER_SUCCESS;
+}
+
+/* Copies what has arrived of the current range fetch into the ringbuffer,
+ * waiting for more if nothing new has */
+FillBufferResult NeonFile::fill_from_fetch ()
+{
+    int64_t copied = m_write_pos - m_fetch->start;
 
     pthread_mutex_lock (& m_reader_status.mutex);
-    to_read = aud::min (m_rb.space (), NEON_NETBLKSIZE);
+
+    while (m_fetch->received == copied && ! m_fetch->done && m_reader_status.reading)
+        pthread_cond_wait (& m_reader_status.fetch_cond, & m_reader_status.mutex);
+
+    int64_t received = m_fetch->received;
+    bool done = m_fetch->done;
+
     pthread_mutex_unlock (& m_reader_status.mutex);
 
+    if (received == copied)
+        return done ? FILL_BUFFER_ERROR : FILL_BUFFER_SUCCESS;
+
+    int to_copy;
+    char * buffer = m_rb.write_ptr (to_copy);
+    to_copy = aud::min ((int64_t) to_copy, received - copied);
+
+    memcpy (buffer, m_fetch->data.begin () + copied, to_copy);
+    m_rb.commit (to_copy);
+    m_write_pos += to_copy;
+
+    if (m_reader_status.reader_waiting)
+        m_reader_status.wake ();
+
+    return FILL_BUFFER_SUCCESS;
+}
+
+/* In read-ahead mode, the content is requested in ranges of NEON_RANGE_SIZE.
+ * The first range after opening (or seeking) is read from m_request; once
+ * half of it is in the ringbuffer, the next one is fetched on a second
+ * session, so that it is on its way by the time it is needed and the
+ * request latency is hidden.  Each range after the first comes from such a
+ * fetch, and starts the fetch of the one after it in turn. */
+FillBufferResult NeonFile::fill_buffer ()
+{
+    if (m_range_end >= 0)
+    {
+        if (m_write_pos == m_range_end)
+            return next_range ();
+
+        if (! m_next && m_range_end < fsize () &&
+         (m_write_pos - m_range_start) * 2 >= m_range_end - m_range_start)
+            m_next = start_fetch (m_range_end);
+
+        if (m_fetch)
+            return fill_from_fetch ();
+    }
+
+    if (m_request_done)
+        return FILL_BUFFER_EOF;
+
+    if (! m_request)
+        return FILL_BUFFER_ERROR;
+
+    /* Read straight into the free part of the ringbuffer */
+    int to_read;
+    char * buffer = m_rb.write_ptr (to_read);
+    to_read = aud::min (to_read, m_blksize);
+
+    if (m_range_end >= 0)
+        to_read = aud::min ((int64_t) to_read, m_range_end - m_write_pos);
+
     int bsize = ne_read_response_block (m_request, buffer, to_read);
 
     if (! bsize)
     {
         AUDDBG ("<%p> End of file encountered\n", this);
+
+        /* finish the response properly so the connection can be reused */
+        if (ne_end_request (m_request) != NE_OK)
+            ne_close_connection (m_session);
+
+        m_request_done = true;
         return FILL_BUFFER_EOF;
     }
 
@@ -667,37 +1184,39 @@ FillBufferResult NeonFile::fill_buffer ()
 
     AUDDBG ("<%p> Read %d bytes of %d\n", this, bsize, to_read);
 
-    pthread_mutex_lock (& m_reader_status.mutex);
-    m_rb.copy_in (buffer, bsize);
-    pthread_mutex_unlock (& m_reader_status.mutex);
+    m_rb.commit (bsize);
+    m_write_pos += bsize;
+
+    if (m_reader_status.reader_waiting)
+        m_reader_status.wake ();
+
+    /* Adapt the block size to the throughput: if the network keeps up with
+     * full blocks, ask for more at once; if it only trickles, ask for less.
+     * Never take more than a quarter of the ringbuffer in one go. */
+    if (bsize == m_blksize)
+        m_blksize = aud::min (m_blksize * 2, aud::clamp (m_rb.size () / 4,
+         NEON_NETBLKSIZE_MIN, NEON_NETBLKSIZE_MAX));
+    else if (bsize < m_blksize / 2)
+        m_blksize = aud::max (m_blksize / 2, NEON_NETBLKSIZE_MIN);
 
     return FILL_BUFFER_SUCCESS;
 }
 
 void NeonFile::reader ()
 {
-    pthread_mutex_lock (& m_reader_status.mutex);
-
     while (m_reader_status.reading)
     {
-        /* Hit the network only if we have more than NEON_NETBLKSIZE of free buffer */
-        if (m_rb.space () > NEON_NETBLKSIZE)
+        /* Hit the network only if we have more than a block of free buffer */
+        if (m_rb.space () > m_blksize)
         {
-            pthread_mutex_unlock (& m_reader_status.mutex);
-
             FillBufferResult ret = fill_buffer ();
 
-            pthread_mutex_lock (& m_reader_status.mutex);
-
-            /* Wake up main thread if it is waiting. */
-            pthread_cond_broadcast (& m_reader_status.cond);
-
             if (ret == FILL_BUFFER_ERROR)
             {
                 AUDERR ("<%p> Error while reading from the network. "
                         "Terminating reader thread\n", this);
                 m_reader_status.status = NEON_READER_ERROR;
-                pthread_mutex_unlock (& m_reader_status.mutex);
+                m_reader_status.wake ();
                 return;
             }
             else if (ret == FILL_BUFFER_EOF)
@@ -705,7 +1224,7 @@ void NeonFile::reader ()
                 AUDDBG ("<%p> EOF encountered while reading from the network. "
                         "Terminating reader thread\n", this);
                 m_reader_status.status = NEON_READER_EOF;
-                pthread_mutex_unlock (& m_reader_status.mutex);
+                m_reader_status.wake ();
                 return;
             }
         }
@@ -713,13 +1232,19 @@ void NeonFile::reader ()
         {
             /* Not enough free space in the buffer.
              * Sleep until the main thread wakes us up. */
-            pthread_cond_wait (& m_reader_status.cond, & m_reader_status.mutex);
+            pthread_mutex_lock (& m_reader_status.mutex);
+            m_reader_status.writer_waiting = true;
+
+            if (m_reader_status.reading && m_rb.space () <= m_blksize)
+                pthread_cond_wait (& m_reader_status.cond, & m_reader_status.mutex);
+
+            m_reader_status.writer_waiting = false;
+            pthread_mutex_unlock (& m_reader_status.mutex);
         }
     }
 
     AUDDBG ("<%p> Reader thread terminating gracefully\n", this);
     m_reader_status.status = NEON_READER_TERM;
-    pthread_mutex_unlock (& m_reader_status.mutex);
 }
 
 VFSImpl * NeonTransport::fopen (const char * path, const char * mode, String & error)
@@ -735,34 +1260,80 @@ VFSImpl * NeonTransport::fopen (const char * path, const char * mode, String & e
         return nullptr;
     }
 
+    file->open_cache ();
+
     return file;
 }
 
+/* Attaches a disk cache entry, if caching is enabled and the stream can be
+ * cached at all.  Missing parts are fetched with ranged requests, so the
+ * server has to support those and tell us the length up front. */
+void NeonFile::open_cache ()
+{
+    if (m_icy_metaint || ! m_can_ranges || m_content_length <= 0)
+        return;
+
+    /* without a validator, the length is the best we can do */
+    StringBuf validator = m_validator ? str_copy (m_validator) :
+     str_printf ("length=%" PRId64, m_content_length);
+
+    m_cache.capture (DiskCacheEntry::open (m_url, validator, m_content_length));
+}
+
 int64_t NeonFile::try_fread (void * ptr, int64_t size, int64_t nmemb, bool & data_read)
 {
-    if (! m_request)
-    {
-        AUDERR ("<%p> No request to read from, seek gone wrong?\n", this);
+    if (! size || ! nmemb || m_eof)
         return 0;
+
+    /* Serve as much as we can from the disk cache */
+    if (m_cache)
+    {
+        int64_t cached = aud::min (m_cache->cached_at (m_pos) / size, nmemb);
+
+        if (cached > 0 && m_cache->read (ptr, m_pos, cached * size) == cached * size)
+        {
+            data_read = true;
+            m_pos += cached * size;
+
+            if (m_pos >= fsize ())
+                m_eof = true;
+
+            return cached;
+        }
+
+        /* Not cached; make sure the network picks up where we are */
+        if (! sync_network ())
+        {
+            AUDERR ("<%p> Error while creating new request!\n", this);
+            return 0;
+        }
     }
 
-    if (! size || ! nmemb || m_eof)
+    if (m_net_pos < 0)
+    {
+        AUDERR ("<%p> No request to read from, seek gone wrong?\n", this);
         return 0;
+    }
 
     /* If the buffer is empty, wait for the reader thread to fill it. */
-    pthread_mutex_lock (& m_reader_status.mutex);
-
-    for (int retries = 0; retries < NEON_RETRY_COUNT; retries ++)
+    if (m_rb.len () / size == 0 && m_reader_status.reading)
     {
-        if (m_rb.len () / size > 0 || ! m_reader_status.reading ||
-         m_reader_status.status != NEON_READER_RUN)
-            break;
+        pthread_mutex_lock (& m_reader_status.mutex);
+        m_reader_status.reader_waiting = true;
 
-        pthread_cond_broadcast (& m_reader_status.cond);
-        pthread_cond_wait (& m_reader_status.cond, & m_reader_status.mutex);
-    }
+        for (int retries = 0; retries < NEON_RETRY_COUNT; retries ++)
+        {
+            if (m_rb.len () / size > 0 || ! m_reader_status.reading ||
+             m_reader_status.status != NEON_READER_RUN)
+                break;
 
-    pthread_mutex_unlock (& m_reader_status.mutex);
+            pthread_cond_broadcast (& m_reader_status.cond);
+            pthread_cond_wait (& m_reader_status.cond, & m_reader_status.mutex);
+        }
+
+        m_reader_status.reader_waiting = false;
+        pthread_mutex_unlock (& m_reader_status.mutex);
+    }
 
     if (! m_reader_status.reading)
     {
@@ -783,14 +1354,12 @@ int64_t NeonFile::try_fread (void * ptr, int64_t size, int64_t nmemb, bool & dat
             /* We have some data in the buffer now.
              * Start the reader thread if we did not reach EOF during
              * the initial fill */
-            pthread_mutex_lock (& m_reader_status.mutex);
-
             if (ret == FILL_BUFFER_SUCCESS)
             {
                 m_reader_status.reading = true;
+                m_reader_status.status = NEON_READER_RUN;
                 AUDDBG ("<%p> Starting reader thread\n", this);
                 pthread_create (& m_reader, nullptr, reader_thread, this);
-                m_reader_status.status = NEON_READER_RUN;
             }
             else if (ret == FILL_BUFFER_EOF)
             {
@@ -798,15 +1367,11 @@ int64_t NeonFile::try_fread (void * ptr, int64_t size, int64_t nmemb, bool & dat
                 m_reader_status.reading = false;
                 m_reader_status.status = NEON_READER_EOF;
             }
-
-            pthread_mutex_unlock (& m_reader_status.mutex);
         }
     }
     else
     {
         /* There already is a reader thread. Look if it is in good shape. */
-        pthread_mutex_lock (& m_reader_status.mutex);
-
         switch (m_reader_status.status)
         {
         case NEON_READER_INIT:
@@ -819,20 +1384,16 @@ int64_t NeonFile::try_fread (void * ptr, int64_t size, int64_t nmemb, bool & dat
              * condition, by falling through to the NEON_READER_EOF codepath. */
             AUDDBG ("<%p> NEON_READER_ERROR happened. Terminating reader thread and marking EOF.\n", this);
             m_reader_status.status = NEON_READER_EOF;
-            pthread_mutex_unlock (& m_reader_status.mutex);
 
             if (m_reader_status.reading)
                 kill_reader ();
 
-            pthread_mutex_lock (& m_reader_status.mutex);
-
         case NEON_READER_EOF:
             /* If there still is data in the buffer, carry on.
              * If not, terminate the reader thread and return 0. */
             if (! m_rb.len ())
             {
                 AUDDBG ("<%p> Reached end of stream\n", this);
-                pthread_mutex_unlock (& m_reader_status.mutex);
 
                 if (m_reader_status.reading)
                     kill_reader ();
@@ -847,23 +1408,18 @@ int64_t NeonFile::try_fread (void * ptr, int64_t size, int64_t nmemb, bool & dat
             /* The reader thread terminated gracefully, most likely on our own request.
              * We should not get here. */
             g_warn_if_reached ();
-            pthread_mutex_unlock (& m_reader_status.mutex);
             return 0;
         }
-
-        pthread_mutex_unlock (& m_reader_status.mutex);
     }
 
-    /* Deliver data from the buffer */
-    pthread_mutex_lock (& m_reader_status.mutex);
-
+    /* Deliver data from the buffer.  No lock is needed for this; the
+     * reader thread only ever appends to the ringbuffer. */
     if (m_rb.len ())
         data_read = true;
     else
     {
         /* The buffer is still empty, we can deliver no data! */
         AUDERR ("<%p> Buffer still underrun, fatal.\n", this);
-        pthread_mutex_unlock (& m_reader_status.mutex);
         return 0;
     }
 
@@ -878,13 +1434,17 @@ int64_t NeonFile::try_fread (void * ptr, int64_t size, int64_t nmemb, bool & dat
                 /* The next data in the buffer is a ICY metadata announcement.
                  * Get the length byte */
                 m_icy_len = 16 * (unsigned char) m_rb.head ();
-                m_rb.pop ();
+                m_rb.consume (1);
 
                 AUDDBG ("<%p> Expecting %d bytes of ICY metadata\n", this, m_icy_len);
             }
 
             if (m_icy_buf.len () < m_icy_len)
-                m_rb.move_out (m_icy_buf, -1, aud::min (m_icy_len - m_icy_buf.len (), m_rb.len ()));
+            {
+                int to_copy = aud::min (m_icy_len - m_icy_buf.len (), m_rb.len ());
+                m_icy_buf.insert (-1, to_copy);
+                m_rb.read (m_icy_buf.end () - to_copy, to_copy);
+            }
 
             if (m_icy_buf.len () >= m_icy_len)
             {
@@ -904,7 +1464,10 @@ int64_t NeonFile::try_fread (void * ptr, int64_t size, int64_t nmemb, bool & dat
     }
 
     nmemb = aud::min (belem, nmemb);
-    m_rb.move_out ((char *) ptr, nmemb * size);
+    m_rb.read ((char *) ptr, nmemb * size);
+
+    if (m_cache)
+        m_cache->write (ptr, m_pos, nmemb * size);
 
     /* Signal the network thread to continue reading */
     if (m_reader_status.status == NEON_READER_EOF)
@@ -915,12 +1478,11 @@ int64_t NeonFile::try_fread (void * ptr, int64_t size, int64_t nmemb, bool & dat
             m_eof = true;
         }
     }
-    else
-        pthread_cond_broadcast (& m_reader_status.cond);
-
-    pthread_mutex_unlock (& m_reader_status.mutex);
+    else if (m_reader_status.writer_waiting)
+        m_reader_status.wake ();
 
     m_pos += nmemb * size;
+    m_net_pos += nmemb * size;
     m_icy_metaleft -= nmemb * size;
 
     return nmemb;
@@ -1044,41 +1606,84 @@ int NeonFile::fseek (int64_t offset, VFSSeekType whence)
     if (newpos == m_pos)
         return 0;
 
-    /* To seek to the new position we have to
+    int64_t oldpos = m_pos;
+    bool oldeof = m_eof;
+
+    m_pos = newpos;
+    m_eof = false;
+
+    /* If the new position is in the disk cache, the network request is
+     * only repositioned once we read past the cached data. */
+    if (m_cache && m_cache->cached_at (newpos))
+        return 0;
+
+    if (! sync_network ())
+    {
+        AUDERR ("<%p> Error while creating new request!\n", this);
+
+        /* a failed seek leaves the position where it was */
+        m_pos = oldpos;
+        m_eof = oldeof;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Brings the network request to the current read position. */
+bool NeonFile::sync_network ()
+{
+    if (m_net_pos == m_pos)
+        return true;
+
+    /* A short forward seek can often be served from data already read ahead
+     * into the ringbuffer, without touching the network at all. */
+    if (m_pos > m_net_pos && skip_buffered (m_pos - m_net_pos))
+        return true;
+
+    /* Otherwise we have to
      * - stop the current reader thread, if there is one
-     * - destroy the current request
+     * - destroy the current request and return the session to the pool
      * - dump all data currently in the ringbuffer
-     * - create a new request starting at newpos */
+     * - create a new request starting at m_pos */
     if (m_reader_status.reading)
         kill_reader ();
 
-    if (m_request)
-    {
-        ne_request_destroy (m_request);
-        m_request = nullptr;
-    }
-
-    if (m_session)
-    {
-        ne_session_destroy (m_session);
-        m_session = nullptr;
-    }
+    cancel_fetches ();
+    close_handle ();
 
-    m_rb.discard ();
+    m_rb.reset ();
     m_icy_buf.clear ();
     m_icy_len = 0;
 
-    if (open_handle (newpos) != 0)
-    {
-        AUDERR ("<%p> Error while creating new request!\n", this);
-        return -1;
-    }
+    /* nothing is on the way from the network until the new request is
+     * open, so that a later sync_network () tries again if this one fails */
+    m_net_pos = -1;
 
-    /* Things seem to have worked. The next read request will start
-     * the reader thread again. */
-    m_eof = false;
+    /* Things seem to have worked if this succeeds. The next read request
+     * will start the reader thread again. */
+    return open_handle (m_pos) == 0;
+}
 
-    return 0;
+/* Drops the given number of bytes from the ringbuffer, provided they have
+ * all been buffered already.  ICY streams are not seekable anyway, so the
+ * metadata countdown is not taken into account here. */
+bool NeonFile::skip_buffered (int64_t bytes)
+{
+    if (m_icy_metaint)
+        return false;
+
+    if (bytes > m_rb.len ())
+        return false;
+
+    AUDDBG ("<%p> Skipping %" PRId64 " buffered bytes\n", this, bytes);
+    m_rb.consume (bytes);
+
+    if (m_reader_status.writer_waiting)
+        m_reader_status.wake ();
+
+    m_net_pos += bytes;
+    return true;
 }
 
 String NeonFile::get_metadata (const char * field)
@@ -0,0 +1,114 @@
+/*
+ *  Single-producer/single-consumer byte ring for the neon plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef NEON_SPSC_RING_H
+#define NEON_SPSC_RING_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+
+#include <libaudcore/index.h>
+
+/* A ring buffer shared by exactly one writer thread (the network reader)
+ * and one reader thread (the decoder).  The read and write positions are
+ * free-running counters, so neither side ever needs a lock to move data.
+ * The writer fills the buffer in place through write_ptr()/commit(), the
+ * reader empties it through read_ptr()/consume() or read(). */
+class SpscRing
+{
+public:
+    /* not thread-safe; call before the writer thread is started */
+    void alloc (int size)
+    {
+        m_buf.resize (size);
+        reset ();
+    }
+
+    /* not thread-safe; call only while the writer thread is stopped */
+    void reset ()
+    {
+        m_read.store (0);
+        m_write.store (0);
+    }
+
+    int size () const
+        { return m_buf.len (); }
+    int len () const
+        { return m_write.load () - m_read.load (); }
+    int space () const
+        { return size () - len (); }
+
+    /* writer side: returns the largest contiguous free region */
+    char * write_ptr (int & avail)
+    {
+        int64_t write = m_write.load (std::memory_order_relaxed);
+        int offset = write % size ();
+        avail = aud::min (size () - offset, space ());
+        return m_buf.begin () + offset;
+    }
+
+    /* writer side: publishes bytes written through write_ptr() */
+    void commit (int bytes)
+        { m_write.fetch_add (bytes); }
+
+    /* reader side: returns the largest contiguous filled region */
+    const char * read_ptr (int & avail) const
+    {
+        int64_t read = m_read.load (std::memory_order_relaxed);
+        int offset = read % size ();
+        avail = aud::min (size () - offset, len ());
+        return m_buf.begin () + offset;
+    }
+
+    /* reader side: releases bytes back to the writer */
+    void consume (int bytes)
+        { m_read.fetch_add (bytes); }
+
+    /* reader side: the first byte in the buffer (which must not be empty) */
+    char head () const
+        { return m_buf[m_read.load (std::memory_order_relaxed) % size ()]; }
+
+    /* reader side: copies out and consumes up to <bytes> bytes */
+    int read (char * dest, int bytes)
+    {
+        int done = 0;
+
+        while (done < bytes)
+        {
+            int avail;
+            const char * src = read_ptr (avail);
+            int part = aud::min (avail, bytes - done);
+
+            if (! part)
+                break;
+
+            memcpy (dest + done, src, part);
+            consume (part);
+            done += part;
+        }
+
+        return done;
+    }
+
+private:
+    Index<char> m_buf;
+    std::atomic<int64_t> m_read {0}, m_write {0};
+};
+
+#endif
@@ -0,0 +1,282 @@
+/*
+ * Polyphase Resampler for Audacious
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "polyphase.h"
+
+#include <math.h>
+
+#include <libaudcore/runtime.h>
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+
+/* Filter design: pass band up to 45% of the lower sample rate, stop band
+ * from 50%, 100 dB attenuation (comparable to libsamplerate's medium sinc) */
+#define PASS_BAND 0.45
+#define STOP_BAND 0.5
+#define ATTENUATION 100.0
+
+#define MAX_UP 1024
+#define MAX_COEFS (1 << 20)
+#define COMPACT_MIN 4096  /* frames of history dropped at once, at least */
+
+/* Inner loop: dot product of filter taps and input history.  As in the
+ * compressor plugin, SSE2 and AVX2 versions are picked at runtime on x86. */
+
+static float dot_scalar (const float * a, const float * b, int len)
+{
+    float sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+    int i = 0;
+
+    for (; i + 4 <= len; i += 4)
+    {
+        sum0 += a[i] * b[i];
+        sum1 += a[i + 1] * b[i + 1];
+        sum2 += a[i + 2] * b[i + 2];
+        sum3 += a[i + 3] * b[i + 3];
+    }
+
+    for (; i < len; i ++)
+        sum0 += a[i] * b[i];
+
+    return (sum0 + sum1) + (sum2 + sum3);
+}
+
+#ifdef HAVE_X86_KERNELS
+
+__attribute__ ((target ("sse2")))
+static float dot_sse2 (const float * a, const float * b, int len)
+{
+    __m128 sum0 = _mm_setzero_ps (), sum1 = _mm_setzero_ps ();
+    int i = 0;
+
+    for (; i + 8 <= len; i += 8)
+    {
+        sum0 = _mm_add_ps (sum0, _mm_mul_ps (_mm_loadu_ps (a + i), _mm_loadu_ps (b + i)));
+        sum1 = _mm_add_ps (sum1, _mm_mul_ps (_mm_loadu_ps (a + i + 4), _mm_loadu_ps (b + i + 4)));
+    }
+
+    float part[4];
+    _mm_storeu_ps (part, _mm_add_ps (sum0, sum1));
+
+    return part[0] + part[1] + part[2] + part[3] + dot_scalar (a + i, b + i, len - i);
+}
+
+__attribute__ ((target ("avx2")))
+static float dot_avx2 (const float * a, const float * b, int len)
+{
+    __m256 sum0 = _mm256_setzero_ps (), sum1 = _mm256_setzero_ps ();
+    int i = 0;
+
+    for (; i + 16 <= len; i += 16)
+    {
+        sum0 = _mm256_add_ps (sum0, _mm256_mul_ps (_mm256_loadu_ps (a + i), _mm256_loadu_ps (b + i)));
+        sum1 = _mm256_add_ps (sum1, _mm256_mul_ps (_mm256_loadu_ps (a + i + 8), _mm256_loadu_ps (b + i + 8)));
+    }
+
+    float part[8];
+    _mm256_storeu_ps (part, _mm256_add_ps (sum0, sum1));
+
+    float sum = 0;
+    for (float p : part)
+        sum += p;
+
+    return sum + dot_scalar (a + i, b + i, len - i);
+}
+
+#endif /* HAVE_X86_KERNELS */
+
+static float (* dot) (const float * a, const float * b, int len) = dot_scalar;
+
+static void select_kernels ()
+{
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init ();
+
+    if (__builtin_cpu_supports ("avx2"))
+        dot = dot_avx2;
+    else if (__builtin_cpu_supports ("sse2"))
+        dot = dot_sse2;
+#endif
+}
+
+static int gcd (int a, int b)
+{
+    while (b)
+    {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+/* zeroth-order modified Bessel function of the first kind */
+static double bessel_i0 (double x)
+{
+    double sum = 1, term = 1;
+
+    for (int k = 1; k < 50 && term > sum * 1e-12; k ++)
+    {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+
+    return sum;
+}
+
+bool PolyphaseResampler::start (int channels, int in_rate, int out_rate)
+{
+    int g = gcd (in_rate, out_rate);
+    int up = out_rate / g;
+    int down = in_rate / g;
+
+    /* Kaiser's estimate of the filter length, with the transition band
+     * expressed relative to the input rate */
+    double min_rate = aud::min (in_rate, out_rate);
+    double transition = (STOP_BAND - PASS_BAND) * min_rate / in_rate;
+    int taps = (int) ceil ((ATTENUATION - 8) / (2.285 * 2 * M_PI * transition));
+    taps = (taps + 7) & ~7;
+
+    if (up > MAX_UP || (int64_t) up * taps > MAX_COEFS)
+    {
+        AUDDBG ("Ratio %d/%d is not suitable for polyphase resampling.\n", up, down);
+        return false;
+    }
+
+    select_kernels ();
+
+    m_channels = channels;
+    m_up = up;
+    m_down = down;
+    m_taps = taps;
+
+    /* Windowed sinc at the upsampled rate.  Phase p holds taps p, p + L,
+     * p + 2L, ... in reverse, so that it lines up with the history in memory
+     * (oldest sample first).  The gain of L makes up for the zeros that the
+     * upsampling would have inserted. */
+    int len = up * taps;
+    int center = (len - 1) / 2;
+    double cutoff = (PASS_BAND + STOP_BAND) / 2 * min_rate / ((double) in_rate * up);
+    double beta = 0.1102 * (ATTENUATION - 8.7);
+    double norm = bessel_i0 (beta);
+
+    m_coefs.resize (len);
+
+    for (int n = 0; n < len; n ++)
+    {
+        double x = n - center;
+        double r = x / (len / 2.0);
+        double window = (fabs (r) < 1) ? bessel_i0 (beta * sqrt (1 - r * r)) / norm : 0;
+        double sinc = x ? sin (2 * M_PI * cutoff * x) / (M_PI * x) : 2 * cutoff;
+
+        int phase = n % up;
+        int tap = n / up;
+        m_coefs[phase * taps + (taps - 1 - tap)] = sinc * window * up;
+    }
+
+    m_history.resize (channels);
+
+    AUDDBG ("Polyphase resampler: %d/%d, %d taps per phase.\n", up, down, taps);
+
+    reset ();
+    return true;
+}
+
+void PolyphaseResampler::reset ()
+{
+    for (Index<float> & history : m_history)
+    {
+        history.resize (0);
+        history.insert (0, m_taps - 1);
+    }
+
+    /* Output n is centered at input frame n * M / L.  Counting from the start
+     * of the history, that is offset by the silence in front and by the delay
+     * of the filter itself. */
+    m_pos = (int64_t) (m_taps - 1) * m_up + (m_up * m_taps - 1) / 2;
+    m_in_total = m_out_total = 0;
+}
+
+void PolyphaseResampler::process (const float * in, int frames, Index<float> & out, bool finish)
+{
+    /* de-interleave into the histories */
+    for (int c = 0; c < m_channels; c ++)
+    {
+        Index<float> & history = m_history[c];
+        int old = history.len ();
+
+        history.insert (-1, frames + (finish ? m_taps : 0));
+
+        float * dest = & history[old];
+        for (int f = 0; f < frames; f ++)
+            dest[f] = in[f * m_channels + c];
+    }
+
+    m_in_total += frames;
+
+    /* produce every output for which all taps are available */
+    int64_t len = m_history[0].len ();
+    int64_t count = aud::max ((int64_t) 0, (len * m_up - m_pos + m_down - 1) / m_down);
+
+    /* when finishing, stop where the input ends, not after the padding */
+    if (finish)
+    {
+        int64_t total = (m_in_total * m_up + m_down - 1) / m_down;
+        count = aud::min (count, total - m_out_total);
+    }
+
+    out.resize (count * m_channels);
+    float * dest = out.begin ();
+
+    for (int64_t n = 0; n < count; n ++)
+    {
+        int64_t pos = m_pos + n * m_down;
+        int64_t frame = pos / m_up;
+        const float * coefs = & m_coefs[(pos % m_up) * m_taps];
+
+        for (int c = 0; c < m_channels; c ++)
+            * dest ++ = dot (coefs, & m_history[c][frame - (m_taps - 1)], m_taps);
+    }
+
+    m_pos += count * m_down;
+    m_out_total += count;
+
+    if (finish)
+    {
+        reset ();
+        return;
+    }
+
+    /* Drop history that no future output will need, but only once there is
+     * at least as much of it as is still needed, so that the samples kept are
+     * moved now and then rather than on every call. */
+    int64_t drop = m_pos / m_up - (m_taps - 1);
+    int64_t keep = len - drop;
+
+    if (drop >= COMPACT_MIN && drop >= keep)
+    {
+        for (Index<float> & history : m_history)
+            history.remove (0, drop);
+
+        m_pos -= drop * m_up;
+    }
+}
@@ -0,0 +1,59 @@
+/*
+ * Polyphase Resampler for Audacious
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef RESAMPLE_POLYPHASE_H
+#define RESAMPLE_POLYPHASE_H
+
+#include <stdint.h>
+
+#include <libaudcore/index.h>
+
+/* Converts between two sample rates whose ratio reduces to a fraction L/M
+ * with a small L (44100 -> 48000 is 160/147).  The input is conceptually
+ * upsampled by L, low-pass filtered and downsampled by M; only the filter
+ * taps that line up with real input samples are evaluated, so each output
+ * sample costs one dot product per channel.  The coefficients for all L
+ * phases are computed in start(). */
+class PolyphaseResampler
+{
+public:
+    /* returns false if the ratio is not a small enough fraction */
+    bool start (int channels, int in_rate, int out_rate);
+    void reset ();
+
+    /* Replaces the contents of <out> with the converted audio.  <out> is
+     * only ever enlarged, so a persistent buffer stops being reallocated
+     * once it has reached its working size. */
+    void process (const float * in, int frames, Index<float> & out, bool finish);
+
+private:
+    int m_channels = 0;
+    int m_up = 0, m_down = 0;   /* L and M */
+    int m_taps = 0;             /* per phase */
+    Index<float> m_coefs;       /* m_up phases of m_taps, in dot product order */
+
+    /* one contiguous history per channel, starting at least m_taps - 1
+     * frames before the oldest sample still needed; the frames before that
+     * are dropped in bulk (see process()) */
+    Index<Index<float>> m_history;
+
+    int64_t m_pos = 0;          /* of the next output, in upsampled frames */
+    int64_t m_in_total = 0, m_out_total = 0;
+};
+
+#endif
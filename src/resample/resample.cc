@@ -25,10 +25,15 @@
 #include <libaudcore/preferences.h>
 #include <libaudcore/audstrings.h>
 
+#include "polyphase.h"
+
 #define MIN_RATE 8000
 #define MAX_RATE 192000
 #define RATE_STEP 50
 
+/* not a libsamplerate converter type; see polyphase.h */
+#define METHOD_POLYPHASE 100
+
 #define RESAMPLE_ERROR(e) AUDERR ("%s\n", src_strerror (e))
 
 class Resampler : public EffectPlugin
@@ -87,6 +92,9 @@ static int stored_channels;
 static double ratio;
 static Index<float> buffer;
 
+static PolyphaseResampler polyphase;
+static bool use_polyphase;
+
 bool Resampler::init ()
 {
     aud_config_set_defaults ("resample", defaults);
@@ -102,6 +110,7 @@ void Resampler::cleanup ()
     }
 
     buffer.clear ();
+    polyphase = PolyphaseResampler ();
 }
 
 void Resampler::start (int & channels, int & rate)
@@ -112,6 +121,8 @@ void Resampler::start (int & channels, int & rate)
         state = nullptr;
     }
 
+    use_polyphase = false;
+
     int new_rate = 0;
 
     if (aud_get_bool ("resample", "use-mappings"))
@@ -128,6 +139,20 @@ void Resampler::start (int & channels, int & rate)
     int method = aud_get_int ("resample", "method");
     int error;
 
+    if (method == METHOD_POLYPHASE)
+    {
+        if (polyphase.start (channels, rate, new_rate))
+        {
+            use_polyphase = true;
+            stored_channels = channels;
+            rate = new_rate;
+            return;
+        }
+
+        /* fall back to a comparable libsamplerate converter */
+        method = SRC_SINC_MEDIUM_QUALITY;
+    }
+
     if ((state = src_new (method, channels, & error)) == nullptr)
     {
         RESAMPLE_ERROR (error);
@@ -141,6 +166,12 @@ void Resampler::start (int & channels, int & rate)
 
 Index<float> & Resampler::resample (Index<float> & data, bool finish)
 {
+    if (use_polyphase)
+    {
+        polyphase.process (data.begin (), data.len () / stored_channels, buffer, finish);
+        return buffer;
+    }
+
     if (! state || ! data.len ())
         return data;
 
@@ -172,6 +203,9 @@ Index<float> & Resampler::resample (Index<float> & data, bool finish)
 
 bool Resampler::flush (bool force)
 {
+    if (use_polyphase)
+        polyphase.reset ();
+
     int error;
     if (state && (error = src_reset (state)))
         RESAMPLE_ERROR (error);
@@ -188,7 +222,8 @@ static const ComboItem method_list[] = {
     ComboItem(N_("Linear interpolation"), SRC_LINEAR),
     ComboItem(N_("Fast sinc interpolation"), SRC_SINC_FASTEST),
     ComboItem(N_("Medium sinc interpolation"), SRC_SINC_MEDIUM_QUALITY),
-    ComboItem(N_("Best sinc interpolation"), SRC_SINC_BEST_QUALITY)
+    ComboItem(N_("Best sinc interpolation"), SRC_SINC_BEST_QUALITY),
+    ComboItem(N_("Polyphase filter (fixed ratios)"), METHOD_POLYPHASE)
 };
 
 const PreferencesWidget Resampler::widgets[] = {
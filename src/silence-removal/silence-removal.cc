@@ -25,6 +25,12 @@
 
 #include <math.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "../effect-common/effect-params.h"
+
 #define MAX_BUFFER_SECS  10
 
 class SilenceRemoval : public EffectPlugin
@@ -60,26 +66,56 @@ const char SilenceRemoval::about[] =
 
 const char * const SilenceRemoval::defaults[] = {
     "threshold", "-40",
+    "rms", "FALSE",
+    "rms_window", "20",
     nullptr
 };
 
+struct SilenceSettings {
+    float threshold;  /* linear amplitude */
+    bool rms;
+    int rms_window;   /* ms */
+};
+
+/* published when changed in the UI */
+static EffectParams<SilenceSettings> params;
+static SilenceSettings settings;
+
+static void update_config ()
+{
+    int threshold_db = aud_get_int ("silence-removal", "threshold");
+
+    params.publish ({
+        powf (10.0f, threshold_db / 20.0f),
+        aud_get_bool ("silence-removal", "rms"),
+        aud_get_int ("silence-removal", "rms_window")
+    });
+}
+
 const PreferencesWidget SilenceRemoval::widgets[] = {
     WidgetLabel (N_("<b>Silence Removal</b>")),
     WidgetSpin (N_("Threshold:"),
-        WidgetInt ("silence-removal", "threshold"),
-        {-60, -20, 1, N_("dB")})
+        WidgetInt ("silence-removal", "threshold", update_config),
+        {-60, -20, 1, N_("dB")}),
+    WidgetCheck (N_("Compare RMS level (ignores short clicks)"),
+        WidgetBool ("silence-removal", "rms", update_config)),
+    WidgetSpin (N_("RMS window:"),
+        WidgetInt ("silence-removal", "rms_window", update_config),
+        {5, 500, 5, N_("ms")},
+        WIDGET_CHILD)
 };
 
 const PluginPreferences SilenceRemoval::prefs = {{widgets}};
 
 static RingBuf<float> buffer;
 static Index<float> output;
-static int current_channels;
+static int current_channels, current_rate;
 static bool initial_silence;
 
 bool SilenceRemoval::init ()
 {
     aud_config_set_defaults ("silence-removal", defaults);
+    update_config ();
     return true;
 }
 
@@ -96,19 +132,135 @@ void SilenceRemoval::start (int & channels, int & rate)
     output.resize (0);
 
     current_channels = channels;
+    current_rate = rate;
     initial_silence = true;
 }
 
-static float * align_to_frame (float * begin, float * sample, bool align_to_end)
+/* Index of the first sample louder than the threshold, or -1.  The scans
+ * below run from opposite ends, so that each stops as soon as it finds a
+ * loud sample; for music, both usually stop within the first few samples. */
+static int find_first (const float * data, int len, float threshold)
+{
+    int i = 0;
+
+#ifdef __SSE2__
+    const __m128 abs_mask = _mm_castsi128_ps (_mm_set1_epi32 (0x7fffffff));
+    const __m128 thresh = _mm_set1_ps (threshold);
+
+    for (; i + 4 <= len; i += 4)
+    {
+        __m128 x = _mm_and_ps (_mm_loadu_ps (data + i), abs_mask);
+        int loud = _mm_movemask_ps (_mm_cmpgt_ps (x, thresh));
+
+        if (loud)
+            return i + __builtin_ctz (loud);
+    }
+#endif
+
+    for (; i < len; i ++)
+    {
+        if (fabsf (data[i]) > threshold)
+            return i;
+    }
+
+    return -1;
+}
+
+/* index of the last sample louder than the threshold, or -1 */
+static int find_last (const float * data, int len, float threshold)
 {
-    if (! sample)
-        return nullptr;
+    int i = len;
+
+#ifdef __SSE2__
+    const __m128 abs_mask = _mm_castsi128_ps (_mm_set1_epi32 (0x7fffffff));
+    const __m128 thresh = _mm_set1_ps (threshold);
+
+    for (; i >= 4; i -= 4)
+    {
+        __m128 x = _mm_and_ps (_mm_loadu_ps (data + i - 4), abs_mask);
+        int loud = _mm_movemask_ps (_mm_cmpgt_ps (x, thresh));
+
+        if (loud)
+            return i - 4 + (31 - __builtin_clz (loud));
+    }
+#endif
+
+    while (i --)
+    {
+        if (fabsf (data[i]) > threshold)
+            return i;
+    }
+
+    return -1;
+}
+
+static float mean_square (const float * data, int len)
+{
+    float sum = 0;
+    int i = 0;
+
+#ifdef __SSE2__
+    __m128 acc = _mm_setzero_ps ();
 
-    int offset = sample - begin;
+    for (; i + 4 <= len; i += 4)
+    {
+        __m128 x = _mm_loadu_ps (data + i);
+        acc = _mm_add_ps (acc, _mm_mul_ps (x, x));
+    }
+
+    float part[4];
+    _mm_storeu_ps (part, acc);
+    sum = (part[0] + part[1]) + (part[2] + part[3]);
+#endif
+
+    for (; i < len; i ++)
+        sum += data[i] * data[i];
+
+    return sum / len;
+}
+
+/* In RMS mode, the block is divided into windows of <window> samples (counted
+ * from the start of the block), and a window is silent if its RMS level is
+ * below the threshold, however loud its peaks.  Within the first and last
+ * loud windows, the cut is placed at the first and last loud samples. */
+static int find_first_rms (const float * data, int len, int window, float threshold)
+{
+    for (int pos = 0; pos < len; pos += window)
+    {
+        int n = aud::min (window, len - pos);
+
+        if (mean_square (data + pos, n) > threshold * threshold)
+            return pos + aud::max (find_first (data + pos, n, threshold), 0);
+    }
+
+    return -1;
+}
+
+static int find_last_rms (const float * data, int len, int window, float threshold)
+{
+    if (! len)
+        return -1;
+
+    for (int pos = (len - 1) / window * window; pos >= 0; pos -= window)
+    {
+        int n = aud::min (window, len - pos);
+
+        if (mean_square (data + pos, n) > threshold * threshold)
+        {
+            int last = find_last (data + pos, n, threshold);
+            return pos + (last >= 0 ? last : n - 1);
+        }
+    }
+
+    return -1;
+}
+
+static int align_to_frame (int offset, bool align_to_end)
+{
     if (align_to_end)
         offset += current_channels;
 
-    return begin + (offset - offset % current_channels);
+    return offset - offset % current_channels;
 }
 
 static void buffer_with_overflow (const float * data, int len)
@@ -133,50 +285,54 @@ static void buffer_with_overflow (const float * data, int len)
 
 Index<float> & SilenceRemoval::process (Index<float> & data)
 {
-    const int threshold_db = aud_get_int ("silence-removal", "threshold");
-    const float threshold = powf (10.0f, threshold_db / 20.0f);
+    params.fetch (settings);
 
-    float * first_sample = nullptr;
-    float * last_sample = nullptr;
+    const float * samples = data.begin ();
+    int len = data.len ();
+    int first, last;
 
-    for (float & sample : data)
+    if (settings.rms)
     {
-        if (sample > threshold || sample < -threshold)
-        {
-            if (! first_sample)
-                first_sample = & sample;
+        int window = aud::max (aud::rescale (settings.rms_window, 1000, current_rate), 1);
+        window *= current_channels;
 
-            last_sample = & sample;
-        }
+        first = find_first_rms (samples, len, window, settings.threshold);
+        last = (first >= 0) ? find_last_rms (samples, len, window, settings.threshold) : -1;
+    }
+    else
+    {
+        first = find_first (samples, len, settings.threshold);
+        last = (first >= 0) ? find_last (samples, len, settings.threshold) : -1;
     }
-
-    first_sample = align_to_frame (data.begin (), first_sample, false);
-    last_sample = align_to_frame (data.begin (), last_sample, true);
 
     output.resize (0);
 
-    if (first_sample)
+    if (first >= 0)
     {
         /* do not skip leading silence if non-silence has been seen */
-        if (! initial_silence)
-            first_sample = data.begin ();
+        first = initial_silence ? align_to_frame (first, false) : 0;
+        last = align_to_frame (last, true);
 
         initial_silence = false;
 
+        /* nothing to trim or to insert: pass the block through as it is */
+        if (first == 0 && last == len && ! buffer.len ())
+            return data;
+
         /* copy any saved silence from previous call */
         buffer.move_out (output, -1, -1);
 
         /* copy non-silent portion */
-        output.insert (first_sample, -1, last_sample - first_sample);
+        output.insert (samples + first, -1, last - first);
 
         /* save trailing silence */
-        buffer_with_overflow (last_sample, data.end () - last_sample);
+        buffer_with_overflow (samples + last, len - last);
     }
     else
     {
         /* if non-silence has been seen, save entire silent chunk */
         if (! initial_silence)
-            buffer_with_overflow (data.begin (), data.len ());
+            buffer_with_overflow (samples, len);
     }
 
     return output;
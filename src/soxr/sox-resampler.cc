@@ -20,7 +20,10 @@
  * the use of this software.
  */
 
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <soxr.h>
 
 #include <libaudcore/i18n.h>
@@ -31,6 +34,7 @@
 #define MIN_RATE 8000
 #define MAX_RATE 192000
 #define RATE_STEP 50
+#define MAX_THREADS 8
 
 class SoXResampler : public EffectPlugin
 {
@@ -56,6 +60,7 @@ public:
     void start (int & channels, int & rate);
     Index<float> & process (Index<float> & data);
     bool flush (bool force);
+    int adjust_delay (int delay);
 };
 
 EXPORT SoXResampler aud_plugin_instance;
@@ -66,15 +71,160 @@ const char * const SoXResampler::defaults[] = {
     "phase_response", aud::numeric_string<SOXR_LINEAR_PHASE>::str,
     "allow_aliasing", "FALSE",
     "use_steep_filter", "FALSE",
+    "threads", "1",
     nullptr
 };
 
-static soxr_t soxr;
-static soxr_error_t error;
-static int stored_channels;
+/* The channels are split into groups, each with its own resampler.  With
+ * more than one group, every group but the first is processed by a worker
+ * thread while the calling thread does the first; process() waits for all of
+ * them, so threading adds no latency of its own. */
+struct ChannelGroup {
+    int first, channels;
+    soxr_t soxr;
+    soxr_error_t error;
+    Index<float> in, out;
+    Index<float> pending;  /* output not yet returned, see process() */
+};
+
+static Index<ChannelGroup> groups;
+static int stored_channels, stored_rate;
 static double ratio;
 static Index<float> buffer;
 
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static Index<pthread_t> workers;
+static int work_serial, work_pending;
+static bool workers_quit;
+
+/* the block currently being processed (nullptr to signal end of input) */
+static const float * block_data;
+static int block_frames;
+
+static void process_group (ChannelGroup & group)
+{
+    size_t done = 0;
+
+    if (block_data)
+    {
+        group.in.resize (block_frames * group.channels);
+
+        const float * src = block_data + group.first;
+        float * dest = group.in.begin ();
+
+        for (int f = 0; f < block_frames; f ++)
+        {
+            memcpy (dest, src, sizeof (float) * group.channels);
+            src += stored_channels;
+            dest += group.channels;
+        }
+
+        group.out.resize (((int) (block_frames * ratio) + 256) * group.channels);
+
+        group.error = soxr_process (group.soxr, group.in.begin (), block_frames,
+         nullptr, group.out.begin (), group.out.len () / group.channels, & done);
+    }
+    else
+        group.error = soxr_process (group.soxr, nullptr, 0, nullptr, nullptr, 0, nullptr);
+
+    if (! group.error)
+        group.pending.insert (group.out.begin (), -1, done * group.channels);
+}
+
+static void * worker_thread (void * arg)
+{
+    ChannelGroup & group = groups[(intptr_t) arg];
+    int serial = 0;
+
+    pthread_mutex_lock (& pool_mutex);
+
+    while (1)
+    {
+        while (! workers_quit && work_serial == serial)
+            pthread_cond_wait (& work_cond, & pool_mutex);
+
+        if (workers_quit)
+            break;
+
+        serial = work_serial;
+        pthread_mutex_unlock (& pool_mutex);
+
+        process_group (group);
+
+        pthread_mutex_lock (& pool_mutex);
+
+        if (! -- work_pending)
+            pthread_cond_signal (& done_cond);
+    }
+
+    pthread_mutex_unlock (& pool_mutex);
+    return nullptr;
+}
+
+/* runs process_group() on all groups, returns false on error */
+static bool process_groups (const float * data, int frames)
+{
+    block_data = data;
+    block_frames = frames;
+
+    if (workers.len ())
+    {
+        pthread_mutex_lock (& pool_mutex);
+        work_pending = workers.len ();
+        work_serial ++;
+        pthread_cond_broadcast (& work_cond);
+        pthread_mutex_unlock (& pool_mutex);
+    }
+
+    process_group (groups[0]);
+
+    if (workers.len ())
+    {
+        pthread_mutex_lock (& pool_mutex);
+        while (work_pending)
+            pthread_cond_wait (& done_cond, & pool_mutex);
+        pthread_mutex_unlock (& pool_mutex);
+    }
+
+    bool success = true;
+
+    for (ChannelGroup & group : groups)
+    {
+        if (group.error)
+        {
+            AUDERR ("%s\n", group.error);
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+static void destroy_groups ()
+{
+    if (workers.len ())
+    {
+        pthread_mutex_lock (& pool_mutex);
+        workers_quit = true;
+        pthread_cond_broadcast (& work_cond);
+        pthread_mutex_unlock (& pool_mutex);
+
+        for (pthread_t thread : workers)
+            pthread_join (thread, nullptr);
+
+        workers.clear ();
+        workers_quit = false;
+        work_serial = 0;
+    }
+
+    for (ChannelGroup & group : groups)
+        soxr_delete (group.soxr);
+
+    groups.clear ();
+}
+
 bool SoXResampler::init ()
 {
     aud_config_set_defaults ("soxr", defaults);
@@ -83,15 +233,13 @@ bool SoXResampler::init ()
 
 void SoXResampler::cleanup ()
 {
-    soxr_delete (soxr);
-    soxr = 0;
+    destroy_groups ();
     buffer.clear ();
 }
 
 void SoXResampler::start (int & channels, int & rate)
 {
-    soxr_delete (soxr);
-    soxr = 0;
+    destroy_groups ();
 
     int new_rate = aud_get_int ("soxr", "rate");
     new_rate = aud::clamp (new_rate, MIN_RATE, MAX_RATE);
@@ -106,49 +254,109 @@ void SoXResampler::start (int & channels, int & rate)
 
     soxr_quality_spec_t q = soxr_quality_spec (quality | phase_response | use_steep_filter | allow_aliasing, 0);
 
-    soxr = soxr_create (rate, new_rate, channels, & error, nullptr, & q, nullptr);
+    int n_groups = aud::clamp (aud_get_int ("soxr", "threads"), 1, aud::min (channels, MAX_THREADS));
 
-    if (error)
+    groups.insert (0, n_groups);
+
+    for (int g = 0; g < n_groups; g ++)
     {
-        AUDERR ("%s\n", error);
-        return;
+        ChannelGroup & group = groups[g];
+        soxr_error_t error;
+
+        /* spread the channels as evenly as possible */
+        group.first = channels * g / n_groups;
+        group.channels = channels * (g + 1) / n_groups - group.first;
+        group.soxr = soxr_create (rate, new_rate, group.channels, & error, nullptr, & q, nullptr);
+
+        if (error)
+        {
+            AUDERR ("%s\n", error);
+            destroy_groups ();
+            return;
+        }
     }
 
+    for (int g = 1; g < n_groups; g ++)
+    {
+        pthread_t thread;
+        if (pthread_create (& thread, nullptr, worker_thread, (void *) (intptr_t) g))
+        {
+            AUDERR ("Failed to create worker thread.\n");
+            destroy_groups ();
+            return;
+        }
+
+        workers.append (thread);
+    }
+
+    if (n_groups > 1)
+        AUDINFO ("Resampling %d channels in %d groups.\n", channels, n_groups);
+
     stored_channels = channels;
+    stored_rate = new_rate;
     ratio = (double) new_rate / rate;
     rate = new_rate;
 }
 
 Index<float> & SoXResampler::process (Index<float> & data)
 {
-    if (! soxr)
+    if (! groups.len ())
          return data;
 
-    buffer.resize ((int) (data.len () * ratio) + 256);
+    if (! process_groups (data.begin (), data.len () / stored_channels))
+        return data;
 
-    size_t samples_done;
-    error = soxr_process (soxr, data.begin (), data.len () / stored_channels,
-     nullptr, buffer.begin (), buffer.len () / stored_channels, & samples_done);
+    /* The groups are fed identically and so should produce the same number of
+     * frames, but to be safe, anything one group produced beyond the others
+     * is held back until next time. */
+    int frames = groups[0].pending.len () / groups[0].channels;
+    for (ChannelGroup & group : groups)
+        frames = aud::min (frames, group.pending.len () / group.channels);
 
-    if (error)
+    buffer.resize (frames * stored_channels);
+
+    for (ChannelGroup & group : groups)
     {
-        AUDERR ("%s\n", error);
-        return data;
-    }
+        const float * src = group.pending.begin ();
+        float * dest = buffer.begin () + group.first;
+
+        for (int f = 0; f < frames; f ++)
+        {
+            memcpy (dest, src, sizeof (float) * group.channels);
+            src += group.channels;
+            dest += stored_channels;
+        }
 
-    buffer.resize (samples_done * stored_channels);
+        group.pending.remove (0, frames * group.channels);
+    }
 
     return buffer;
 }
 
 bool SoXResampler::flush (bool force)
 {
-    if (soxr && (error = soxr_process (soxr, nullptr, 0, nullptr, nullptr, 0, nullptr)))
-        AUDERR ("%s\n", error);
+    if (groups.len ())
+    {
+        process_groups (nullptr, 0);
+
+        for (ChannelGroup & group : groups)
+            group.pending.resize (0);
+    }
 
     return true;
 }
 
+int SoXResampler::adjust_delay (int delay)
+{
+    if (! groups.len ())
+        return delay;
+
+    ChannelGroup & group = groups[0];
+    double frames = soxr_delay (group.soxr) + group.pending.len () / group.channels;
+
+    return delay + (int) (frames * 1000 / stored_rate);
+}
+
 const char SoXResampler::about[] =
  N_("SoX Resampler Plugin for Audacious\n"
     "Copyright 2013 Michał Lipski\n\n"
@@ -181,7 +389,10 @@ const PreferencesWidget SoXResampler::widgets[] = {
     WidgetCheck (N_("Use steep filter"), WidgetBool ("soxr", "use_steep_filter")),
     WidgetSpin (N_("Rate:"),
         WidgetInt ("soxr", "rate"),
-        {MIN_RATE, MAX_RATE, RATE_STEP, N_("Hz")})
+        {MIN_RATE, MAX_RATE, RATE_STEP, N_("Hz")}),
+    WidgetSpin (N_("Threads:"),
+        WidgetInt ("soxr", "threads"),
+        {1, MAX_THREADS, 1})
 };
 
 const PluginPreferences SoXResampler::prefs = {{widgets}};
@@ -18,23 +18,39 @@
  */
 
 #include <math.h>
+#include <string.h>
 #include <samplerate.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include <libaudcore/hook.h>
 #include <libaudcore/i18n.h>
 #include <libaudcore/runtime.h>
 #include <libaudcore/plugin.h>
 #include <libaudcore/preferences.h>
 
+#include "../effect-common/effect-params.h"
+
 /* The general idea of the speed change algorithm is to divide the input signal
  * into pieces, spaced at a time interval A, using a cosine-shaped window
  * function.  The pieces are then reassembled by adding them together again,
  * spaced at another time interval B.  By varying the ratio A:B, we change the
- * speed of the audio. */
+ * speed of the audio.
+ *
+ * To avoid the phasing that comes from adding pieces of a periodic waveform
+ * at arbitrary offsets, each piece is shifted by up to SEEK_TIME from its
+ * nominal position, to wherever it best matches the audio that would have
+ * followed the previous piece in the input (WSOLA). */
 
 #define FREQ    10
 #define OVERLAP  3
 
+#define SEEK_TIME    0.01  /* seconds either way */
+#define SEEK_STEP    4     /* frames, for the coarse pass of the search */
+#define COMPARE_TIME 0.04  /* seconds */
+
 #define CFGSECT "speed-pitch"
 #define MINSPEED 0.5
 #define MAXSPEED 2.0
@@ -77,47 +93,249 @@ private:
 
 EXPORT SpeedPitch aud_plugin_instance;
 
+/* A queue of samples that is kept contiguous in memory, so that any window
+ * of it can be handed to the inner loops as a plain array.  Samples are
+ * appended at the tail and discarded from the head by moving offsets; the
+ * live data is moved back to the front only when the tail reaches the end
+ * of the storage, which is at least twice as large as the live data. */
+class SampleQueue
+{
+public:
+    int len () const
+        { return m_tail - m_head; }
+    float * begin ()
+        { return m_buf.begin () + m_head; }
+    float & operator[] (int i)
+        { return m_buf[m_head + i]; }
+
+    /* returns space for at least <n> more samples; see add() */
+    float * reserve (int n)
+    {
+        if (m_tail + n > m_buf.len ())
+        {
+            int live = len ();
+
+            if (2 * (live + n) > m_buf.len ())
+                m_buf.resize (2 * (live + n));
+
+            memmove (m_buf.begin (), begin (), sizeof (float) * live);
+            m_head = 0;
+            m_tail = live;
+        }
+
+        return m_buf.begin () + m_tail;
+    }
+
+    void add (int n)
+        { m_tail += n; }
+
+    void add_zeros (int n)
+    {
+        memset (reserve (n), 0, sizeof (float) * n);
+        m_tail += n;
+    }
+
+    void discard (int n)
+    {
+        m_head += n;
+        if (m_head == m_tail)
+            m_head = m_tail = 0;
+    }
+
+    void clear ()
+        { m_head = m_tail = 0; }
+    void destroy ()
+        { m_buf.clear (); clear (); }
+
+private:
+    Index<float> m_buf;
+    int m_head = 0, m_tail = 0;
+};
+
+struct SpeedSettings {
+    float speed, pitch;
+    bool decouple;
+};
+
+/* Settings are published here when changed in the UI and picked up by the
+ * audio thread at the start of each block. */
+static EffectParams<SpeedSettings> params;
+static SpeedSettings cur;
+
 static double semitones;
 static int curchans, currate;
 static SRC_STATE * srcstate;
 static int outstep, width;
 static Index<float> cosine;
-static Index<float> in, out;
+static SampleQueue in, out;
 static int src, dst;
 
-static void add_data (Index<float> & b, Index<float> & data, float ratio)
+/* WSOLA state: the input position (relative to the input buffer, or -1) that
+ * would have continued the last piece copied, and scratch buffers holding
+ * downmixed audio for the similarity search */
+static int natural;
+static int seek_frames, compare_frames;
+static Index<float> reference, candidates;
+
+/* Inner loops.  On x86, SSE2 is part of the baseline, so there is no need to
+ * check for it at runtime. */
+
+static void overlap_add (float * dest, const float * data, const float * window, int len)
+{
+    int i = 0;
+
+#ifdef __SSE2__
+    for (; i + 4 <= len; i += 4)
+    {
+        __m128 x = _mm_mul_ps (_mm_loadu_ps (data + i), _mm_loadu_ps (window + i));
+        _mm_storeu_ps (dest + i, _mm_add_ps (_mm_loadu_ps (dest + i), x));
+    }
+#endif
+
+    for (; i < len; i ++)
+        dest[i] += data[i] * window[i];
+}
+
+/* correlation of <a> and <b>, normalized by the energy of <b> */
+static float similarity (const float * a, const float * b, int len)
+{
+    float dot = 0, energy = 0;
+    int i = 0;
+
+#ifdef __SSE2__
+    __m128 vdot = _mm_setzero_ps (), venergy = _mm_setzero_ps ();
+
+    for (; i + 4 <= len; i += 4)
+    {
+        __m128 va = _mm_loadu_ps (a + i);
+        __m128 vb = _mm_loadu_ps (b + i);
+        vdot = _mm_add_ps (vdot, _mm_mul_ps (va, vb));
+        venergy = _mm_add_ps (venergy, _mm_mul_ps (vb, vb));
+    }
+
+    float part[4];
+    _mm_storeu_ps (part, vdot);
+    dot = part[0] + part[1] + part[2] + part[3];
+    _mm_storeu_ps (part, venergy);
+    energy = part[0] + part[1] + part[2] + part[3];
+#endif
+
+    for (; i < len; i ++)
+    {
+        dot += a[i] * b[i];
+        energy += b[i] * b[i];
+    }
+
+    return dot / sqrtf (energy + 1e-9f);
+}
+
+static void downmix (float * dest, const float * data, int frames)
+{
+    if (curchans == 1)
+    {
+        memcpy (dest, data, sizeof (float) * frames);
+        return;
+    }
+
+    for (int f = 0; f < frames; f ++)
+    {
+        float sum = 0;
+        for (int c = 0; c < curchans; c ++)
+            sum += data[c];
+
+        dest[f] = sum;
+        data += curchans;
+    }
+}
+
+/* Returns the offset (in samples) from <pos> at which the piece centered
+ * there best continues the previous piece, or 0 if there is not enough
+ * audio buffered to search. */
+static int find_offset (int pos)
+{
+    int half = compare_frames / 2;
+    int pos_frame = pos / curchans;
+    int in_frames = in.len () / curchans;
+    int natural_frame = natural / curchans;
+
+    if (natural < 0 || natural_frame < half || natural_frame + half > in_frames)
+        return 0;
+
+    int lo = aud::max (-seek_frames, half - pos_frame);
+    int hi = aud::min (seek_frames, in_frames - half - pos_frame);
+
+    if (lo >= hi)
+        return 0;
+
+    downmix (reference.begin (), & in[(natural_frame - half) * curchans], compare_frames);
+    downmix (candidates.begin (), & in[(pos_frame + lo - half) * curchans],
+     hi - lo + compare_frames);
+
+    auto score = [=] (int offset)
+        { return similarity (reference.begin (), & candidates[offset - lo], compare_frames); };
+
+    int best = 0;
+    float best_score = score (0);
+
+    for (int offset = lo; offset <= hi; offset += SEEK_STEP)
+    {
+        float s = score (offset);
+        if (s > best_score)
+        {
+            best = offset;
+            best_score = s;
+        }
+    }
+
+    int coarse = best;
+    int fine_lo = aud::max (lo, coarse - SEEK_STEP + 1);
+    int fine_hi = aud::min (hi, coarse + SEEK_STEP - 1);
+
+    for (int offset = fine_lo; offset <= fine_hi; offset ++)
+    {
+        float s = score (offset);
+        if (s > best_score)
+        {
+            best = offset;
+            best_score = s;
+        }
+    }
+
+    return best * curchans;
+}
+
+static void add_data (SampleQueue & b, Index<float> & data, float ratio)
 {
-    int oldlen = b.len ();
     int inframes = data.len () / curchans;
     int maxframes = (int) (inframes * ratio) + 256;
-    b.resize (oldlen + maxframes * curchans);
 
     SRC_DATA d = SRC_DATA ();
 
     d.data_in = data.begin ();
     d.input_frames = inframes;
-    d.data_out = & b[oldlen];
+    d.data_out = b.reserve (maxframes * curchans);
     d.output_frames = maxframes;
     d.src_ratio = ratio;
 
     src_process (srcstate, & d);
-    b.resize (oldlen + d.output_frames_gen * curchans);
+    b.add (d.output_frames_gen * curchans);
 }
 
 bool SpeedPitch::flush (bool force)
 {
     src_reset (srcstate);
 
-    in.resize (0);
-    out.resize (0);
+    in.clear ();
+    out.clear ();
 
     /* The source and destination pointers give the center of the next cosine
      * window to be copied, relative to the current input and output buffers. */
     src = dst = 0;
+    natural = -1;
 
     /* The output buffer always extends right of the destination pointer by half
      * the width of a cosine window. */
-    out.insert (0, width / 2);
+    out.add_zeros (width / 2);
 
     return true;
 }
@@ -127,6 +345,8 @@ void SpeedPitch::start (int & chans, int & rate)
     curchans = chans;
     currate = rate;
 
+    params.fetch (cur);
+
     if (srcstate)
         src_delete (srcstate);
 
@@ -144,58 +364,77 @@ void SpeedPitch::start (int & chans, int & rate)
     for (int i = 0; i < width; i ++)
         cosine[i] = (1.0 - cos (2.0 * M_PI * i / width)) / OVERLAP;
 
+    /* find_offset() compares <compare_frames / 2> frames either side of a
+     * center frame, so the count must be even to stay within the buffer. */
+    seek_frames = (int) (currate * SEEK_TIME);
+    compare_frames = (int) (currate * COMPARE_TIME) & ~1;
+
+    reference.resize (compare_frames);
+    candidates.resize (compare_frames + 2 * seek_frames + 1);
+
     flush (true);
 }
 
 Index<float> & SpeedPitch::process (Index<float> & data, bool ending)
 {
     const float * cosine_center = & cosine[width / 2];
-    float pitch = aud_get_double (CFGSECT, "pitch");
-    float speed = aud_get_double (CFGSECT, "speed");
+
+    params.fetch (cur);
 
     /* Copy the passed audio to the input buffer, scaled to adjust pitch. */
-    add_data (in, data, 1.0 / pitch);
+    add_data (in, data, 1.0 / cur.pitch);
 
-    if (! aud_get_bool (CFGSECT, "decouple"))
+    if (! cur.decouple)
     {
-        data = std::move (in);
+        data.resize (0);
+        data.insert (in.begin (), 0, in.len ());
+        in.clear ();
         return data;
     }
 
     /* Calculate the spacing interval for input. */
-    int instep = (int) round ((outstep / curchans) * speed / pitch) * curchans;
+    int instep = (int) round ((outstep / curchans) * cur.speed / cur.pitch) * curchans;
 
-    /* Stop copying half a window's width before the end of the input buffer (or
-     * right up to the end of the buffer if the song is ending). */
-    int stop = in.len () - (ending ? 0 : width / 2);
+    /* Stop copying half a window's width (plus the search range) before the
+     * end of the input buffer (or right up to the end of the buffer if the
+     * song is ending). */
+    int stop = in.len () - (ending ? 0 : width / 2 + seek_frames * curchans);
 
     while (src <= stop)
     {
+        int pos = src + find_offset (src);
+
         /* Truncate the window to avoid overflows if necessary. */
-        int begin = aud::max (-(width / 2), aud::max (-src, -dst));
-        int end = aud::min (width / 2, aud::min (in.len () - src, out.len () - dst));
+        int begin = aud::max (-(width / 2), aud::max (-pos, -dst));
+        int end = aud::min (width / 2, aud::min (in.len () - pos, out.len () - dst));
 
-        for (int i = begin; i < end; i ++)
-            out[dst + i] += in[src + i] * cosine_center[i];
+        if (begin < end)
+            overlap_add (& out[dst + begin], & in[pos + begin], cosine_center + begin, end - begin);
 
+        natural = pos + outstep;
         src += instep;
         dst += outstep;
 
-        out.insert (-1, outstep);
+        out.add_zeros (outstep);
     }
 
-    /* Discard input up to half a window's width before the source pointer (or
-     * right up to the previous source pointer if the song is ending. */
-    int seek = aud::clamp (0, src - (ending ? instep : width / 2), in.len ());
-    in.remove (0, seek);
+    /* Discard input up to half a window's width (plus the search range) before
+     * the source pointer, keeping what the next search will compare against
+     * (or right up to the previous source pointer if the song is ending). */
+    int keep = ending ? src - instep : aud::min (src - width / 2 - seek_frames * curchans,
+     natural - (compare_frames / 2) * curchans);
+    int seek = aud::clamp (0, keep, in.len ());
+    in.discard (seek);
     src -= seek;
+    natural -= seek;
 
     data.resize (0);
 
     /* Return output up to half a window's width before the destination pointer
      * (or right up to the previous destination pointer if the song is ending). */
     int ret = aud::clamp (0, dst - (ending ? outstep : width / 2), out.len ());
-    data.move_from (out, 0, 0, ret, true, true);
+    data.insert (out.begin (), 0, ret);
+    out.discard (ret);
     dst -= ret;
 
     return data;
@@ -203,15 +442,23 @@ Index<float> & SpeedPitch::process (Index<float> & data, bool ending)
 
 int SpeedPitch::adjust_delay (int delay)
 {
-    if (! aud_get_bool (CFGSECT, "decouple"))
+    if (! cur.decouple)
         return delay;
 
     float samples_to_ms = 1000.0 / (curchans * currate);
-    float speed = aud_get_double (CFGSECT, "speed");
     int in_samples = in.len () - src;
     int out_samples = dst;
 
-    return (delay + in_samples * samples_to_ms) * speed + out_samples * samples_to_ms;
+    return (delay + in_samples * samples_to_ms) * cur.speed + out_samples * samples_to_ms;
+}
+
+static void update_config ()
+{
+    SpeedSettings settings;
+    settings.speed = aud_get_double (CFGSECT, "speed");
+    settings.pitch = aud_get_double (CFGSECT, "pitch");
+    settings.decouple = aud_get_bool (CFGSECT, "decouple");
+    params.publish (settings);
 }
 
 static void sync_speed ()
@@ -221,6 +468,8 @@ static void sync_speed ()
         aud_set_double (CFGSECT, "speed", aud_get_double (CFGSECT, "pitch"));
         hook_call ("speed-pitch set speed", nullptr);
     }
+
+    update_config ();
 }
 
 static void pitch_changed ()
@@ -248,7 +497,7 @@ const PreferencesWidget SpeedPitch::widgets[] = {
     WidgetCheck (N_("Decouple from pitch"),
         WidgetBool (CFGSECT, "decouple", sync_speed)),
     WidgetSpin (N_("Multiplier:"),
-        WidgetFloat (CFGSECT, "speed", nullptr, "speed-pitch set speed"),
+        WidgetFloat (CFGSECT, "speed", update_config, "speed-pitch set speed"),
         {MINSPEED, MAXSPEED, 0.05},
         WIDGET_CHILD),
     WidgetLabel (N_("<b>Pitch</b>")),
@@ -278,6 +527,8 @@ void SpeedPitch::cleanup ()
     srcstate = nullptr;
 
     cosine.clear ();
-    in.clear ();
-    out.clear ();
+    in.destroy ();
+    out.destroy ();
+    reference.clear ();
+    candidates.clear ();
 }
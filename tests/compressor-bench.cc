@@ -0,0 +1,168 @@
+/*
+ * Measures the compressor plugin: each sum_abs/ramp kernel the CPU supports
+ * against the scalar one (time per sample and largest difference), and then
+ * Compressor::process() as a whole, as a share of one core, in both the
+ * chunked and the multiband mode.
+ *
+ *   make -C tests bench
+ *
+ * The plugin source is included directly so that its static kernels can be
+ * called; it needs the libaudcore headers (AUDACIOUS_CFLAGS in the Makefile).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+#include "../src/compressor/compressor.cc"
+
+struct Kernels {
+    const char * name;
+    float (* sum_abs) (const float * data, int length);
+    void (* ramp) (float * data, int length, float a, float step);
+    bool supported;
+};
+
+static std::vector<Kernels> kernels ()
+{
+    std::vector<Kernels> list = {{"scalar", sum_abs_scalar, ramp_scalar, true}};
+
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init ();
+    list.push_back ({"SSE2", sum_abs_sse2, ramp_sse2, (bool) __builtin_cpu_supports ("sse2")});
+    list.push_back ({"AVX2", sum_abs_avx2, ramp_avx2, (bool) __builtin_cpu_supports ("avx2")});
+#endif
+
+    return list;
+}
+
+static double now ()
+{
+    return std::chrono::duration<double> (std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+}
+
+/* noise whose level changes every half second, so that the compressor has
+ * something to do */
+static std::vector<float> make_noise (int channels, int rate, double seconds)
+{
+    std::vector<float> data ((size_t) (channels * rate * seconds));
+    unsigned seed = 1;
+    float level = 0.5f;
+
+    for (size_t i = 0; i < data.size (); i ++)
+    {
+        seed = seed * 1103515245 + 12345;
+
+        if (i % (channels * rate / 2) == 0)
+            level = 0.05f + (seed >> 16) / 65536.0f * 0.9f;
+
+        data[i] = level * ((int) (seed >> 8 & 0xffff) - 32768) / 32768;
+    }
+
+    return data;
+}
+
+/* one chunk as the plugin sees it: 0.2 s of 44.1 kHz stereo */
+static void bench_kernels ()
+{
+    const int length = 2 * (int) (44100 * CHUNK_TIME);
+    const int rounds = 20000;
+
+    auto noise = make_noise (2, 44100, CHUNK_TIME);
+    std::vector<float> data (length), expected (length);
+
+    float expected_sum = sum_abs_scalar (noise.data (), length);
+    expected = noise;
+    ramp_scalar (expected.data (), length, 0.5f, 1.5f / length);
+
+    printf ("kernels (%d samples):\n", length);
+
+    for (const Kernels & k : kernels ())
+    {
+        if (! k.supported)
+            continue;
+
+        /* the kernels sum in a different order, so only rounding differs */
+        double sum_error = fabs (k.sum_abs (noise.data (), length) - expected_sum) / expected_sum;
+
+        data = noise;
+        k.ramp (data.data (), length, 0.5f, 1.5f / length);
+
+        float ramp_error = 0;
+        for (int i = 0; i < length; i ++)
+            ramp_error = aud::max (ramp_error, fabsf (data[i] - expected[i]));
+
+        volatile float sink = 0;
+        double start = now ();
+        for (int round = 0; round < rounds; round ++)
+            sink = sink + k.sum_abs (noise.data (), length);
+        double sum_time = now () - start;
+
+        start = now ();
+        for (int round = 0; round < rounds; round ++)
+            k.ramp (data.data (), length, 1.0f, 0.0f);
+        double ramp_time = now () - start;
+
+        printf ("  %-6s sum_abs %.3f ns/sample (rel. error %.1e), "
+         "ramp %.3f ns/sample (max error %.1e)\n", k.name,
+         sum_time * 1e9 / ((double) rounds * length), sum_error,
+         ramp_time * 1e9 / ((double) rounds * length), ramp_error);
+    }
+}
+
+/* 60 seconds of audio in 512-frame blocks through init/start/process/finish */
+static void bench_plugin (bool multiband_on, int channels, int rate)
+{
+    const double seconds = 60;
+    const int block = 512 * channels;
+
+    auto noise = make_noise (channels, rate, seconds);
+    Index<float> in;
+    long out_samples = 0;
+
+    aud_plugin_instance.init ();
+    aud_set_bool ("compressor", "multiband", multiband_on);
+    aud_plugin_instance.start (channels, rate);
+
+    /* the multiband mode drains its look-ahead delay in finish() */
+    long expected = noise.size () + (multiband_on ? multiband.latency () * channels : 0);
+
+    double start = now ();
+
+    for (size_t pos = 0; pos < noise.size (); pos += block)
+    {
+        int count = (int) aud::min (noise.size () - pos, (size_t) block);
+        in.resize (count);
+        memcpy (in.begin (), & noise[pos], count * sizeof (float));
+
+        out_samples += aud_plugin_instance.process (in).len ();
+    }
+
+    in.resize (0);
+    out_samples += aud_plugin_instance.finish (in, true).len ();
+
+    double elapsed = now () - start;
+    aud_plugin_instance.cleanup ();
+
+    printf ("  %-9s %d ch, %d Hz: %.2f ns/sample, %.2f%% of one core%s\n",
+     multiband_on ? "multiband" : "chunked", channels, rate,
+     elapsed * 1e9 / noise.size (), elapsed / seconds * 100,
+     out_samples == expected ? "" : " (OUTPUT LENGTH WRONG)");
+}
+
+int main ()
+{
+    bench_kernels ();
+
+    printf ("plugin (selected kernels):\n");
+    for (bool multiband_on : {false, true})
+    {
+        bench_plugin (multiband_on, 2, 44100);
+        bench_plugin (multiband_on, 8, 96000);
+    }
+
+    return 0;
+}
@@ -0,0 +1,59 @@
+/*
+ * Loads a file for the console benchmarks the way the plugin does (see
+ * ConsoleFileHandler in Audacious_Driver.cc): through a Gzip_Reader,
+ * identified by its header, or by its extension for headerless GYM files.
+ * Std_File_Reader stands in for Vfs_File_Reader so that plain paths work.
+ */
+
+#ifndef TESTS_CONSOLE_FILE_H
+#define TESTS_CONSOLE_FILE_H
+
+#include <stdio.h>
+
+#include "Data_Reader.h"
+#include "Gzip_Reader.h"
+#include "Music_Emu.h"
+#include "gme.h"
+
+/* pass gme_info_only as the sample rate to read only the track info;
+ * returns null after printing a message on error */
+static Music_Emu * load_console_file (const char * path, long sample_rate)
+{
+    Std_File_Reader file;
+    Gzip_Reader gzip;
+    char header[4];
+
+    if (file.open (path) || gzip.open (& file) || gzip.read (header, sizeof header))
+    {
+        printf ("%s: cannot read file\n", path);
+        return nullptr;
+    }
+
+    gme_type_t type = gme_identify_extension (gme_identify_header (header));
+    if (! type && gme_identify_extension (path) == gme_gym_type)
+        type = gme_gym_type;
+
+    if (! type)
+    {
+        printf ("%s: not a supported file\n", path);
+        return nullptr;
+    }
+
+    Music_Emu * emu = gme_new_emu (type, sample_rate);
+    if (! emu)
+        return nullptr;
+
+    Remaining_Reader reader (header, sizeof header, & gzip);
+    blargg_err_t err = emu->load (reader);
+
+    if (err)
+    {
+        printf ("%s: %s\n", path, err);
+        gme_delete (emu);
+        return nullptr;
+    }
+
+    return emu;
+}
+
+#endif /* TESTS_CONSOLE_FILE_H */
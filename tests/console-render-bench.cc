@@ -0,0 +1,105 @@
+/*
+ * Measures rendering in the console plugin's emulators: a minute of each
+ * file given, played in the old 1024-sample blocks and in 100 ms blocks (the
+ * plugin's default), with the time each takes and whether the output is the
+ * same.  A third run with Play_Profile enabled shows where the time goes.
+ *
+ *   make -C tests console-render-bench
+ *   tests/console-render-bench song.spc song.vgz ...
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "console-file.h"
+
+#define RATE 44100
+#define SECONDS 60
+
+/* renders SECONDS of the first track in blocks of <block> samples and
+ * returns the time taken */
+static double render (const char * path, int block, bool profile, std::vector<short> & out)
+{
+    Music_Emu * emu = load_console_file (path, RATE);
+    if (! emu)
+        return -1;
+
+    emu->ignore_silence (true);
+    emu->profile ().enable (profile);
+
+    if (emu->start_track (0))
+    {
+        gme_delete (emu);
+        return -1;
+    }
+
+    long total = (long) SECONDS * RATE * 2;
+    out.resize (total + block);
+
+    auto start = std::chrono::steady_clock::now ();
+
+    long pos = 0;
+    while (pos < total && ! emu->track_ended ())
+    {
+        if (emu->play (block, & out[pos]))
+            break;
+
+        pos += block;
+    }
+
+    double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+    out.resize (std::min (pos, total));
+
+    if (profile)
+    {
+        Play_Profile const & p = emu->profile ();
+        printf ("  profile: emulation %.0f ms, mixing %.0f ms, resampling %.0f ms\n",
+         p.seconds (Play_Profile::emulation) * 1000, p.seconds (Play_Profile::mixing) * 1000,
+         p.seconds (Play_Profile::resampling) * 1000);
+    }
+
+    gme_delete (emu);
+    return seconds;
+}
+
+static bool bench_file (const char * path)
+{
+    std::vector<short> small, large, profiled;
+
+    double small_time = render (path, 1024, false, small);
+    double large_time = render (path, RATE / 10 * 2, false, large);
+
+    if (small_time < 0 || large_time < 0)
+        return false;
+
+    /* a track that ends is cut at a block boundary, so compare what both have */
+    size_t common = std::min (small.size (), large.size ());
+    bool same = ! memcmp (small.data (), large.data (), common * sizeof (short));
+
+    printf ("%s (%.0f s):\n", path, common / (2.0 * RATE));
+    printf ("  1024-sample blocks %.0f ms, 100 ms blocks %.0f ms, output %s\n",
+     small_time * 1000, large_time * 1000, same ? "identical" : "DIFFERS");
+
+    render (path, RATE / 10 * 2, true, profiled);
+
+    return same;
+}
+
+int main (int argc, char * * argv)
+{
+    if (argc < 2)
+    {
+        fprintf (stderr, "usage: %s file...\n", argv[0]);
+        return 1;
+    }
+
+    bool ok = true;
+    for (int i = 1; i < argc; i ++)
+        ok = bench_file (argv[i]) && ok;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+/*
+ * Measures seeking in the console plugin's emulators, with snapshots every
+ * 10 seconds (as the plugin sets them) and without.  Each file is played
+ * for a minute in 100 ms blocks (the plugin's default), then sought to a
+ * series of positions forwards and backwards.  The time each seek takes is
+ * reported, and whether the second after it matches the same second of
+ * uninterrupted playback.
+ *
+ *   make -C tests console-seek-bench
+ *   tests/console-seek-bench song.spc song.vgz ...
+ *
+ * With snapshots, every seek should match: seeks to multiples of 10 seconds
+ * land exactly on a snapshot, and other seeks emulate the rest of the way
+ * with sound.  Without snapshots, long skips are made with the voices muted,
+ * as they always were; that leaves some emulators slightly off afterwards,
+ * so those seeks need not match.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "console-file.h"
+
+#define RATE 44100
+#define SECONDS 60
+#define BLOCK (RATE / 10 * 2)  /* samples */
+
+/* in seconds, in the order sought to */
+static const int targets[] = {50, 10, 35, 20, 55, 0, 30, 5, 40, 12};
+
+struct SeekResult {
+    double seconds;
+    int matched[2], compared[2];  /* [1] at multiples of 10 s, [0] elsewhere */
+};
+
+/* plays up to <samples> into <out> and returns how many were played before
+ * the track ended */
+static long play (Music_Emu * emu, short * out, long samples)
+{
+    long played = 0;
+
+    while (played < samples && ! emu->track_ended ())
+    {
+        if (emu->play (BLOCK, out + played))
+            break;
+
+        played += BLOCK;
+    }
+
+    return played;
+}
+
+static bool open_track (Music_Emu * & emu, const char * path, long snapshot_period)
+{
+    emu = load_console_file (path, RATE);
+    if (! emu)
+        return false;
+
+    emu->ignore_silence (true);
+    emu->set_snapshot_period (snapshot_period);
+
+    blargg_err_t err = emu->start_track (0);
+    if (err)
+    {
+        printf ("%s: %s\n", path, err);
+        gme_delete (emu);
+        return false;
+    }
+
+    return true;
+}
+
+static SeekResult bench_seeks (const char * path, long snapshot_period,
+ const std::vector<short> & linear)
+{
+    SeekResult result = {0, {0, 0}, {0, 0}};
+    Music_Emu * emu;
+
+    if (! open_track (emu, path, snapshot_period))
+        return result;
+
+    std::vector<short> buf (linear.size () + BLOCK);
+    play (emu, buf.data (), linear.size ());
+
+    for (int target : targets)
+    {
+        long pos = (long) target * RATE * 2;
+        long count = std::min ((long) RATE * 2, (long) linear.size () - pos);
+
+        auto start = std::chrono::steady_clock::now ();
+        emu->seek (target * 1000L);
+        result.seconds += std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+
+        if (count < RATE * 2)
+            continue;  /* past the end of the track */
+
+        bool on_mark = (target % 10 == 0);
+        result.compared[on_mark] ++;
+
+        if (play (emu, buf.data (), count) >= count &&
+         ! memcmp (buf.data (), & linear[pos], count * sizeof (short)))
+            result.matched[on_mark] ++;
+    }
+
+    gme_delete (emu);
+    return result;
+}
+
+static void print_result (const char * name, const SeekResult & result)
+{
+    printf ("  %s %6.2f ms per seek; match linear playback: %d of %d at "
+     "10 s marks, %d of %d elsewhere\n", name,
+     result.seconds * 1000 / (sizeof targets / sizeof targets[0]),
+     result.matched[1], result.compared[1], result.matched[0], result.compared[0]);
+}
+
+static bool bench_file (const char * path)
+{
+    Music_Emu * emu;
+    if (! open_track (emu, path, 0))
+        return false;
+
+    std::vector<short> linear ((long) SECONDS * RATE * 2 + BLOCK);
+    linear.resize (play (emu, linear.data (), (long) SECONDS * RATE * 2));
+    gme_delete (emu);
+
+    printf ("%s (%.0f s played):\n", path, linear.size () / (2.0 * RATE));
+    print_result ("with snapshots:   ", bench_seeks (path, 10 * 1000, linear));
+    print_result ("without snapshots:", bench_seeks (path, 0, linear));
+
+    return true;
+}
+
+int main (int argc, char * * argv)
+{
+    if (argc < 2)
+    {
+        fprintf (stderr, "usage: %s file...\n", argv[0]);
+        return 1;
+    }
+
+    bool ok = true;
+    for (int i = 1; i < argc; i ++)
+        ok = bench_file (argv[i]) && ok;
+
+    return ok ? 0 : 1;
+}
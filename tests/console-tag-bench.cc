@@ -0,0 +1,63 @@
+/*
+ * Measures tag reading in the console plugin: the time to open each file
+ * given, load it with an info-only emulator and get the first track's info,
+ * as read_tag() does.  The files are read repeatedly, so they come from the
+ * page cache; the tags read are printed to check that they are unchanged.
+ *
+ *   make -C tests console-tag-bench
+ *   tests/console-tag-bench song.vgz song.spc album.nsfe ...
+ */
+
+#include <stdio.h>
+
+#include <chrono>
+
+#include "console-file.h"
+
+#define ROUNDS 2000
+
+static bool bench_file (const char * path)
+{
+    track_info_t info;
+
+    auto start = std::chrono::steady_clock::now ();
+
+    for (int round = 0; round < ROUNDS; round ++)
+    {
+        Music_Emu * emu = load_console_file (path, gme_info_only);
+        if (! emu)
+            return false;
+
+        blargg_err_t err = emu->track_info (& info, 0);
+        gme_delete (emu);
+
+        if (err)
+        {
+            printf ("%s: %s\n", path, err);
+            return false;
+        }
+    }
+
+    double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+
+    printf ("%s: %.1f us per file\n  song \"%s\", game \"%s\", author \"%s\", "
+     "length %ld ms\n", path, seconds * 1e6 / ROUNDS, info.song, info.game,
+     info.author, info.length);
+
+    return true;
+}
+
+int main (int argc, char * * argv)
+{
+    if (argc < 2)
+    {
+        fprintf (stderr, "usage: %s file...\n", argv[0]);
+        return 1;
+    }
+
+    bool ok = true;
+    for (int i = 1; i < argc; i ++)
+        ok = bench_file (argv[i]) && ok;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,113 @@
+/*
+ * Measures the echo plugin.  The default single tap (500 ms, 50% feedback,
+ * 50% volume) is first checked against a plain per-sample delay line, fed in
+ * blocks of random length; then the time per sample is measured with one and
+ * with three taps.
+ *
+ *   make -C tests bench
+ *
+ * The plugin source is included directly so that its settings can be
+ * changed; it needs the libaudcore headers (AUDACIOUS_CFLAGS in the Makefile).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <vector>
+
+#include "../src/echo_plugin/echo.cc"
+
+static unsigned seed = 1;
+
+static float noise ()
+{
+    seed = seed * 1103515245 + 12345;
+    return ((int) (seed >> 8 & 0xffff) - 32768) / 65536.0f;
+}
+
+/* returns the largest difference from the reference */
+static float check_single_tap (int channels, int rate)
+{
+    aud_plugin_instance.start (channels, rate);
+
+    std::vector<float> line (rate / 2 * channels);
+    size_t pos = 0;
+    float max_error = 0;
+
+    for (int block = 0; block < 200; block ++)
+    {
+        seed = seed * 1103515245 + 12345;
+        int samples = ((seed >> 16) % 3000 + 1) * channels;
+
+        Index<float> data;
+        data.resize (samples);
+
+        std::vector<float> in (samples);
+        for (int i = 0; i < samples; i ++)
+            in[i] = data[i] = noise ();
+
+        aud_plugin_instance.process (data);
+
+        for (int i = 0; i < samples; i ++)
+        {
+            float echo = line[pos];
+            line[pos] = in[i] + echo * 0.5f;
+            pos = (pos + 1) % line.size ();
+
+            max_error = aud::max (max_error, fabsf (in[i] + echo * 0.5f - data[i]));
+        }
+    }
+
+    return max_error;
+}
+
+/* 512-frame blocks, as most output plugins ask for */
+static void bench_taps (const char * name, int channels, int rate)
+{
+    const int rounds = 20000;
+
+    aud_plugin_instance.start (channels, rate);
+
+    Index<float> data;
+    data.resize (512 * channels);
+
+    volatile float sink = 0;
+    auto start = std::chrono::steady_clock::now ();
+
+    for (int round = 0; round < rounds; round ++)
+    {
+        for (float & sample : data)
+            sample = 0.1f;
+
+        sink = sink + aud_plugin_instance.process (data)[7];
+    }
+
+    double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+
+    printf ("%s: %.2f ns/sample\n", name, seconds * 1e9 / ((double) rounds * data.len ()));
+}
+
+int main ()
+{
+    aud_plugin_instance.init ();
+
+    float error = check_single_tap (2, 44100);
+    printf ("single tap against reference: max error %.1e (%s)\n", error,
+     error < 1e-5f ? "ok" : "FAILED");
+
+    bench_taps ("1 tap", 2, 44100);
+
+    aud_set_int ("echo_plugin", "delay2", 300);
+    aud_set_int ("echo_plugin", "feedback2", 20);
+    aud_set_int ("echo_plugin", "volume2", 30);
+    aud_set_int ("echo_plugin", "delay3", 700);
+    aud_set_int ("echo_plugin", "volume3", 40);
+    update_config ();
+
+    bench_taps ("3 taps", 2, 44100);
+
+    aud_plugin_instance.cleanup ();
+
+    return error < 1e-5f ? 0 : 1;
+}
@@ -0,0 +1,327 @@
+/*
+ * Measures the ffaudio plugin's decode loop: each file given is decoded to
+ * /dev/null twice, once with a new packet and frame for every iteration and
+ * audio_interlace() for planar formats, as the plugin used to, and once
+ * reusing the packet, the frame and the interleave buffer with the plugin's
+ * own interleaving kernels, as it does now.  For each, the decoded frames per
+ * second and the allocations (calls to malloc and friends) per second are
+ * reported, the latter also per second of audio.  The demuxer still allocates
+ * the data of each packet it reads, so the reusing loop is not at zero; the
+ * difference between the two is what reusing saves.
+ *
+ *   make -C tests ffaudio-decode-bench
+ *   tests/ffaudio-decode-bench song.opus song.flac ...
+ *
+ * The plugin source is included directly so that its helpers can be used; it
+ * needs the libaudcore and FFmpeg headers (AUDACIOUS_CFLAGS and FFMPEG_CFLAGS
+ * in the Makefile).  Allocations are counted by wrapping the glibc allocator,
+ * so this only builds against glibc.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <chrono>
+
+#include "../src/ffaudio/ffaudio-core.cc"
+
+static std::atomic<long> allocations;
+
+extern "C" {
+
+void * __libc_malloc (size_t size);
+void * __libc_calloc (size_t count, size_t size);
+void * __libc_realloc (void * ptr, size_t size);
+void * __libc_memalign (size_t align, size_t size);
+
+void * malloc (size_t size)
+{
+    allocations.fetch_add (1, std::memory_order_relaxed);
+    return __libc_malloc (size);
+}
+
+void * calloc (size_t count, size_t size)
+{
+    allocations.fetch_add (1, std::memory_order_relaxed);
+    return __libc_calloc (count, size);
+}
+
+void * realloc (void * ptr, size_t size)
+{
+    allocations.fetch_add (1, std::memory_order_relaxed);
+    return __libc_realloc (ptr, size);
+}
+
+void * memalign (size_t align, size_t size)
+{
+    allocations.fetch_add (1, std::memory_order_relaxed);
+    return __libc_memalign (align, size);
+}
+
+void * aligned_alloc (size_t align, size_t size)
+{
+    allocations.fetch_add (1, std::memory_order_relaxed);
+    return __libc_memalign (align, size);
+}
+
+int posix_memalign (void * * ptr, size_t align, size_t size)
+{
+    allocations.fetch_add (1, std::memory_order_relaxed);
+    * ptr = __libc_memalign (align, size);
+    return * ptr ? 0 : ENOMEM;
+}
+
+} /* extern "C" */
+
+/* sends <tmp> to the decoder, as FFaudio::play does */
+static bool send_packet (AVCodecContext * context, AVPacket & tmp)
+{
+#ifdef SEND_PACKET
+    return avcodec_send_packet (context, & tmp) >= 0;
+#else
+    return true;
+#endif
+}
+
+/* gets the next frame decoded from <tmp>; false when the next packet is
+ * needed */
+static bool receive_frame (AVCodecContext * context, AVPacket & tmp, AVFrame * frame)
+{
+#ifdef SEND_PACKET
+    return avcodec_receive_frame (context, frame) >= 0;
+#else
+    while (1)
+    {
+        int decoded = 0;
+        int len = avcodec_decode_audio4 (context, frame, & decoded, & tmp);
+
+        if (len < 0)
+            return false;
+
+        tmp.size -= len;
+        tmp.data += len;
+
+        if (decoded)
+            return true;
+        if (tmp.size <= 0)
+            return false;
+    }
+#endif
+}
+
+/* a mutable (shallow) copy of <pkt>, or an empty packet to flush the
+ * decoder at the end */
+static AVPacket packet_to_send (AVPacket & pkt, bool eof)
+{
+    AVPacket tmp;
+
+    if (eof)
+    {
+        tmp = AVPacket ();
+        av_init_packet (& tmp);
+    }
+    else
+        tmp = pkt;
+
+    return tmp;
+}
+
+/* the loop as it was: a packet per read and a frame per decoded frame */
+static int64_t decode_allocating (AVFormatContext * ic, int stream_idx,
+ AVCodecContext * context, int out_fmt, bool planar, FILE * sink)
+{
+    int64_t frames = 0;
+    bool eof = false;
+    Index<char> buf;
+
+    while (! eof)
+    {
+        ScopedPacket pkt;
+        int ret = av_read_frame (ic, & pkt);
+
+        if (ret == (int) AVERROR_EOF)
+            eof = true;
+        else if (ret < 0)
+            return -1;
+        else if (pkt.stream_index != stream_idx)
+            continue;
+
+        AVPacket tmp = packet_to_send (pkt, eof);
+        if (! send_packet (context, tmp))
+            return -1;
+
+        while (1)
+        {
+            ScopedFrame frame;
+
+            if (! receive_frame (context, tmp, frame.ptr))
+                break;
+
+            int size = FMT_SIZEOF (out_fmt) * context->channels * frame->nb_samples;
+
+            if (planar)
+            {
+                if (size > buf.len ())
+                    buf.resize (size);
+
+                audio_interlace ((const void * *) frame->data, out_fmt,
+                 context->channels, buf.begin (), frame->nb_samples);
+                fwrite (buf.begin (), 1, size, sink);
+            }
+            else
+                fwrite (frame->data[0], 1, size, sink);
+
+            frames += frame->nb_samples;
+        }
+    }
+
+    return frames;
+}
+
+/* the loop as it is now: one packet, one frame and one buffer for all */
+static int64_t decode_reusing (AVFormatContext * ic, int stream_idx,
+ AVCodecContext * context, int out_fmt, bool planar, FILE * sink)
+{
+    int64_t frames = 0;
+    bool eof = false;
+
+    ScopedPacket pkt;
+    ScopedFrame frame;
+    Index<char> buf;
+
+    while (! eof)
+    {
+        pkt.unref ();
+        int ret = av_read_frame (ic, & pkt);
+
+        if (ret == (int) AVERROR_EOF)
+            eof = true;
+        else if (ret < 0)
+            return -1;
+        else if (pkt.stream_index != stream_idx)
+            continue;
+
+        AVPacket tmp = packet_to_send (pkt, eof);
+        if (! send_packet (context, tmp))
+            return -1;
+
+        while (receive_frame (context, tmp, frame.ptr))
+        {
+            int size = FMT_SIZEOF (out_fmt) * context->channels * frame->nb_samples;
+
+            if (planar)
+            {
+                if (size > buf.len ())
+                    buf.resize (size);
+
+                interleave ((const void * const *) frame->extended_data, out_fmt,
+                 context->channels, buf.begin (), frame->nb_samples);
+                fwrite (buf.begin (), 1, size, sink);
+            }
+            else
+                fwrite (frame->data[0], 1, size, sink);
+
+            frames += frame->nb_samples;
+        }
+    }
+
+    return frames;
+}
+
+typedef int64_t (* DecodeFunc) (AVFormatContext * ic, int stream_idx,
+ AVCodecContext * context, int out_fmt, bool planar, FILE * sink);
+
+static bool run_loop (const char * path, const char * name, DecodeFunc decode,
+ FILE * sink, AVFormatContext * ic, const CodecInfo & cinfo)
+{
+    ScopedContext context (cinfo);
+    int out_fmt; bool planar;
+
+    if (avcodec_open2 (context.ptr, cinfo.codec, nullptr) < 0 ||
+     ! convert_format (context->sample_fmt, out_fmt, planar))
+    {
+        printf ("%s: cannot open %s decoder\n", path, cinfo.codec->name);
+        return false;
+    }
+
+    long allocs_before = allocations.load ();
+    auto start = std::chrono::steady_clock::now ();
+
+    int64_t frames = decode (ic, cinfo.stream_idx, context.ptr, out_fmt, planar, sink);
+
+    double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+    long allocs = allocations.load () - allocs_before;
+
+    if (frames < 0)
+    {
+        printf ("%s: decoding failed\n", path);
+        return false;
+    }
+
+    double audio = (double) frames / context->sample_rate;
+
+    printf ("%s: %s, %s %d ch%s: %.0f frames/s (%.0fx real time), "
+     "%.0f allocations/s, %.1f per second of audio\n", path, name,
+     cinfo.codec->name, context->channels, planar ? " planar" : "",
+     frames / seconds, audio / seconds, allocs / seconds,
+     audio > 0 ? allocs / audio : 0);
+
+    return true;
+}
+
+static bool bench_loop (const char * path, const char * name, DecodeFunc decode, FILE * sink)
+{
+    AVFormatContext * ic = nullptr;
+
+    if (avformat_open_input (& ic, path, nullptr, nullptr) < 0)
+    {
+        printf ("%s: cannot open file\n", path);
+        return false;
+    }
+
+    bool ok = false;
+    AVCodec * codec = nullptr;
+    int stream_idx = -1;
+
+    if (avformat_find_stream_info (ic, nullptr) >= 0)
+        stream_idx = av_find_best_stream (ic, AVMEDIA_TYPE_AUDIO, -1, -1, & codec, 0);
+
+    if (stream_idx < 0)
+        printf ("%s: no audio stream found\n", path);
+    else
+    {
+        CodecInfo cinfo = {stream_idx, ic->streams[stream_idx], codec};
+        ok = run_loop (path, name, decode, sink, ic, cinfo);
+    }
+
+    avformat_close_input (& ic);
+    return ok;
+}
+
+int main (int argc, char * * argv)
+{
+    if (argc < 2)
+    {
+        fprintf (stderr, "usage: %s file...\n", argv[0]);
+        return 1;
+    }
+
+    av_register_all ();
+    av_log_set_level (AV_LOG_ERROR);
+
+    FILE * sink = fopen ("/dev/null", "w");
+    if (! sink)
+        return 1;
+
+    bool ok = true;
+
+    for (int i = 1; i < argc; i ++)
+    {
+        ok = bench_loop (argv[i], "allocating", decode_allocating, sink) && ok;
+        ok = bench_loop (argv[i], "reusing", decode_reusing, sink) && ok;
+    }
+
+    fclose (sink);
+    return ok ? 0 : 1;
+}
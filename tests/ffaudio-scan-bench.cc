@@ -0,0 +1,261 @@
+/*
+ * Measures the ffaudio plugin's probe cache on a playlist scan.  The files
+ * given are treated as a playlist and are gone through three times, as
+ * Audacious does:
+ *
+ *   scan:    is_our_file() and read_tag() for each file, when they are added
+ *   rescan:  read_tag() for each file again, when the playlist is refreshed
+ *   play:    opening each file and finding its stream, as play() does before
+ *            it starts decoding
+ *
+ * This is done once with the probe cache on, starting cold, and once with it
+ * off (cleared before every call, so that each call probes the format and
+ * runs avformat_find_stream_info() itself, as it did before the cache).  For
+ * each phase, the time per file and the number of files whose stream was
+ * already cached, so that find_codec_cached() could skip
+ * avformat_find_stream_info(), are reported.  With more files than the cache
+ * holds (PROBE_CACHE_SIZE, 32), a scan in playlist order evicts each entry
+ * before it is used again, which the hit counts show.
+ *
+ * The tuples read, and the stream, codec, duration and start time found when
+ * opening, must be the same with the cache on as with it off.
+ *
+ *   make -C tests ffaudio-scan-bench
+ *   tests/ffaudio-scan-bench song1.flac song2.opus song3.m4a ...
+ *
+ * The plugin source is included directly so that its cache can be cleared
+ * and inspected; it needs the libaudcore and FFmpeg headers (AUDACIOUS_CFLAGS
+ * and FFMPEG_CFLAGS in the Makefile).  The files are read repeatedly, so they
+ * come from the page cache.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "../src/ffaudio/ffaudio-core.cc"
+
+#define ROUNDS 5
+
+enum {
+    PHASE_SCAN,
+    PHASE_RESCAN,
+    PHASE_PLAY,
+    N_PHASES
+};
+
+static const char * const phase_names[N_PHASES] = {"scan", "rescan", "play"};
+
+/* what play() finds when opening a file */
+struct OpenInfo
+{
+    bool found = false;
+    int stream_idx = -1;
+    String codec;
+    int64_t duration = AV_NOPTS_VALUE;
+    int64_t start_time = AV_NOPTS_VALUE;
+    int64_t stream_start_time = AV_NOPTS_VALUE;
+
+    bool operator== (const OpenInfo & b) const
+    {
+        return found == b.found && stream_idx == b.stream_idx &&
+         codec == b.codec && duration == b.duration &&
+         start_time == b.start_time && stream_start_time == b.stream_start_time;
+    }
+};
+
+struct Results
+{
+    double seconds[N_PHASES] {};
+    int cached[N_PHASES] {};
+    Index<Tuple> scan_tuples, rescan_tuples;
+    Index<OpenInfo> opened;
+};
+
+static void clear_probe_cache ()
+{
+    pthread_mutex_lock (& probe_mutex);
+    probe_cache.clear ();
+    pthread_mutex_unlock (& probe_mutex);
+}
+
+/* looks up the file without moving it to the front, so that counting doesn't
+ * change what gets evicted */
+static bool stream_cached (const char * uri)
+{
+    FileID id (uri);
+    bool cached = false;
+
+    pthread_mutex_lock (& probe_mutex);
+
+    for (const ProbeResult & entry : probe_cache)
+    {
+        if (entry.id == id)
+            cached = (entry.stream_idx >= 0);
+    }
+
+    pthread_mutex_unlock (& probe_mutex);
+
+    return cached;
+}
+
+static Tuple scan_file (const char * uri, bool with_probe, bool cache)
+{
+    Tuple tuple;
+    VFSFile file (uri, "r");
+
+    if (! file)
+        return tuple;
+
+    if (with_probe)
+    {
+        if (! cache)
+            clear_probe_cache ();
+
+        if (! aud_plugin_instance.is_our_file (uri, file))
+            return tuple;
+    }
+
+    if (! cache)
+        clear_probe_cache ();
+
+    aud_plugin_instance.read_tag (uri, file, tuple, nullptr);
+    return tuple;
+}
+
+static OpenInfo open_file (const char * uri, bool cache)
+{
+    OpenInfo info;
+    VFSFile file (uri, "r");
+
+    if (! file)
+        return info;
+
+    if (! cache)
+        clear_probe_cache ();
+
+    FileID id (uri);
+    SmartPtr<AVFormatContext, close_input_file> ic (open_input_file (uri, file, id));
+    CodecInfo cinfo;
+
+    if (ic && find_codec (ic.get (), & cinfo, id))
+    {
+        info.found = true;
+        info.stream_idx = cinfo.stream_idx;
+        info.codec = String (cinfo.codec->name);
+        info.duration = ic->duration;
+        info.start_time = ic->start_time;
+        info.stream_start_time = cinfo.stream->start_time;
+    }
+
+    return info;
+}
+
+/* one pass over the playlist; the probe cache starts empty either way */
+static void run_pass (const Index<String> & uris, bool cache, Results & res)
+{
+    clear_probe_cache ();
+
+    for (int phase = 0; phase < N_PHASES; phase ++)
+    {
+        for (const String & uri : uris)
+        {
+            /* not timed, since it has to stat the file */
+            if (cache && stream_cached (uri))
+                res.cached[phase] ++;
+
+            auto start = std::chrono::steady_clock::now ();
+
+            if (phase == PHASE_SCAN)
+                res.scan_tuples.append (scan_file (uri, true, cache));
+            else if (phase == PHASE_RESCAN)
+                res.rescan_tuples.append (scan_file (uri, false, cache));
+            else
+                res.opened.append (open_file (uri, cache));
+
+            res.seconds[phase] += std::chrono::duration<double>
+             (std::chrono::steady_clock::now () - start).count ();
+        }
+    }
+}
+
+static void print_results (bool cache, const Results & res, int files)
+{
+    for (int phase = 0; phase < N_PHASES; phase ++)
+    {
+        printf ("cache %s, %s: %.3f ms per file", cache ? "on" : "off", phase_names[phase],
+         res.seconds[phase] * 1000 / (files * ROUNDS));
+
+        if (cache)
+            printf (", %d of %d streams cached", res.cached[phase] / ROUNDS, files);
+
+        printf ("\n");
+    }
+}
+
+int main (int argc, char * * argv)
+{
+    if (argc < 2)
+    {
+        fprintf (stderr, "usage: %s file...\n", argv[0]);
+        return 1;
+    }
+
+    av_register_all ();
+    av_log_set_level (AV_LOG_ERROR);
+    create_extension_dict ();
+
+    Index<String> uris;
+    for (int i = 1; i < argc; i ++)
+    {
+        if (strstr (argv[i], "://"))
+            uris.append (String (argv[i]));
+        else
+            uris.append (String (filename_to_uri (argv[i])));
+    }
+
+    Results off, on;
+
+    for (int round = 0; round < ROUNDS; round ++)
+    {
+        run_pass (uris, false, off);
+        run_pass (uris, true, on);
+    }
+
+    printf ("%d files, probe cache of %d\n", uris.len (), PROBE_CACHE_SIZE);
+    print_results (false, off, uris.len ());
+    print_results (true, on, uris.len ());
+
+    bool ok = true;
+
+    for (int f = 0; f < uris.len (); f ++)
+    {
+        const char * error = nullptr;
+
+        for (int i = f; ! error && i < off.opened.len (); i += uris.len ())
+        {
+            if (! off.opened[i].found)
+                error = "cannot open";
+            else if (on.scan_tuples[i] != off.scan_tuples[i] ||
+             on.rescan_tuples[i] != off.rescan_tuples[i])
+                error = "tuples DIFFER with the cache on";
+            else if (! (on.opened[i] == off.opened[i]))
+                error = "stream info DIFFERS with the cache on";
+        }
+
+        if (error)
+        {
+            printf ("%s: %s\n", argv[1 + f], error);
+            ok = false;
+        }
+    }
+
+    if (ok)
+        printf ("tuples and stream info match\n");
+
+    clear_probe_cache ();
+    extension_dict.clear ();
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,79 @@
+/*
+ * Measures Fir_Resampler::read() throughput for each FIR width in use (12 in
+ * Dual_Resampler, 24 in Spc_Emu) and each kernel the CPU supports.
+ *
+ *   make -C tests bench
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "Fir_Resampler.h"
+
+static const char * const kernel_names[] = {"scalar", "SSE2", "AVX2", "NEON"};
+
+/* input blocks per measurement */
+#define ROUNDS 20000
+
+template<int width>
+static void bench_width ()
+{
+    static short src[4096], out[8192];
+    unsigned seed = 1;
+
+    for (short & s : src)
+    {
+        seed = seed * 1103515245 + 12345;
+        s = (short) (seed >> 16);
+    }
+
+    printf ("width %2d:", width);
+
+    for (int k = Fir_Resampler_::kernel_scalar; k <= Fir_Resampler_::kernel_neon; k ++)
+    {
+        if (! Fir_Resampler_::set_kernel ((Fir_Resampler_::kernel_t) k))
+            continue;
+
+        /* the SPC rate to 44.1 kHz, as most of the emulators use */
+        Fir_Resampler<width> fir;
+        fir.buffer_size (4096);
+        fir.time_ratio (32000.0 / 44100);
+
+        double seconds = 0;
+        long samples = 0;
+        unsigned hash = 0;
+
+        for (int round = 0; round < ROUNDS; round ++)
+        {
+            int n = fir.max_write ();
+            memcpy (fir.buffer (), src, n * sizeof (short));
+            fir.write (n);
+
+            auto start = std::chrono::steady_clock::now ();
+            int count = fir.read (out, 8192);
+            seconds += std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+
+            samples += count;
+            for (int i = 0; i < count; i ++)
+                hash = hash * 31 + (unsigned short) out[i];
+        }
+
+        printf ("  %s %.0f M samples/s (%08x)", kernel_names[k], samples / seconds / 1e6, hash);
+    }
+
+    printf ("\n");
+}
+
+int main ()
+{
+    bench_width<8> ();
+    bench_width<12> ();
+    bench_width<16> ();
+    bench_width<24> ();
+    bench_width<32> ();
+
+    return 0;
+}
@@ -0,0 +1,125 @@
+/*
+ * Checks that every Fir_Resampler kernel the CPU supports gives exactly the
+ * same output as the scalar one, for all FIR widths in use and several
+ * resampling ratios, with input and output in blocks of varying size.
+ *
+ *   make -C tests check
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "Fir_Resampler.h"
+
+static const char * const kernel_names[] = {"scalar", "SSE2", "AVX2", "NEON"};
+
+static const double ratios[] = {32000.0 / 44100, 44100.0 / 48000, 48000.0 / 44100,
+ 0.5, 1.0, 1.5, 2.0 / 3};
+
+/* resamples <in> with the given kernel, writing and reading blocks of
+ * pseudo-random size */
+template<int width>
+static std::vector<short> resample (Fir_Resampler_::kernel_t kernel,
+ const std::vector<short> & in, double ratio, double rolloff)
+{
+    Fir_Resampler_::set_kernel (kernel);
+
+    Fir_Resampler<width> fir;
+    fir.buffer_size (4096);
+    fir.time_ratio (ratio, rolloff);
+
+    std::vector<short> out;
+    short block[2048];
+    unsigned seed = 1;
+    size_t pos = 0;
+
+    while (pos < in.size ())
+    {
+        seed = seed * 1103515245 + 12345;
+        int count = ((seed >> 16) % (fir.max_write () / 2) + 1) * 2;
+        count = (int) std::min ((size_t) count, in.size () - pos);
+
+        memcpy (fir.buffer (), & in[pos], count * sizeof (short));
+        fir.write (count);
+        pos += count;
+
+        seed = seed * 1103515245 + 12345;
+        int n = fir.read (block, ((seed >> 16) % 1024 + 1) * 2);
+        out.insert (out.end (), block, block + n);
+    }
+
+    int n;
+    while ((n = fir.read (block, 2048)) > 0)
+        out.insert (out.end (), block, block + n);
+
+    return out;
+}
+
+template<int width>
+static int test_width (const std::vector<short> & in)
+{
+    int failed = 0;
+
+    for (double ratio : ratios)
+    {
+        for (double rolloff : {0.999, 0.9})
+        {
+            auto expected = resample<width> (Fir_Resampler_::kernel_scalar, in, ratio, rolloff);
+
+            for (int k = Fir_Resampler_::kernel_sse2; k <= Fir_Resampler_::kernel_neon; k ++)
+            {
+                auto kernel = (Fir_Resampler_::kernel_t) k;
+                if (! Fir_Resampler_::set_kernel (kernel))
+                    continue;
+
+                auto got = resample<width> (kernel, in, ratio, rolloff);
+
+                size_t i = 0;
+                while (i < expected.size () && i < got.size () && got[i] == expected[i])
+                    i ++;
+
+                if (i < expected.size () || i < got.size ())
+                {
+                    printf ("FAIL: width %d, ratio %.4f, rolloff %.3f: %s differs from "
+                     "scalar at sample %zu of %zu\n", width, ratio, rolloff,
+                     kernel_names[k], i, expected.size ());
+                    failed ++;
+                }
+            }
+        }
+    }
+
+    printf ("width %2d: %s\n", width, failed ? "FAILED" : "ok");
+    return failed;
+}
+
+int main ()
+{
+    /* full-scale noise, so that intermediate sums wrap */
+    std::vector<short> in (2 * 48000);
+    unsigned seed = 12345;
+
+    for (short & s : in)
+    {
+        seed = seed * 1103515245 + 12345;
+        s = (short) (seed >> 16);
+    }
+
+    printf ("kernels:");
+    for (int k = Fir_Resampler_::kernel_scalar; k <= Fir_Resampler_::kernel_neon; k ++)
+    {
+        if (Fir_Resampler_::set_kernel ((Fir_Resampler_::kernel_t) k))
+            printf (" %s", kernel_names[k]);
+    }
+    printf ("\n");
+
+    int failed = test_width<4> (in) + test_width<6> (in) + test_width<8> (in) +
+     test_width<10> (in) + test_width<12> (in) + test_width<14> (in) +
+     test_width<16> (in) + test_width<20> (in) + test_width<24> (in) +
+     test_width<32> (in);
+
+    return failed ? 1 : 0;
+}
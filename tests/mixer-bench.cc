@@ -0,0 +1,92 @@
+/*
+ * Measures the channel mixer: for common shapes, the fixed-shape kernel the
+ * plugin picks against the generic loop (time per frame), and the largest
+ * difference between the plugin's output and the generic loop's.
+ *
+ *   make -C tests bench
+ *
+ * The plugin source is included directly so that the kernels can be called;
+ * it needs the libaudcore headers (AUDACIOUS_CFLAGS in the Makefile).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <vector>
+
+#include "../src/mixer/mixer.cc"
+
+static const struct {
+    int in, out;
+} shapes[] = {
+    {8, 2},
+    {6, 2},
+    {8, 6},
+    {2, 6},
+    {3, 2}  /* no fixed kernel */
+};
+
+#define ROUNDS 20000
+#define BLOCK 1024
+
+static double time_kernel (MixFunc func, int in_channels, int out_channels)
+{
+    Index<float> in, out;
+    in.resize (BLOCK * in_channels);
+    out.resize (BLOCK * out_channels);
+
+    auto start = std::chrono::steady_clock::now ();
+
+    for (int round = 0; round < ROUNDS; round ++)
+        func (in.begin (), out.begin (), BLOCK);
+
+    double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+    return seconds * 1e9 / ((double) ROUNDS * BLOCK);
+}
+
+static bool bench_shape (int in_channels, int out_channels)
+{
+    aud_set_int ("mixer", "channels", out_channels);
+    aud_set_int ("mixer", "matrix", MATRIX_ITU);
+
+    int channels = in_channels, rate = 48000;
+    aud_plugin_instance.start (channels, rate);
+
+    /* an odd number of frames, to cover the kernels' tails */
+    int frames = 4099;
+    Index<float> data;
+    data.resize (frames * in_channels);
+
+    for (int i = 0; i < data.len (); i ++)
+        data[i] = (i * 7919 % 1000) / 1000.0f - 0.5f;
+
+    std::vector<float> expected (frames * out_channels);
+    mix_generic (data.begin (), expected.data (), frames);
+
+    Index<float> & got = aud_plugin_instance.process (data);
+
+    float error = (got.len () == frames * out_channels) ? 0 : INFINITY;
+    for (int i = 0; i < got.len () && i < (int) expected.size (); i ++)
+        error = aud::max (error, fabsf (got[i] - expected[i]));
+
+    printf ("%d -> %d: %s kernel %.2f ns/frame, generic loop %.2f ns/frame, max difference %g\n",
+     in_channels, out_channels, mix_func == mix_generic ? "generic" : "fixed",
+     time_kernel (mix_func, in_channels, out_channels),
+     time_kernel (mix_generic, in_channels, out_channels), error);
+
+    return error < 1e-6f;
+}
+
+int main ()
+{
+    aud_plugin_instance.init ();
+
+    bool ok = true;
+    for (auto & shape : shapes)
+        ok = bench_shape (shape.in, shape.out) && ok;
+
+    aud_plugin_instance.cleanup ();
+
+    return ok ? 0 : 1;
+}
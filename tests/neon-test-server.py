@@ -0,0 +1,163 @@
+#!/usr/bin/env python3
+#
+# Local HTTP(S) server for testing the neon transport plugin.
+#
+# Serves one file with support for ranged requests and persistent connections,
+# and reports how many requests each connection carried and how long each
+# request took to answer, so that session reuse and seek latency can be
+# measured while playing the file in Audacious:
+#
+#   tests/neon-test-server.py --latency 100 song.mp3
+#   audacious http://127.0.0.1:8000/song.mp3
+#   audtool playback-seek 60; audtool playback-seek 10; ...
+#
+# The path /redirect answers with a 302 to the file, to test redirects.
+# --latency delays the first response on each new connection, standing in for
+# the TCP and TLS handshakes of a distant server; with --cert and --key the
+# server speaks HTTPS.  --rate throttles each response, so that the plugin's
+# read-ahead (two connections fetching ranges at once) makes a difference.
+# A summary is printed on Ctrl-C or SIGTERM.
+
+import argparse
+import http.server
+import os
+import re
+import signal
+import socketserver
+import ssl
+import sys
+import threading
+import time
+
+stats_lock = threading.Lock()
+connections = []  # number of requests carried by each connection
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def setup(self):
+        super().setup()
+        self.requests = 0
+        with stats_lock:
+            self.index = len(connections)
+            connections.append(0)
+
+    def log_message(self, fmt, *args):
+        pass
+
+    def do_GET(self):
+        start = time.monotonic()
+
+        if self.requests == 0 and args.latency:
+            time.sleep(args.latency / 1000)
+
+        self.requests += 1
+        with stats_lock:
+            connections[self.index] = self.requests
+
+        if self.path == '/redirect':
+            body = b'Moved\n'
+            self.send_response(302)
+            self.send_header('Location', '/' + os.path.basename(args.file))
+            self.send_header('Content-Length', str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+            self.report(start, 'redirect')
+            return
+
+        size = os.path.getsize(args.file)
+        first, last = 0, size - 1
+
+        match = re.match(r'bytes=(\d+)-(\d*)$', self.headers.get('Range', ''))
+        if match:
+            first = int(match.group(1))
+            if match.group(2):
+                last = min(int(match.group(2)), size - 1)
+
+        if first >= size:
+            self.send_response(416)
+            self.send_header('Content-Range', 'bytes */%d' % size)
+            self.send_header('Content-Length', '0')
+            self.end_headers()
+            self.report(start, 'bytes %d- (out of range)' % first)
+            return
+
+        self.send_response(206 if match else 200)
+        self.send_header('Accept-Ranges', 'bytes')
+        self.send_header('Content-Length', str(last + 1 - first))
+        self.send_header('Content-Type', 'application/octet-stream')
+        self.send_header('ETag', '"%x-%x"' % (size, int(os.path.getmtime(args.file))))
+        if match:
+            self.send_header('Content-Range', 'bytes %d-%d/%d' % (first, last, size))
+        self.end_headers()
+
+        self.report(start, 'bytes %d-%d' % (first, last))
+
+        with open(args.file, 'rb') as f:
+            f.seek(first)
+            remain = last + 1 - first
+            while remain > 0:
+                block = f.read(min(remain, 65536))
+                if not block:
+                    break
+                try:
+                    self.wfile.write(block)
+                except (BrokenPipeError, ConnectionResetError):
+                    # the client dropped the connection, as it does when seeking
+                    self.close_connection = True
+                    return
+                remain -= len(block)
+                if args.rate:
+                    time.sleep(len(block) / (args.rate * 1024))
+
+    def report(self, start, what):
+        print('connection %d request %d: %s, answered in %.1f ms' % (self.index + 1,
+              self.requests, what, (time.monotonic() - start) * 1000), flush=True)
+
+
+class Server(socketserver.ThreadingMixIn, http.server.HTTPServer):
+    daemon_threads = True
+
+
+def summary():
+    with stats_lock:
+        total = sum(connections)
+        print('\n%d requests over %d connections (%.2f requests per connection)' %
+              (total, len(connections), total / max(len(connections), 1)))
+
+
+parser = argparse.ArgumentParser(description='HTTP test server for the neon plugin')
+parser.add_argument('file', help='file to serve')
+parser.add_argument('--port', type=int, default=8000)
+parser.add_argument('--latency', type=int, default=0,
+                    help='delay in ms before the first response on each connection')
+parser.add_argument('--rate', type=int, default=0,
+                    help='limit each response to this many KiB/s')
+parser.add_argument('--cert', help='certificate file, to serve HTTPS')
+parser.add_argument('--key', help='private key file for --cert')
+args = parser.parse_args()
+
+server = Server(('127.0.0.1', args.port), Handler)
+
+if args.cert:
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.load_cert_chain(args.cert, args.key)
+    server.socket = context.wrap_socket(server.socket, server_side=True)
+
+scheme = 'https' if args.cert else 'http'
+print('Serving %s at %s://127.0.0.1:%d/%s' % (args.file, scheme, args.port,
+                                              os.path.basename(args.file)), flush=True)
+
+def interrupt(signum, frame):
+    raise KeyboardInterrupt
+
+
+signal.signal(signal.SIGINT, interrupt)
+signal.signal(signal.SIGTERM, interrupt)
+
+try:
+    server.serve_forever()
+except KeyboardInterrupt:
+    summary()
+    sys.exit(0)
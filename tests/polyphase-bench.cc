@@ -0,0 +1,93 @@
+/*
+ * Measures the polyphase resampler: converts 10 seconds of a stereo 1 kHz
+ * tone between common rates and reports the residual against an ideal tone
+ * at the output rate, whether the output length is exact, and the share of
+ * one core used.
+ *
+ *   make -C tests bench
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <vector>
+
+#include "../src/resample/polyphase.h"
+
+static const struct {
+    int in_rate, out_rate;
+} conversions[] = {
+    {44100, 48000},
+    {48000, 44100},
+    {96000, 48000},
+    {8000, 48000}
+};
+
+#define SECONDS 10
+#define TONE 1000.0
+#define LEVEL 0.5
+
+/* input in blocks of this many frames, as the effect plugin would see it */
+#define BLOCK 1024
+
+static bool bench_conversion (int in_rate, int out_rate)
+{
+    PolyphaseResampler resampler;
+    if (! resampler.start (2, in_rate, out_rate))
+    {
+        printf ("%5d -> %5d: not a supported ratio\n", in_rate, out_rate);
+        return false;
+    }
+
+    int frames = in_rate * SECONDS;
+    std::vector<float> in (2 * frames);
+
+    for (int i = 0; i < frames; i ++)
+        in[2 * i] = in[2 * i + 1] = LEVEL * sin (2 * M_PI * TONE * i / in_rate);
+
+    Index<float> out;
+    std::vector<float> left;
+
+    auto start = std::chrono::steady_clock::now ();
+
+    for (int pos = 0; pos < frames; pos += BLOCK)
+    {
+        int count = aud::min (BLOCK, frames - pos);
+        resampler.process (& in[2 * pos], count, out, pos + count >= frames);
+
+        for (int i = 0; i < out.len (); i += 2)
+            left.push_back (out[i]);
+    }
+
+    double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+
+    /* skip the first and last second, where the filter sees the edges */
+    double error = 0, signal = 0;
+    for (size_t i = out_rate; i + out_rate < left.size (); i ++)
+    {
+        double ideal = LEVEL * sin (2 * M_PI * TONE * i / out_rate);
+        error += (left[i] - ideal) * (left[i] - ideal);
+        signal += ideal * ideal;
+    }
+
+    long expected = (long) ceil ((double) frames * out_rate / in_rate);
+    bool length_ok = ((long) left.size () == expected);
+
+    printf ("%5d -> %5d: residual %.1f dB, %zu frames out (%s), %.2f%% of one core\n",
+     in_rate, out_rate, 10 * log10 (error / signal), left.size (),
+     length_ok ? "exact" : "WRONG", seconds / SECONDS * 100);
+
+    return length_ok;
+}
+
+int main ()
+{
+    bool ok = true;
+
+    for (auto & c : conversions)
+        ok = bench_conversion (c.in_rate, c.out_rate) && ok;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,172 @@
+/*
+ * Tests the console plugin's render-ahead worker, built with ThreadSanitizer
+ * so that any race between it and the reading thread is reported.  Each file
+ * given is played through a RenderAhead as the plugin does (snapshots every
+ * 10 seconds, a 60-second length, a scout), with 40 seeks backwards and
+ * forwards mixed in, some landing in audio already rendered and some not.
+ * Everything read must match the same track played straight through.  Once
+ * the track has ended, the length the scout found is checked too: that of
+ * the straight playback if the track ended in silence, and none if it was
+ * faded out.
+ *
+ *   make -C tests render-ahead-test
+ *   tests/render-ahead-test song.vgm song.nsf ...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "console-file.h"
+#include "render_ahead.h"
+
+#define RATE 44100
+#define BLOCK (RATE / 10 * 2)  /* samples */
+#define LENGTH 60000           /* msec, fade included */
+#define FADE 8000              /* msec */
+#define SEEK_EVERY 40          /* blocks */
+#define SEEKS 40
+
+static long msec_to_samples (long msec)
+{
+    return (msec / 1000 * RATE + msec % 1000 * RATE / 1000) * 2;
+}
+
+static Music_Emu * open_track (const char * path)
+{
+    Music_Emu * emu = load_console_file (path, RATE);
+    if (! emu)
+        return nullptr;
+
+    emu->set_snapshot_period (10 * 1000);
+
+    if (emu->start_track (0))
+    {
+        printf ("%s: cannot start track\n", path);
+        gme_delete (emu);
+        return nullptr;
+    }
+
+    emu->set_fade (LENGTH - FADE, FADE);
+    return emu;
+}
+
+static bool test_file (const char * path)
+{
+    Music_Emu * emu = open_track (path);
+    if (! emu)
+        return false;
+
+    std::vector<short> linear;
+    Music_Emu::sample_t buf[BLOCK];
+
+    while (! emu->track_ended ())
+    {
+        emu->play (BLOCK, buf);
+        linear.insert (linear.end (), buf, buf + BLOCK);
+    }
+
+    long linear_msec = emu->tell ();
+    gme_delete (emu);
+
+    emu = open_track (path);
+    Music_Emu * scout = open_track (path);
+    if (! emu || ! scout)
+        return false;
+
+    RenderAhead ahead;
+    if (! ahead.start (emu, 10 * 1000, BLOCK, scout, LENGTH - FADE))
+        return false;
+
+    srand (1);
+
+    long pos = 0, last_seek = (long) linear.size () - msec_to_samples (2000);
+    int seeks = 0, blocks = 0, detected = -1;
+    bool ok = true, done = false;
+
+    while (ok)
+    {
+        if (++ blocks % SEEK_EVERY == 0 && seeks < SEEKS && last_seek > 0)
+        {
+            /* somewhere between the start and 8 seconds ahead, on a block
+             * boundary, since the fade steps its gain per block played */
+            long limit = std::min (pos + msec_to_samples (8000), last_seek);
+            long msec = rand () % (limit * 10 / (2 * RATE) + 1) * 100;
+
+            /* now and then, let the worker catch up first */
+            if (seeks % 2)
+                usleep (50 * 1000);
+
+            ahead.seek (msec);
+            pos = msec_to_samples (msec);
+            seeks ++;
+        }
+
+        int count = ahead.read (buf, BLOCK);
+
+        if (pos + count > (long) linear.size () ||
+         memcmp (buf, & linear[pos], count * sizeof buf[0]))
+        {
+            printf ("%s: output differs at %.3f s (after %d seeks)\n", path,
+             pos / (2.0 * RATE), seeks);
+            ok = false;
+        }
+
+        pos += count;
+
+        /* as the plugin does after each block */
+        if (! done && (done = ahead.scout_done ()))
+            detected = ahead.detected_length ();
+
+        if (count < BLOCK)
+            break;
+    }
+
+    /* the scout runs when there is nothing left to render */
+    for (int wait = 0; wait < 600 && ! done; wait ++)
+    {
+        usleep (50 * 1000);
+
+        if ((done = ahead.scout_done ()))
+            detected = ahead.detected_length ();
+    }
+
+    ahead.stop ();
+
+    gme_delete (emu);
+    gme_delete (scout);
+
+    /* a track that ended before its fade ended in silence */
+    long expected = (linear_msec < LENGTH - FADE) ? linear_msec : -1;
+
+    printf ("%s: %d seeks, output %s; length found %d ms, played %ld ms\n",
+     path, seeks, ok ? "matches" : "DIFFERS", detected, linear_msec);
+
+    if (! done || detected != expected)
+    {
+        printf ("%s: scout %s, expected length %ld ms\n", path,
+         done ? "done" : "NOT DONE", expected);
+        ok = false;
+    }
+
+    return ok;
+}
+
+int main (int argc, char * * argv)
+{
+    if (argc < 2)
+    {
+        fprintf (stderr, "usage: %s file...\n", argv[0]);
+        return 1;
+    }
+
+    bool ok = true;
+    for (int i = 1; i < argc; i ++)
+        ok = test_file (argv[i]) && ok;
+
+    return ok ? 0 : 1;
+}
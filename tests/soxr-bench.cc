@@ -0,0 +1,94 @@
+/*
+ * Measures the SoX resampler plugin's threading: 60 seconds of noise are
+ * resampled from 44.1 to 48 kHz at the "Very High" quality setting, with 2
+ * and 8 channels and 1 to 8 threads (as many as there are channels), and the
+ * real-time factor (seconds of audio per second of processing) is reported.
+ * The output with each thread count must be the same as with one thread.
+ *
+ *   make -C tests bench
+ *
+ * The plugin source is included directly; it needs the libaudcore headers and
+ * libsoxr (AUDACIOUS_CFLAGS and SOXR_CFLAGS/SOXR_LIBS in the Makefile).
+ */
+
+#include <stdio.h>
+
+#include <chrono>
+#include <vector>
+
+#include "../src/soxr/sox-resampler.cc"
+
+#define IN_RATE 44100
+#define OUT_RATE 48000
+#define SECONDS 60
+#define BLOCK 4096  /* frames, as the output plugins usually ask for */
+
+static const int channel_counts[] = {2, 8};
+
+/* returns the real-time factor, the output in <out> */
+static double run (int channels, int threads, std::vector<float> & out)
+{
+    aud_set_int ("soxr", "quality", SOXR_VHQ);
+    aud_set_int ("soxr", "rate", OUT_RATE);
+    aud_set_int ("soxr", "threads", threads);
+
+    int rate = IN_RATE;
+    aud_plugin_instance.start (channels, rate);
+
+    Index<float> data;
+    unsigned seed = 1;
+
+    out.clear ();
+
+    auto start = std::chrono::steady_clock::now ();
+
+    for (int done = 0; done < IN_RATE * SECONDS; done += BLOCK)
+    {
+        data.resize (BLOCK * channels);
+
+        for (float & sample : data)
+        {
+            seed = seed * 1103515245 + 12345;
+            sample = (int) (seed >> 16 & 0x7fff) / 16384.0f - 1;
+        }
+
+        Index<float> & result = aud_plugin_instance.process (data);
+        out.insert (out.end (), result.begin (), result.end ());
+    }
+
+    double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+
+    aud_plugin_instance.flush (true);
+    aud_plugin_instance.cleanup ();
+
+    return SECONDS / seconds;
+}
+
+int main ()
+{
+    aud_plugin_instance.init ();
+
+    bool ok = true;
+
+    for (int channels : channel_counts)
+    {
+        std::vector<float> expected, got;
+        double single = run (channels, 1, expected);
+
+        printf ("%d channels, 1 thread: %.1fx real time\n", channels, single);
+
+        for (int threads = 2; threads <= aud::min (channels, MAX_THREADS); threads ++)
+        {
+            double factor = run (channels, threads, got);
+            bool same = (got == expected);
+
+            printf ("%d channels, %d threads: %.1fx real time (%.2fx one thread), "
+             "output %s\n", channels, threads, factor, factor / single,
+             same ? "matches" : "DIFFERS");
+
+            ok = ok && same;
+        }
+    }
+
+    return ok ? 0 : 1;
+}